@@ -0,0 +1,44 @@
+# Convert the binary log written by AsyncLogger (Log/log.bin) into the text files used by plot.py:
+#   imu.txt, mat_pre.txt, mat_out.txt and camera_pose.txt (TUM format)
+# usage: python log_convert.py [log.bin] [output_dir]
+import os
+import sys
+import struct
+
+LOG_MAGIC = b'FLVLOG1\x00'
+LOG_FILES = {1: 'imu.txt', 2: 'mat_pre.txt', 3: 'mat_out.txt', 4: 'camera_pose.txt'}
+LOG_IMU, LOG_STATE_PRE, LOG_STATE_OUT, LOG_POSE_TUM = 1, 2, 3, 4
+
+def read_log(file_name):
+    records = {t: [] for t in LOG_FILES}
+    with open(file_name, 'rb') as f:
+        data = f.read()
+    if data[:8] != LOG_MAGIC:
+        raise ValueError('%s is not a fast_livo binary log' % file_name)
+    pos = 8
+    while pos + 8 <= len(data):
+        rec_type, num = struct.unpack_from('<II', data, pos)
+        pos += 8
+        if pos + 8 * num > len(data):
+            break  # truncated tail
+        records.setdefault(rec_type, []).append(struct.unpack_from('<%dd' % num, data, pos))
+        pos += 8 * num
+    return records
+
+def write_txt(file_name, rows, fmt):
+    with open(file_name, 'w') as f:
+        for row in rows:
+            f.write(' '.join(fmt(i, v) for i, v in enumerate(row)) + '\n')
+
+if __name__ == '__main__':
+    log_file = sys.argv[1] if len(sys.argv) > 1 else 'log.bin'
+    out_dir = sys.argv[2] if len(sys.argv) > 2 else os.path.dirname(os.path.abspath(log_file))
+    records = read_log(log_file)
+    for rec_type, file_name in LOG_FILES.items():
+        rows = records[rec_type]
+        if rec_type == LOG_POSE_TUM:
+            fmt = lambda i, v: '%.6f' % v
+        else:
+            fmt = lambda i, v: ('%d' % v) if (rec_type == LOG_STATE_OUT and i == 19) else ('%.9g' % v)
+        write_txt(os.path.join(out_dir, file_name), rows, fmt)
+        print('%s: %d records' % (file_name, len(rows)))
@@ -0,0 +1,167 @@
+# End-to-end accuracy and latency regression check on a recorded sequence.
+# The run is compared with a stored reference run of the same bag and config:
+#   accuracy: ATE / RPE of the TUM poses and RMSE of the mat_out states (read from log.bin)
+#   latency:  p50/p95 of the per-frame total time (metrics.txt) and of each traced stage (trace.json)
+# The check fails (exit code 1) when the accuracy drifts past the thresholds or a p95 latency regresses.
+#
+# usage:
+#   python regression.py save  <ref_dir> [--log-dir DIR] [--run CONFIG CAMERA BAG]
+#   python regression.py check <ref_dir> [--log-dir DIR] [--run CONFIG CAMERA BAG] [thresholds]
+# --run replays the bag with fastlivo_replay first, which writes log.bin, metrics.txt and trace.json into Log/.
+import os
+import sys
+import json
+import shutil
+import argparse
+import subprocess
+import numpy as np
+from log_convert import read_log, LOG_STATE_OUT, LOG_POSE_TUM
+
+RUN_FILES = ['log.bin', 'metrics.txt', 'trace.json']
+STATE_BLOCKS = [('euler', 1, 4, 'deg'), ('pos', 4, 7, 'm'), ('vel', 7, 10, 'm/s'),
+                ('bg', 10, 13, 'rad/s'), ('ba', 13, 16, 'm/s^2'), ('grav', 16, 19, 'm/s^2')]
+
+def load_run(run_dir):
+    records = read_log(os.path.join(run_dir, 'log.bin'))
+    run = {'pose': np.array(records[LOG_POSE_TUM]).reshape(-1, 8),
+           'state': np.array(records[LOG_STATE_OUT]).reshape(-1, 20),
+           'latency': {}}
+    metrics_file = os.path.join(run_dir, 'metrics.txt')
+    if os.path.exists(metrics_file):
+        with open(metrics_file) as f:
+            names = f.readline().split()
+        data = np.loadtxt(metrics_file, skiprows=1, ndmin=2)
+        if 'total_time' in names and data.size:
+            col = data[:, names.index('total_time')]
+            run['latency']['frame_total'] = col[np.isfinite(col)] * 1e3
+    trace_file = os.path.join(run_dir, 'trace.json')
+    if os.path.exists(trace_file):
+        with open(trace_file) as f:
+            events = json.load(f)['traceEvents']
+        stages = {}
+        for e in events:
+            stages.setdefault(e['name'], []).append(e['dur'] * 1e-3)
+        for name, dur in stages.items():
+            run['latency'][name] = np.array(dur)
+    return run
+
+def associate(t_ref, t_cur, max_dt=0.01):
+    # 按时间戳最近邻关联，返回两组下标
+    if len(t_ref) == 0 or len(t_cur) < 2:
+        return np.zeros(0, int), np.zeros(0, int)
+    idx = np.clip(np.searchsorted(t_cur, t_ref), 1, len(t_cur) - 1)
+    idx -= (t_ref - t_cur[idx - 1]) < (t_cur[idx] - t_ref)
+    ok = np.abs(t_cur[idx] - t_ref) <= max_dt
+    return np.nonzero(ok)[0], idx[ok]
+
+def quat_to_rot(q):
+    x, y, z, w = q[:, 0], q[:, 1], q[:, 2], q[:, 3]
+    R = np.empty((len(q), 3, 3))
+    R[:, 0, 0] = 1 - 2 * (y * y + z * z); R[:, 0, 1] = 2 * (x * y - z * w);     R[:, 0, 2] = 2 * (x * z + y * w)
+    R[:, 1, 0] = 2 * (x * y + z * w);     R[:, 1, 1] = 1 - 2 * (x * x + z * z); R[:, 1, 2] = 2 * (y * z - x * w)
+    R[:, 2, 0] = 2 * (x * z - y * w);     R[:, 2, 1] = 2 * (y * z + x * w);     R[:, 2, 2] = 1 - 2 * (x * x + y * y)
+    return R
+
+def trajectory_errors(ref, cur, rpe_delta):
+    # 两次运行的世界系相同（都从第一帧开始），不做对齐，ATE 直接比较位置
+    i_ref, i_cur = associate(ref[:, 0], cur[:, 0])
+    if len(i_ref) < 2:
+        return None
+    t = ref[i_ref, 0]
+    p_ref, p_cur = ref[i_ref, 1:4], cur[i_cur, 1:4]
+    R_ref, R_cur = quat_to_rot(ref[i_ref, 4:8]), quat_to_rot(cur[i_cur, 4:8])
+    ate = np.sqrt(np.mean(np.sum((p_ref - p_cur) ** 2, axis=1)))
+    # RPE：间隔 rpe_delta 秒的相对位姿误差
+    j = np.searchsorted(t, t + rpe_delta)
+    k = np.nonzero(j < len(t))[0]
+    j = j[k]
+    if len(k) == 0:
+        return ate, 0.0, 0.0, len(t)
+    d_ref = np.einsum('nji,nj->ni', R_ref[k], p_ref[j] - p_ref[k])
+    d_cur = np.einsum('nji,nj->ni', R_cur[k], p_cur[j] - p_cur[k])
+    dR_ref = np.einsum('nji,njk->nik', R_ref[k], R_ref[j])
+    dR_cur = np.einsum('nji,njk->nik', R_cur[k], R_cur[j])
+    E = np.einsum('nji,njk->nik', dR_ref, dR_cur)
+    ang = np.arccos(np.clip((np.trace(E, axis1=1, axis2=2) - 1) * 0.5, -1.0, 1.0))
+    rpe_t = np.sqrt(np.mean(np.sum((d_ref - d_cur) ** 2, axis=1)))
+    rpe_r = np.degrees(np.sqrt(np.mean(ang ** 2)))
+    return ate, rpe_t, rpe_r, len(t)
+
+def state_errors(ref, cur):
+    i_ref, i_cur = associate(ref[:, 0], cur[:, 0], 1e-4)
+    errs = {}
+    for name, beg, end, _ in STATE_BLOCKS:
+        d = ref[i_ref, beg:end] - cur[i_cur, beg:end]
+        if name == 'euler':
+            d = (d + 180.0) % 360.0 - 180.0
+        errs[name] = np.sqrt(np.mean(np.sum(d ** 2, axis=1))) if len(i_ref) else float('nan')
+    return errs, len(i_ref)
+
+def run_replay(replay, config, camera, bag):
+    cmd = replay.split() + [config, camera, bag]
+    print('[ REGRESSION ]: %s' % ' '.join(cmd))
+    if subprocess.call(cmd) != 0:
+        raise RuntimeError('replay failed')
+
+def check(ref, cur, args):
+    failed = []
+    traj = trajectory_errors(ref['pose'], cur['pose'], args.rpe_delta)
+    if traj is None:
+        failed.append('no matching poses')
+    else:
+        ate, rpe_t, rpe_r, n = traj
+        print('[ REGRESSION ]: %d poses, ATE %.4f m, RPE(%.1fs) %.4f m / %.4f deg' % (n, ate, args.rpe_delta, rpe_t, rpe_r))
+        if ate > args.ate_max:     failed.append('ATE %.4f m > %.4f m' % (ate, args.ate_max))
+        if rpe_t > args.rpe_t_max: failed.append('RPE %.4f m > %.4f m' % (rpe_t, args.rpe_t_max))
+        if rpe_r > args.rpe_r_max: failed.append('RPE %.4f deg > %.4f deg' % (rpe_r, args.rpe_r_max))
+    errs, n = state_errors(ref['state'], cur['state'])
+    print('[ REGRESSION ]: %d states, RMSE ' % n + ', '.join('%s %.4g %s' % (name, errs[name], unit) for name, _, _, unit in STATE_BLOCKS))
+    if not errs['vel'] <= args.vel_max:
+        failed.append('velocity RMSE %.4g m/s > %.4g m/s' % (errs['vel'], args.vel_max))
+    if len(cur['state']) < len(ref['state']) * 0.99:
+        failed.append('%d states, reference has %d' % (len(cur['state']), len(ref['state'])))
+
+    print('[ REGRESSION ]: %-24s %8s %10s %10s %10s %10s (ms)' % ('stage', 'n', 'ref p50', 'p50', 'ref p95', 'p95'))
+    for name in sorted(ref['latency']):
+        if name not in cur['latency'] or len(ref['latency'][name]) == 0 or len(cur['latency'][name]) == 0:
+            continue
+        r50, r95 = np.percentile(ref['latency'][name], [50, 95])
+        c50, c95 = np.percentile(cur['latency'][name], [50, 95])
+        print('[ REGRESSION ]: %-24s %8d %10.3f %10.3f %10.3f %10.3f' % (name, len(cur['latency'][name]), r50, c50, r95, c95))
+        # 同时超过相对和绝对阈值才算退化，避免短阶段的计时噪声
+        if c95 > r95 * (1.0 + args.p95_tol) and c95 - r95 > args.p95_floor:
+            failed.append('%s p95 %.3f ms > reference %.3f ms' % (name, c95, r95))
+
+    for msg in failed:
+        print('[ REGRESSION ]: FAIL %s' % msg)
+    print('[ REGRESSION ]: %s' % ('FAILED' if failed else 'PASSED'))
+    return not failed
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser()
+    parser.add_argument('mode', choices=['save', 'check'])
+    parser.add_argument('ref_dir')
+    parser.add_argument('--log-dir', default=os.path.dirname(os.path.abspath(__file__)))
+    parser.add_argument('--run', nargs=3, metavar=('CONFIG', 'CAMERA', 'BAG'))
+    parser.add_argument('--replay', default='rosrun fast_livo fastlivo_replay')
+    parser.add_argument('--ate-max', type=float, default=0.05, help='m')
+    parser.add_argument('--rpe-delta', type=float, default=1.0, help='s')
+    parser.add_argument('--rpe-t-max', type=float, default=0.02, help='m')
+    parser.add_argument('--rpe-r-max', type=float, default=0.2, help='deg')
+    parser.add_argument('--vel-max', type=float, default=0.05, help='m/s')
+    parser.add_argument('--p95-tol', type=float, default=0.2, help='allowed relative p95 increase')
+    parser.add_argument('--p95-floor', type=float, default=0.5, help='ms, smaller p95 increases are ignored')
+    args = parser.parse_args()
+
+    if args.run:
+        run_replay(args.replay, *args.run)
+    if args.mode == 'save':
+        if not os.path.isdir(args.ref_dir):
+            os.makedirs(args.ref_dir)
+        for name in RUN_FILES:
+            src = os.path.join(args.log_dir, name)
+            if os.path.exists(src):
+                shutil.copy(src, args.ref_dir)
+                print('[ REGRESSION ]: saved %s' % os.path.join(args.ref_dir, name))
+        sys.exit(0)
+    sys.exit(0 if check(load_run(args.ref_dir), load_run(args.log_dir), args) else 1)
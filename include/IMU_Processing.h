@@ -26,6 +26,8 @@
 #include <sensor_msgs/PointCloud2.h>
 #include <fast_livo/States.h>
 #include <geometry_msgs/Vector3.h>
+#include "async_logger.h"
+#include "trace.h"
 
 #ifdef USE_IKFOM
 #include "use-ikfom.hpp"
@@ -34,9 +36,31 @@
 /// *************Preconfiguration
 
 #define MAX_INI_COUNT (200)
+#define DESKEW_BLOCK  (256)   // 去畸变时每次SIMD处理的点数
 
 const bool time_list(PointType &x, PointType &y); //{return (x.curvature < y.curvature);};
 
+/// *************Covariance propagation
+// cov = F_x * cov * F_x^T + cov_w, Exp_neg = Exp(angvel_avr, -dt)
+void PropagateCovDense(MD(DIM_STATE, DIM_STATE) &cov, const M3D &Exp_neg, const M3D &R_imu, const M3D &acc_avr_skew, double dt,
+                       const V3D &cov_gyr, const V3D &cov_acc, const V3D &cov_bias_gyr, const V3D &cov_bias_acc);
+void PropagateCovBlock(MD(DIM_STATE, DIM_STATE) &cov, const M3D &Exp_neg, const M3D &R_imu, const M3D &acc_avr_skew, double dt,
+                       const V3D &cov_gyr, const V3D &cov_acc, const V3D &cov_bias_gyr, const V3D &cov_bias_acc);
+
+/// *************Backward undistortion
+// 一个IMU段内的去畸变模型，矩阵按行存储
+struct DeskewModel
+{
+  float M0[9], M1[9], M2[9];
+  float b0[3], b1[3], b2[3], bv[3], ba[3];
+  float w2;           // |gyr|^2
+  float time_offset;  // 段起点相对扫描起点的时间，单位秒
+};
+void BuildDeskewModel(DeskewModel &model, const M3D &R_head, const V3D &pos_head, const V3D &vel_head, const V3D &acc_head,
+                      const V3D &gyr_head, const M3D &extR_Ri, const V3D &pos_end, const M3D &Lid_rot_to_IMU,
+                      const V3D &Lid_offset_to_IMU, const V3D &exrR_extT, double time_offset);
+void ApplyDeskewModel(const DeskewModel &model, PointType *pts, int n);
+
 /// *************IMU Process and undistortion
 class ImuProcess
 {
@@ -54,6 +78,7 @@ class ImuProcess
   void set_acc_cov_scale(const V3D &scaler);
   void set_gyr_bias_cov(const V3D &b_g);
   void set_acc_bias_cov(const V3D &b_a);
+  double get_acc_scale() const { return G_m_s2 / mean_acc.norm(); }  // 加速度归一化系数
   #ifdef USE_IKFOM
   Eigen::Matrix<double, 12, 12> Q;
   void Process(const MeasureGroup &meas,  esekfom::esekf<state_ikfom, 12, input_ikfom> &kf_state, PointCloudXYZI::Ptr pcl_un_);
@@ -63,8 +88,7 @@ class ImuProcess
   void UndistortPcl(LidarMeasureGroup &lidar_meas, StatesGroup &state_inout, PointCloudXYZI &pcl_out);
   #endif
 
-  ros::NodeHandle nh;
-  ofstream fout_imu;
+  shared_ptr<AsyncLogger> logger;  // IMU数据记录，为空时不记录
   V3D cov_acc;
   V3D cov_gyr;
   V3D cov_acc_scale;
@@ -87,6 +111,7 @@ class ImuProcess
   sensor_msgs::ImuConstPtr last_imu_;
   deque<sensor_msgs::ImuConstPtr> v_imu_;
   vector<Pose6D> IMUpose;
+  vector<int>    seg_pcl_beg;  // 每个IMU段的第一个点的下标
   vector<M3D>    v_rot_pcl_;
   M3D Lid_rot_to_IMU;
   V3D Lid_offset_to_IMU;
@@ -0,0 +1,66 @@
+
+#ifndef ASYNC_LOGGER_H
+#define ASYNC_LOGGER_H
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#define LOG_RING_SIZE   (1 << 14)   // 环形缓冲区的记录数，必须是2的幂
+#define LOG_MAX_FIELDS  (24)        // 每条记录最多的 double 字段数
+#define LOG_MAGIC       "FLVLOG1"   // 文件头，8字节（含结尾的0）
+
+/// 记录类型，对应原来的 Log/imu.txt、mat_pre.txt、mat_out.txt、camera_pose.txt
+enum LogType
+{
+  LOG_IMU       = 1,  // time gyr(3) acc(3)
+  LOG_STATE_PRE = 2,  // time euler(3) pos(3) vel(3) bg(3) ba(3) grav(3)
+  LOG_STATE_OUT = 3,  // time euler(3) pos(3) vel(3) bg(3) ba(3) grav(3) feats_num
+  LOG_POSE_TUM  = 4   // time tx ty tz qx qy qz qw
+};
+
+/// *************Asynchronous binary logger
+/// 估计线程只把定长记录写入单生产者单消费者的无锁环形缓冲区，后台线程把记录以二进制写入文件。
+/// 文件格式：8字节文件头 LOG_MAGIC，之后每条记录为 uint32 类型、uint32 字段数、字段数个 double。
+/// 用 Log/log_convert.py 转换为原来的文本格式。只允许一个线程调用 log_* 接口。
+class AsyncLogger
+{
+ public:
+  struct Record
+  {
+    uint32_t type;
+    uint32_t num;
+    double   data[LOG_MAX_FIELDS];
+  };
+
+  AsyncLogger();
+  ~AsyncLogger();
+
+  bool start(const std::string &file_name);
+  void stop();
+
+  void log_imu(double time, const Eigen::Vector3d &gyr, const Eigen::Vector3d &acc);
+  void log_state(uint32_t type, double time, const Eigen::Vector3d &euler, const Eigen::Vector3d &pos, const Eigen::Vector3d &vel,
+                 const Eigen::Vector3d &bg, const Eigen::Vector3d &ba, const Eigen::Vector3d &grav, int feats_num = -1);
+  void log_pose(double time, const Eigen::Vector3d &t, const Eigen::Quaterniond &q);
+
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  Record *acquire();
+  void commit();
+  void worker();
+  size_t drain();
+
+  Record *ring;
+  std::atomic<uint64_t> head_;     // 生产者写入位置
+  std::atomic<uint64_t> tail_;     // 消费者读取位置
+  std::atomic<uint64_t> dropped_;  // 缓冲区满时丢弃的记录数
+  std::atomic<bool> running;
+  std::thread thread_;
+  FILE *fp;
+};
+#endif
@@ -16,6 +16,7 @@
 #include <opencv2/opencv.hpp>
 #include <sophus/se3.h>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
 #include <unordered_map>
 
 using namespace std;
@@ -76,7 +77,14 @@ extern V3F Zero3f;
 namespace lidar_selection
 {
     class Point;
-    typedef std::shared_ptr<Point> PointPtr;
+    struct Feature;
+    // 视觉地图的点和特征用非原子的侵入式引用计数，只在估计线程中复制和释放，定义在 point.cpp
+    void intrusive_ptr_add_ref(Point *p);
+    void intrusive_ptr_release(Point *p);
+    void intrusive_ptr_add_ref(Feature *p);
+    void intrusive_ptr_release(Feature *p);
+    typedef boost::intrusive_ptr<Point> PointPtr;
+    typedef boost::intrusive_ptr<Feature> FeaturePtr;
     class VOXEL_POINTS
     {
     public:
@@ -145,11 +153,28 @@ namespace std
   };
 }
 
+// 图像预处理结果：缩放、灰度、金字塔只做一次，之后各模块共享同一份缓冲区
+struct ImgFrame
+{
+    double time;
+    cv::Mat gray;                       // 缩放后的灰度图，即金字塔第0层
+    vector<cv::Mat> pyr;                // 图像金字塔，pyr[0]与gray共享内存
+    cv::Mat rgb;                        // 缩放后的BGR图，仅在需要点云着色时保留
+    cv::Mat canvas;                     // 用于绘制跟踪点的BGR副本，仅在有订阅者时生成
+    int epoch;                          // 图像时间戳回退时加一，预处理完成时已过期的帧被丢弃
+    ImgFrame()
+    {
+        time = 0.0;
+        epoch = 0;
+    };
+};
+typedef std::shared_ptr<ImgFrame> ImgFramePtr;
+
 struct MeasureGroup     
 {
     double img_offset_time;
     deque<sensor_msgs::Imu::ConstPtr> imu;
-    cv::Mat img;
+    ImgFramePtr img;
     MeasureGroup()
     {
         img_offset_time = 0.0;
@@ -164,6 +189,7 @@ struct LidarMeasureGroup
     std::deque<struct MeasureGroup> measures;
     bool is_lidar_end;
     int lidar_scan_index_now;
+    int lidar_slice_index;      // 当前扫描中已经处理的子扫描（slice）数量
     LidarMeasureGroup()
     {
         lidar_beg_time = 0.0;
@@ -171,6 +197,7 @@ struct LidarMeasureGroup
         this->lidar.reset(new PointCloudXYZI());
         std::deque<struct MeasureGroup> ().swap(this->measures);
         lidar_scan_index_now = 0;
+        lidar_slice_index = 0;
         last_update_time = 0.0;
     };
     void debug_show()
@@ -20,34 +20,36 @@
 #include <frame.h>
 #include <point.h>
 #include <common_lib.h>
+#include <object_pool.h>
 
 namespace lidar_selection {
 
 // A salient image region that is tracked across frames.
+// 从 ObjectPool<Feature> 分配，由 FeaturePtr 侵入式计数
 struct Feature
 {
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_MAKE_OPERATOR_NEW(Feature)
 
   enum FeatureType {
     CORNER,
     EDGELET
   };
   int id_;
+  int ref_count_;       //!< 引用计数，由 FeaturePtr 维护
   FeatureType type;     //!< Type can be corner or edgelet.
   Frame* frame;         //!< Pointer to frame in which the feature was detected.
   cv::Mat img;
-  vector<cv::Mat> ImgPyr;
   Vector2d px;          //!< Coordinates in pixels on pyramid level 0.
   Vector3d f;           //!< Unit-bearing vector of the feature.
   int level;            //!< Image pyramid level where feature was extracted.
   PointPtr point;         //!< Pointer to 3D point which corresponds to the feature.
   Vector2d grad;        //!< Dominant gradient direction for edglets, normalized.
   float score;
-  float error;
   // Vector2d grad_cur_;   //!< edgelete grad direction in cur frame 
   SE3 T_f_w_;
   // float* patch;
   Feature(const Vector2d& _px, const Vector3d& _f, const SE3& _T_f_w, const float &_score, int _level) :
+    ref_count_(0),
     type(CORNER),
     px(_px),
     f(_f),
@@ -24,12 +24,7 @@
 
 namespace lidar_selection {
 
-struct Feature;
-typedef std::shared_ptr<Feature>  FeaturePtr;
-
-class Point;
-typedef std::shared_ptr<Point> PointPtr;
-
+// FeaturePtr、PointPtr 在 common_lib.h 中声明
 typedef list<FeaturePtr> Features;
 typedef vector<cv::Mat> ImgPyr;
 
@@ -51,11 +46,15 @@ public:
   bool                          is_keyframe_;           //!< Was this frames selected as keyframe
 
   Frame(vk::AbstractCamera* cam, const cv::Mat& img);
+  Frame(vk::AbstractCamera* cam, const ImgPyr& img_pyr);
   ~Frame();
 
   /// Initialize new frame and create image pyramid.
   void initFrame(const cv::Mat& img);
 
+  /// Initialize new frame with an already built image pyramid (shares the buffers).
+  void initFrame(const ImgPyr& img_pyr);
+
   /// Select this frame as keyframe.
   void setKeyframe();
 
@@ -1,4 +1,5 @@
 #include "ikd_Tree.h"
+#include "trace.h"
 
 /*
 Description: ikd-Tree: an incremental k-d tree for robotic applications 
@@ -194,6 +195,7 @@ void KD_TREE::multi_thread_rebuild(){
         pthread_mutex_lock(&rebuild_ptr_mutex_lock);
         pthread_mutex_lock(&working_flag_mutex);
         if (Rebuild_Ptr != nullptr ){                    
+            TRACE_SCOPE("ikdtree_rebuild");
             /* Traverse and copy */
             if (!Rebuild_Logger.empty()){
                 printf("\n\n\n\n\n\n\n\n\n\n\n ERROR!!! \n\n\n\n\n\n\n\n\n");
@@ -335,6 +337,7 @@ void KD_TREE::run_operation(KD_TREE_NODE ** root, Operation_Logger_Type operatio
 }
 
 void KD_TREE::Build(PointVector point_cloud){
+    TRACE_SCOPE("ikdtree_build");
     if (Root_Node != nullptr){
         delete_tree_nodes(&Root_Node);
     }
@@ -380,6 +383,7 @@ void KD_TREE::Nearest_Search(PointType point, int k_nearest, PointVector& Neares
 }
 
 int KD_TREE::Add_Points(PointVector & PointToAdd, bool downsample_on){
+    TRACE_SCOPE("ikdtree_add_points");
     int NewPointSize = PointToAdd.size();
     int tree_size = size();
     BoxPointType Box_of_Point;
@@ -499,6 +503,7 @@ void KD_TREE::Delete_Points(PointVector & PointToDel){
 }
 
 int KD_TREE::Delete_Point_Boxes(vector<BoxPointType> & BoxPoints){
+    TRACE_SCOPE("ikdtree_delete_boxes");
     int tmp_counter = 0;
     for (int i=0;i < BoxPoints.size();i++){ 
         if (Rebuild_Ptr == nullptr || *Rebuild_Ptr != Root_Node){               
@@ -0,0 +1,70 @@
+
+#ifndef IMG_PROCESSING_H
+#define IMG_PROCESSING_H
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+#include <ros/ros.h>
+#include <common_lib.h>
+#include <sensor_msgs/Image.h>
+#include <cv_bridge/cv_bridge.h>
+#include <opencv2/opencv.hpp>
+#include <vikit/abstract_camera.h>
+
+/// *************Image ingestion
+/// 图像到达后在独立线程中完成一次性的预处理（缩放、灰度化、金字塔、可选的彩色副本），
+/// 生成的 ImgFrame 直接交给 LidarSelector::detect，主线程中不再有图像拷贝。
+class ImgProcess
+{
+ public:
+  typedef std::function<void(ImgFramePtr)> FrameCallback;
+
+  ImgProcess();
+  ~ImgProcess();
+
+  void set(int width, int height, int pyr_levels);
+  void start(FrameCallback cb);
+  void stop();
+  void push(const sensor_msgs::ImageConstPtr &msg, double time, int epoch = 0);
+  ImgFramePtr process(const sensor_msgs::ImageConstPtr &msg, double time);
+
+  std::atomic<bool> rgb_en;     // 保留彩色图，用于点云着色
+  std::atomic<bool> canvas_en;  // 生成绘制用的彩色副本，用于发布 /rgb_img
+
+ private:
+  struct Item
+  {
+    sensor_msgs::ImageConstPtr msg;
+    double time;
+    int epoch;
+  };
+
+  void worker();
+
+  int width, height, pyr_levels;
+  FrameCallback frame_cbk;
+  std::thread thread_;
+  std::mutex mtx_;
+  std::condition_variable cond_;
+  deque<Item> msg_buffer;
+  bool running;
+};
+
+/// *************Point cloud colourization
+#define COLORIZE_BLOCK (256)
+// 世界系点投影到相机的模型，与 vk::PinholeCamera 相同（k1 k2 p1 p2 畸变），矩阵按行存储
+struct ColorizeModel
+{
+  float R[9], t[3];     // T_c_w
+  float fx, fy, cx, cy;
+  float d[4];
+  int width, height;
+  const vk::AbstractCamera *cam;   // 非 Pinhole 的相机模型，逐点调用 world2cam；Pinhole 时为空，用上面的参数批量投影
+};
+void BuildColorizeModel(ColorizeModel &model, const M3D &Rcw, const V3D &Pcw, double fx, double fy, double cx, double cy,
+                        const double *d, int width, int height, const vk::AbstractCamera *cam);
+int ColorizePoints(const ColorizeModel &model, const cv::Mat &img_bgr, const PointType *pts, int n, PointCloudXYZRGB &out);
+#endif
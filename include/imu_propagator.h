@@ -0,0 +1,61 @@
+
+#ifndef IMU_PROPAGATOR_H
+#define IMU_PROPAGATOR_H
+#include <deque>
+#include <memory>
+#include <ros/ros.h>
+#include <ros/callback_queue.h>
+#include <so3_math.h>
+#include <common_lib.h>
+#include <sensor_msgs/Imu.h>
+#include <nav_msgs/Odometry.h>
+
+#define MAX_PROP_IMU_BUFFER (2000)   // 没有锚点更新时最多缓存的IMU数量
+
+/// *************IMU-rate odometry
+/// 从最近一次EKF更新后的状态（锚点）出发，用和 ImuProcess::Forward 相同的模型积分新到的IMU，按IMU频率发布位姿和速度。
+/// IMU在独立的 CallbackQueue/AsyncSpinner 中处理；EKF更新后估计线程用 atomic_store 替换锚点，两边不共享锁。
+class ImuPropagator
+{
+ public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  struct Anchor
+  {
+    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    double time;       // 状态对应的时刻
+    double acc_scale;  // 加速度归一化系数 G_m_s2 / |mean_acc|
+    M3D rot;
+    V3D pos, vel, bias_g, bias_a, gravity;
+  };
+  typedef std::shared_ptr<const Anchor> AnchorConstPtr;
+
+  ImuPropagator();
+  ~ImuPropagator();
+
+  void start(const ros::NodeHandle &nh, const string &imu_topic, const string &odom_topic);
+  void stop();
+  void set_anchor(const StatesGroup &state, double time, double acc_scale);
+
+ private:
+  void imu_cbk(const sensor_msgs::Imu::ConstPtr &msg);
+  void reset_to(const AnchorConstPtr &anchor);
+  void integrate(const sensor_msgs::Imu &head, const sensor_msgs::Imu &tail);
+  void publish(const sensor_msgs::Imu &msg);
+
+  AnchorConstPtr anchor_;       // 最新锚点，只通过 atomic_load/atomic_store 访问
+  AnchorConstPtr anchor_used;   // 当前积分所基于的锚点
+  deque<sensor_msgs::Imu::ConstPtr> imu_buffer;  // 锚点之后的IMU
+
+  // 以下只在回调线程中使用
+  M3D rot_imu;
+  V3D pos_imu, vel_imu, angvel_imu;
+  double state_time;
+
+  std::unique_ptr<ros::NodeHandle> nh_;  // start() 中创建，离线回放时不连接master
+  ros::CallbackQueue queue_;
+  std::unique_ptr<ros::AsyncSpinner> spinner_;
+  ros::Subscriber sub_imu;
+  ros::Publisher pub_odom;
+};
+#endif
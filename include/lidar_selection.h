@@ -15,8 +15,21 @@
 #include <pcl/filters/voxel_grid.h>
 #include <set>
 
+#define MAX_SEARCH_LEVEL  (2)   // 参考 patch 的最大搜索层级，warpAffine 在参考图像上的采样范围为 halfpatch << (search_level + pyramid_level)
+
 namespace lidar_selection {
 
+/// 一帧 ComputeJ 的统计
+struct VioStats
+{
+    int patches = 0;               // 参与更新的 patch 数
+    int iterations[3] = {0, 0, 0}; // 各金字塔层的迭代次数，跳过的层为0
+    float prior_error = 0;         // 先验位姿下每像素的平均光度误差平方
+    float final_error = 0;         // 更新后每像素的平均光度误差平方，取实际迭代过的最精细一层
+    double time = 0;               // ComputeJ 用时 (s)
+    bool deadline_hit = false;     // 因超出时间预算提前结束
+};
+
 class LidarSelector {
   public:
     int grid_size;
@@ -33,13 +46,21 @@ class LidarSelector {
     float* map_value;
     float* patch_with_border_;
     vector<float> patch_cache;
+    vector<float> st_score;        // 当前帧每个像素的 Shi-Tomasi 角点得分，见 computeShiTomasiMap
     int width, height, grid_n_width, grid_n_height, length;
     SubSparseMap* sub_sparse_map;
     double fx,fy,cx,cy;
     bool ncc_en;
+    bool map_update_en = true;     // false: 定位模式，不向视觉地图加点和观测
     int debug, patch_size, patch_size_total, patch_size_half;
     int count_img, MIN_IMG_COUNT;
     int NUM_MAX_ITERATIONS;
+    bool vio_adaptive_en = false;  // 自适应迭代：先验误差小时跳过粗层，代价下降很小时结束本层，并限制每帧用时
+    float vio_skip_error = 0;      // 先验每像素平均误差平方低于该值时只在原图层迭代
+    float vio_min_decrease = 0;    // 一次迭代的代价相对下降低于该值时结束本层
+    double vio_time_budget = 0;    // 每帧 VIO 用时上限 (s)，0 不限制
+    double vio_deadline = 0;       // 本帧的截止时刻 (omp_get_wtime)，0 不限制
+    VioStats vio_stats;
     vk::robust_cost::WeightFunctionPtr weight_function_;
     float weight_scale_;
     double img_point_cov, outlier_threshold, ncc_thre;
@@ -60,7 +81,10 @@ class LidarSelector {
     ~LidarSelector();
 
     void detect(cv::Mat img, PointCloudXYZI::Ptr pg);
+    void detect(ImgFramePtr frame, PointCloudXYZI::Ptr pg);
     float CheckGoodPoints(cv::Mat img, V2D uv);
+    void computeShiTomasiMap(const cv::Mat& img);
+    float shiTomasiScore(int u, int v) const;
     void addFromSparseMap(cv::Mat img, PointCloudXYZI::Ptr pg);
     void addSparseMap(cv::Mat img, PointCloudXYZI::Ptr pg);
     void FeatureAlignment(cv::Mat img);
@@ -99,7 +123,7 @@ class LidarSelector {
     int getBestSearchLevel(const Matrix2d& A_cur_ref, const int max_level);
     void display_keypatch(double time);
     void updateFrameState(StatesGroup state);
-    V3F getpixel(cv::Mat img, V2D pc);
+    V3F getpixel(const cv::Mat &img, V2D pc);
 
     void warpAffine(
       const Matrix2d& A_cur_ref,
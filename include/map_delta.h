@@ -0,0 +1,67 @@
+
+#ifndef MAP_DELTA_H
+#define MAP_DELTA_H
+#include <mutex>
+#include <vector>
+#include <unordered_map>
+#include <common_lib.h>
+#include <ikd-Tree/ikd_Tree.h>
+
+typedef pcl::PointXYZI PointTypeLOD;
+typedef pcl::PointCloud<PointTypeLOD> PointCloudLOD;
+
+/// 一层 LOD 自上次取出以来的变化，块号每3个数为一块的 ix iy iz
+struct MapDeltaLevel
+{
+  bool keyframe;                    // 为 true 时 updated 为该层的全部块
+  float resolution;
+  std::vector<int32_t> updated;     // 有新体素（或被删除了部分体素）的块
+  std::vector<uint32_t> counts;     // updated 中每块的点数，points 按块依次排列
+  std::vector<int32_t> removed;     // 整块被删除的块
+  PointCloudLOD points;             // updated 中各块的全部点
+};
+
+/// *************Incremental LOD map
+/// 跟踪 ikdtree 地图的变化：地图按 block_size 分块，每层 LOD 在块内按该层 resolution 体素降采样，
+/// 每个体素保留第一个落入的点。插入新体素或删除体素时只标记所在的块，take() 取出有变化的块的完整内容
+/// 和被删除的块号，发布开销与地图的变化量成正比；keyframe 时取出整层，供新订阅者重建地图。
+/// insert() 在地图插入线程调用，remove_boxes() 在估计线程调用，take() 在发布线程调用，内部加锁。
+/// 不记录变化时（track_changes 为 false）只作为地图的体素副本，由 collect() 分段取出全部点，用于写地图快照。
+class MapDeltaTracker
+{
+ public:
+  MapDeltaTracker();
+
+  // resolutions 从精细到粗糙，block_size 应为各层 resolution 的整数倍
+  void set_levels(const std::vector<double> &resolutions, double block_size, bool track_changes = true);
+  void insert(const PointVector &points);
+  void remove_boxes(const std::vector<BoxPointType> &boxes);
+  void take(int level, bool keyframe, MapDeltaLevel &out);
+  void collect(int level, std::vector<PointTypeLOD> &out);
+
+  int levels() const { return int(layers.size()); }
+  double block() const { return block_size; }
+  size_t voxels(int level);
+
+ private:
+  struct Block
+  {
+    std::unordered_map<VOXEL_KEY, PointTypeLOD> voxels;
+    bool dirty;                    // 上次 take() 之后是否有变化
+  };
+  struct Layer
+  {
+    double resolution;
+    std::unordered_map<VOXEL_KEY, Block> blocks;
+    std::vector<VOXEL_KEY> dirty_keys;
+    std::vector<VOXEL_KEY> removed_keys;
+  };
+
+  void mark_dirty(Layer &layer, const VOXEL_KEY &key, Block &block);
+
+  double block_size;
+  bool track_changes;
+  std::vector<Layer> layers;
+  std::mutex mtx;
+};
+#endif
@@ -0,0 +1,131 @@
+
+#ifndef MAP_SNAPSHOT_H
+#define MAP_SNAPSHOT_H
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <lidar_selection.h>
+#include <map_delta.h>
+
+#define SNAPSHOT_MAGIC    (0x31504e5356494c46ULL)   // "FLIVSNP1"
+#define SNAPSHOT_VERSION  (3)
+
+#define SNAPSHOT_VIO_STEP (2000)   // 运行中每帧最多收集的视觉地图点数
+
+/// 快照文件头，之后依次为各段数据，偏移均按8字节对齐
+struct SnapshotHeader
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t pad;
+  uint64_t lio_points, vio_points, observations, images;
+  uint64_t lio_offset, vio_offset, obs_offset, image_offset;
+  uint64_t file_size;
+};
+
+struct SnapshotLioPoint
+{
+  float x, y, z, intensity;
+};
+
+struct SnapshotVioPoint
+{
+  double pos[3];
+  float normal[3];
+  float value;
+  uint32_t first_obs, n_obs;   // 该点的观测在观测段中的范围，顺序与 Point::obs_ 相同
+  uint32_t normal_set;
+  uint32_t pad;
+};
+
+struct SnapshotObs
+{
+  double R[9], t[3];           // T_f_w
+  double px[2], f[3];
+  float score;
+  int32_t level;
+  int32_t frame_id;
+  uint32_t image;              // 参考图像在图像段中的下标
+};
+
+/// 观测引用的参考图像（帧的金字塔第0层），每帧只存一次，像素按行紧密排列
+struct SnapshotImage
+{
+  int32_t frame_id;
+  uint32_t width, height;
+  uint32_t pad;
+  uint64_t offset;             // 像素数据在文件中的偏移
+};
+
+/// 等待写盘的快照。视觉地图在估计线程中分帧收集，参考图像只保存 cv::Mat 句柄（与地图共享像素）；
+/// 激光点和图像像素由写盘线程取出和写出
+struct SnapshotData
+{
+  std::vector<SnapshotLioPoint> lio;
+  std::vector<SnapshotVioPoint> vio;
+  std::vector<SnapshotObs> obs;
+  std::vector<SnapshotImage> images;
+  std::vector<cv::Mat> image_data;   // 与 images 一一对应
+};
+
+/// 视觉地图分帧收集的进度：开始时记下的体素和已收集的帧号到图像下标的映射
+struct SnapshotVioCursor
+{
+  std::vector<VOXEL_KEY> voxels;
+  size_t next = 0;
+  std::unordered_map<int32_t, uint32_t> image_index;
+};
+
+void snapshot_collect_lio(MapDeltaTracker &map, SnapshotData &data);
+void snapshot_begin_vio(const lidar_selection::LidarSelector &selector, SnapshotVioCursor &cursor, SnapshotData &data);
+bool snapshot_step_vio(const lidar_selection::LidarSelector &selector, SnapshotVioCursor &cursor, SnapshotData &data, size_t max_points);
+bool snapshot_write(const std::string &path, const SnapshotData &data);
+
+/// *************Background snapshot writer
+/// save() 把收集好的快照交给后台线程，给出 lio 时先在后台线程从中取出激光点，再写盘
+/// （先写临时文件再改名，中途退出不会留下损坏的快照）。上一次写盘未完成时返回 false，本次跳过。
+class MapSnapshotWriter
+{
+ public:
+  MapSnapshotWriter();
+  ~MapSnapshotWriter();
+
+  bool save(const std::string &path, SnapshotData &&data, MapDeltaTracker *lio);
+  bool busy() const { return busy_; }
+  void wait();
+
+ private:
+  std::atomic<bool> busy_;
+  std::thread thread_;
+};
+
+/// *************Memory-mapped snapshot
+/// 只读映射快照文件，各段直接按结构体数组访问。恢复的视觉地图的参考图像指向映射的内存，
+/// 因此对象需保留到视觉地图销毁之后。
+class MapSnapshot
+{
+ public:
+  MapSnapshot();
+  ~MapSnapshot();
+
+  bool open(const std::string &path);
+  void close();
+
+  const SnapshotHeader &header() const { return *reinterpret_cast<const SnapshotHeader *>(data); }
+  const SnapshotLioPoint *lio() const { return reinterpret_cast<const SnapshotLioPoint *>(data + header().lio_offset); }
+  const SnapshotVioPoint *vio() const { return reinterpret_cast<const SnapshotVioPoint *>(data + header().vio_offset); }
+  const SnapshotObs *obs() const { return reinterpret_cast<const SnapshotObs *>(data + header().obs_offset); }
+  const SnapshotImage *images() const { return reinterpret_cast<const SnapshotImage *>(data + header().image_offset); }
+  const uint8_t *pixels(const SnapshotImage &image) const { return data + image.offset; }
+
+ private:
+  const uint8_t *data;
+  size_t size;
+};
+
+void snapshot_restore_lio(const MapSnapshot &snapshot, PointVector &points);
+int snapshot_restore_vio(const MapSnapshot &snapshot, lidar_selection::LidarSelector &selector);
+#endif
@@ -0,0 +1,40 @@
+
+#ifndef METRICS_H
+#define METRICS_H
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#define METRICS_CAPACITY (8192)   // 每个序列保留的最近帧数
+
+/// *************Per-frame metrics
+/// 每帧写入一行固定列的指标（如地图点数、近邻搜索耗时、增量耗时、总耗时），
+/// 保存在容量固定的环形缓冲区中，同时对每列维护总的次数、均值、方差、最小值、最大值。
+/// 内存与运行时长无关；dump() 把缓冲区中的行写成文本文件，可在运行中由其他线程调用。
+class FrameMetrics
+{
+ public:
+  struct Aggregate
+  {
+    unsigned long count;
+    double mean, m2, min, max;   // m2 为 Welford 算法的二阶中心矩累加
+  };
+
+  FrameMetrics(const std::vector<std::string> &names, int capacity = METRICS_CAPACITY);
+
+  void push(const std::vector<double> &values);
+  Aggregate aggregate(int col) const;
+  unsigned long size() const;
+  bool dump(const std::string &file_name) const;
+  void print_summary(FILE *fp = stdout) const;
+
+ private:
+  const std::vector<std::string> names;
+  const int capacity, cols;
+  std::vector<double> ring;        // capacity 行 x cols 列
+  std::vector<Aggregate> aggs;
+  unsigned long rows;              // 写入的总行数
+  mutable std::mutex mtx;
+};
+#endif
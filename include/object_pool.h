@@ -0,0 +1,110 @@
+
+#ifndef OBJECT_POOL_H
+#define OBJECT_POOL_H
+#include <cstddef>
+#include <cstdlib>
+#include <cassert>
+#include <new>
+#include <vector>
+#include <algorithm>
+
+#define OBJECT_POOL_SLAB_BYTES  (256 * 1024)   // 每个 slab 的字节数，一次申请多个对象槽
+
+/// 对象池的分配统计
+struct PoolStats
+{
+  size_t object_size;    // 每个对象槽的字节数
+  size_t slabs;          // 已申请的 slab 数
+  size_t capacity;       // 对象槽总数
+  size_t in_use;         // 当前存活的对象数
+  size_t peak;           // 存活对象数的峰值
+  size_t allocs, frees;  // 累计分配和释放次数
+};
+
+/// *************Typed object pool
+/// 定长对象的 slab 分配器：按 OBJECT_POOL_SLAB_BYTES 成批申请对象槽，释放的槽挂到空闲链表上留给下一个对象，
+/// 同类对象在内存中紧挨着，分配和释放只是链表头的出入。slab 不归还系统，池对象本身也不析构，
+/// 程序退出时仍存活的对象不会访问已释放的池。
+/// 不加锁：只用于视觉地图的点和特征，它们只在估计线程中创建和释放。
+template <typename T>
+class ObjectPool
+{
+ public:
+  static void *allocate(size_t size)
+  {
+    ObjectPool &pool = instance();
+    assert(size <= pool.stats_.object_size);
+    if (pool.free_list_ == nullptr) pool.grow();
+    Slot *slot = pool.free_list_;
+    pool.free_list_ = slot->next;
+    pool.stats_.allocs ++;
+    pool.stats_.in_use ++;
+    pool.stats_.peak = std::max(pool.stats_.peak, pool.stats_.in_use);
+    return slot;
+  }
+
+  static void deallocate(void *p)
+  {
+    if (p == nullptr) return;
+    ObjectPool &pool = instance();
+    Slot *slot = static_cast<Slot *>(p);
+    slot->next = pool.free_list_;
+    pool.free_list_ = slot;
+    pool.stats_.frees ++;
+    pool.stats_.in_use --;
+  }
+
+  static PoolStats stats() { return instance().stats_; }
+
+ private:
+  struct Slot
+  {
+    Slot *next;
+  };
+
+  static constexpr size_t alignment() { return alignof(T) > alignof(Slot) ? alignof(T) : alignof(Slot); }
+
+  ObjectPool()
+      : free_list_(nullptr)
+  {
+    stats_.object_size = (std::max(sizeof(T), sizeof(Slot)) + alignment() - 1) / alignment() * alignment();
+    stats_.slabs = stats_.capacity = stats_.in_use = stats_.peak = stats_.allocs = stats_.frees = 0;
+  }
+
+  static ObjectPool &instance()
+  {
+    static ObjectPool *pool = new ObjectPool;
+    return *pool;
+  }
+
+  /**
+   * @brief 申请一个 slab，把其中的槽按地址顺序挂到空闲链表上
+   */
+  void grow()
+  {
+    const size_t n = std::max<size_t>(OBJECT_POOL_SLAB_BYTES / stats_.object_size, 1);
+    void *mem = nullptr;
+    if (posix_memalign(&mem, std::max(alignment(), sizeof(void *)), n * stats_.object_size) != 0) throw std::bad_alloc();
+    slabs_.push_back(mem);
+    char *base = static_cast<char *>(mem);
+    for (size_t i = n; i > 0; i--)
+    {
+      Slot *slot = reinterpret_cast<Slot *>(base + (i - 1) * stats_.object_size);
+      slot->next = free_list_;
+      free_list_ = slot;
+    }
+    stats_.slabs ++;
+    stats_.capacity += n;
+  }
+
+  Slot *free_list_;
+  std::vector<void *> slabs_;
+  PoolStats stats_;
+};
+
+/// 在类定义中使用，该类的 new/delete 从 ObjectPool<T> 分配，代替 EIGEN_MAKE_ALIGNED_OPERATOR_NEW（槽按 alignof(T) 对齐）
+#define POOL_MAKE_OPERATOR_NEW(T) \
+  static void *operator new(size_t size) { return ObjectPool<T>::allocate(size); } \
+  static void operator delete(void *p) { ObjectPool<T>::deallocate(p); }
+
+#endif
@@ -17,8 +17,10 @@
 #ifndef SVO_POINT_H_
 #define SVO_POINT_H_
 
+#include <memory>
 #include <boost/noncopyable.hpp>
 #include <common_lib.h>
+#include <object_pool.h>
 #include <feature.h>
 #include <frame.h>
 
@@ -26,11 +28,51 @@ namespace lidar_selection {
 
 typedef Matrix<double, 2, 3> Matrix23d;
 
+#define MAX_OBS_NUM  (20)   // 每个地图点最多保留的观测数，addObservation 中删去最远的观测来维持
+
+/// *************Point observations
+/// 地图点观测的定长存储，按结构体数组保存每个观测的相机光心（T_f_w_ 的逆的平移，加入时算一次）、
+/// 从地图点指向光心的单位视线方向和特征（持有参考图像块）。视线方向依赖地图点位置，位置改变后由 updateDirs 重新计算。下标 0 为最新的观测，与原先 list::push_front 的顺序相同。
+/// 视角搜索只扫描这几个连续的 float 数组，不再访问 Feature 和对位姿求逆。
+/// 容量随观测数按 2、4、8、16、20 增长，多数地图点只有少量观测；已满时再加入会丢掉最旧的观测。
+class PointObs : boost::noncopyable
+{
+public:
+  typedef const FeaturePtr* const_iterator;
+
+  PointObs();
+
+  size_t size() const { return n_; }
+  bool empty() const { return n_ == 0; }
+  const FeaturePtr& operator[](int i) const { return ftr_[i]; }
+  const FeaturePtr& front() const { return ftr_[0]; }
+  const FeaturePtr& back() const { return ftr_[n_ - 1]; }
+  const_iterator begin() const { return ftr_.get(); }
+  const_iterator end() const { return ftr_.get() + n_; }
+
+  /// 相机光心和视线方向的第 axis 个分量，长度为 size()
+  const float* center(int axis) const { return geom_.get() + axis * cap_; }
+  const float* dir(int axis) const { return geom_.get() + (3 + axis) * cap_; }
+
+  void push_front(const FeaturePtr& ftr, const Vector3d& pos);
+  void updateDirs(const Vector3d& pos);
+  void erase(int i);
+  void clear();
+
+private:
+  void reserve(int cap);
+
+  std::unique_ptr<float[]> geom_;       //!< 光心 x、y、z 和视线方向 x、y、z 各 cap_ 个
+  std::unique_ptr<FeaturePtr[]> ftr_;
+  int n_, cap_;
+};
+
 /// A 3D point on the surface of the scene.
+/// 从 ObjectPool<Point> 分配，由 PointPtr 侵入式计数；成员按访问频率排列，投影和视角搜索用到的在前。
 class Point : boost::noncopyable
 {
 public:
-  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+  POOL_MAKE_OPERATOR_NEW(Point)
   
   // enum PointType {
   //   TYPE_DELETED,
@@ -40,26 +82,24 @@ public:
   // };
 
   static int                  point_counter_;           //!< Counts the number of created points. Used to set the unique id.
-  int                         id_;                      //!< Unique ID of the point.
-  Vector3d                    pos_;                     //!< 3d pos of the point in the world coordinate frame.
-  float x, y, z, intensity;
+  Vector3d                    pos_;                     //!< 3d pos of the point in the world coordinate frame. 有观测后通过 setPos 修改，保持 obs_ 的视线方向一致
+  PointObs                    obs_;                     //!< References to keyframes which observe the point, newest first.
+  float                       value;
+  int                         ref_count_;               //!< 引用计数，由 PointPtr 维护
   Vector3d                    normal_;                  //!< Surface normal at point.
-  Matrix3d                    normal_information_;      //!< Inverse covariance matrix of normal estimation.
   bool                        normal_set_;              //!< Flag whether the surface normal was estimated or not.
-  list<FeaturePtr>              obs_;                     //!< References to keyframes which observe the point.
+  int                         id_;                      //!< Unique ID of the point.
   size_t                      n_obs_;                   //!< Number of observations: Keyframes AND successful reprojections in intermediate frames.
-  int                         last_published_ts_;       //!< Timestamp of last publishing.
-  int                         last_projected_kf_id_;    //!< Flag for the reprojection: don't reproject a pt twice.
   // PointType                   type_;                    //!< Quality of the point.
+  int                         last_published_ts_;       //!< Timestamp of last publishing.
   int                         n_failed_reproj_;         //!< Number of failed reprojections. Used to assess the quality of the point.
-  int                         n_succeeded_reproj_;      //!< Number of succeeded reprojections. Used to assess the quality of the point.
-  int                         last_structure_optim_;    //!< Timestamp of last point optimization
-  bool                        have_scaled;
-  float                       value;
   Point(const Vector3d& pos);
   Point(const Vector3d& pos, FeaturePtr ftr);
   ~Point();
 
+  /// 修改位置并更新各观测的视线方向
+  void setPos(const Vector3d& pos);
+
   void getFurthestViewObs(const Vector3d& framepos, FeaturePtr& ftr) const;
   void deleteFeatureRef(FeaturePtr ftr);
 
@@ -82,6 +122,9 @@ public:
 
   bool getCloseViewObs_test(const Vector3d& pos, FeaturePtr& obs, const Vector2d& cur_px, double& min_cos_angle) const;
 
+  /// Index of the observation with the smallest view angle to pos, and the cosine of that angle.
+  int closestViewObs(const Vector3d& pos, double& max_cos_angle) const;
+
   /// Get number of observations.
   inline size_t nRefs() const { return obs_.size(); }
 
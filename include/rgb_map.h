@@ -0,0 +1,37 @@
+
+#ifndef RGB_MAP_H
+#define RGB_MAP_H
+#include <vector>
+#include <unordered_map>
+#include <common_lib.h>
+#include "tile_writer.h"
+
+/// *************Voxel-fused RGB map
+/// 着色后的点按 resolution 的体素融合，每个体素只保留一个点：位置和颜色为落入该体素的所有观测的均值，并记录观测次数。
+/// 内存随探索的空间增长，与运行时长无关。take_updated() 取出上次调用后有变化的体素用于增量发布，
+/// save() 分批交给 TileWriter 写盘。不加锁，只允许一个线程使用（发布任务）。
+class RGBVoxelMap
+{
+ public:
+  struct Voxel
+  {
+    float x, y, z;       // 位置均值
+    float r, g, b;       // 颜色均值
+    uint32_t hits;       // 观测次数
+    bool updated;        // 上次 take_updated() 之后是否有新观测
+  };
+
+  explicit RGBVoxelMap(double resolution = 0.05);
+
+  void set_resolution(double resolution);
+  void insert(const PointCloudXYZRGB &cloud);
+  void take_updated(PointCloudXYZRGB &out);
+  void save(TileWriter &writer) const;
+  size_t size() const { return voxels.size(); }
+
+ private:
+  double resolution;
+  std::unordered_map<VOXEL_KEY, Voxel> voxels;
+  std::vector<VOXEL_KEY> updated_keys;
+};
+#endif
@@ -0,0 +1,34 @@
+
+#ifndef STATIC_KDTREE_H
+#define STATIC_KDTREE_H
+#include <vector>
+#include <cstdint>
+#include <common_lib.h>
+
+#define STATIC_KDTREE_LEAF  (8)    // 叶子中的最大点数，叶子内线性扫描
+
+/// *************Static kd-tree
+/// 定位模式下的只读地图：建树一次，之后只做近邻搜索。点按中位数划分原地重排，每个区间的中点即为划分节点，
+/// 不存指针，每点只多一个字节的划分维度；树严格平衡，没有增删、重建和锁。
+/// Nearest_Search 与 ikdtree 的接口相同，可以多线程同时调用。
+class StaticKdTree
+{
+ public:
+  void Build(const PointVector &points);
+  void Nearest_Search(const PointType &point, int k_nearest, PointVector &nearest, std::vector<float> &dists) const;
+  size_t size() const { return pts.size(); }
+
+ private:
+  struct Pt
+  {
+    float x, y, z, intensity;
+    float operator[](int i) const { return (&x)[i]; }
+  };
+
+  void build(size_t lo, size_t hi);
+  void search(size_t lo, size_t hi, const float q[3], int k, float *best_d, uint32_t *best_i, int &n) const;
+
+  std::vector<Pt> pts;
+  std::vector<uint8_t> dims;   // 每个区间中点的划分维度
+};
+#endif
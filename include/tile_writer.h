@@ -0,0 +1,65 @@
+
+#ifndef TILE_WRITER_H
+#define TILE_WRITER_H
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+#include <condition_variable>
+
+#define TILE_MAX_STAGED  (4000000)   // 等待写盘的最大点数，超过时 push 阻塞
+
+/// 与 PCD 二进制格式逐字节相同的点：x y z 加一个 4 字节字段（打包的 rgb 或 intensity）
+struct TilePoint
+{
+  float x, y, z;
+  float value;
+};
+
+/// *************Streaming tiled map writer
+/// 地图点按 tile_size 的立方体分块，后台线程把每批点追加到各自块的原始文件（与 PCD 的二进制数据段格式相同）。
+/// 内存中只保留等待写盘的点（上限 TILE_MAX_STAGED），与运行时长无关；stop() 时把每个块补上 PCD 文件头，
+/// 写出 tile_xxx.pcd 和索引文件 index.txt（块号、点数、包围盒、文件名），每次只复制一个块的数据块缓冲。
+class TileWriter
+{
+ public:
+  TileWriter();
+  ~TileWriter();
+
+  // field 为 PCD 中第四个字段的名字，"rgb" 或 "intensity"
+  bool start(const std::string &dir, const std::string &field, double tile_size);
+  void push(std::vector<TilePoint> &&points);
+  void stop();
+
+  uint64_t points() const { return total_points; }
+
+ private:
+  struct Tile
+  {
+    int ix, iy, iz;
+    uint64_t count;
+    float min[3], max[3];
+  };
+
+  void worker();
+  void write_batch(const std::vector<TilePoint> &batch);
+  void finish();
+  std::string raw_name(const Tile &tile) const;
+  std::string pcd_name(const Tile &tile) const;
+
+  std::string dir, field;
+  double tile_size;
+  std::unordered_map<int64_t, Tile> tiles;   // 只由后台线程访问
+  uint64_t total_points;
+
+  std::mutex mtx;
+  std::condition_variable sig_push, sig_pop;
+  std::deque<std::vector<TilePoint>> batches;
+  size_t staged;                   // batches 中的点数
+  bool running_;
+  std::thread thread_;
+};
+#endif
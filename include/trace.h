@@ -0,0 +1,90 @@
+
+#ifndef TRACE_H
+#define TRACE_H
+#include <atomic>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+
+#define TRACE_WINDOW     (4096)      // 每个阶段保留最近的耗时个数，用于滚动分位数
+#define TRACE_MAX_SPANS  (1 << 17)   // 导出 Chrome trace 时最多保留的最近区间数
+
+/// *************Per-stage latency tracing
+/// 每个阶段（TraceStage）记录最近 TRACE_WINDOW 次耗时，给出滚动的 p50/p95/p99/max；
+/// 同时在环形缓冲区中保留最近的区间（开始时刻、耗时、线程号、帧号），按需导出为 Chrome trace JSON（chrome://tracing）。
+/// 关闭时 TRACE_SCOPE 只有一次原子读；定义 TRACE_DISABLE 时完全不编译。
+struct TraceStage
+{
+  struct Summary
+  {
+    uint64_t count;     // 总次数
+    double mean_ms;     // 总平均
+    double p50_ms, p95_ms, p99_ms, max_ms;   // 最近 TRACE_WINDOW 次
+  };
+
+  explicit TraceStage(const char *name);
+
+  const char *name;
+  int64_t window[TRACE_WINDOW];   // 以下由 Tracer 的锁保护
+  uint64_t count;
+  double sum_ns;
+};
+
+class Tracer
+{
+ public:
+  static void set_enabled(bool en) { enabled_.store(en, std::memory_order_relaxed); }
+  static bool enabled() { return enabled_.load(std::memory_order_relaxed); }
+  static void set_frame(int frame) { frame_.store(frame, std::memory_order_relaxed); }
+
+  static TraceStage *stage(const char *name);
+  static int64_t now_ns();
+  static void record(TraceStage *stage, int64_t begin_ns, int64_t end_ns);
+  static void record_duration(TraceStage *stage, double dur_s);
+
+  static TraceStage::Summary summary(const TraceStage *stage);
+  static void print_summary(FILE *fp = stdout);
+  static bool dump_chrome(const std::string &file_name);
+
+ private:
+  static std::atomic<bool> enabled_;
+  static std::atomic<int> frame_;
+};
+
+/// 作用域计时，析构时记录一个区间
+class TraceScope
+{
+ public:
+  explicit TraceScope(TraceStage *stage)
+      : stage_(Tracer::enabled() ? stage : nullptr), begin_ns(stage_ ? Tracer::now_ns() : 0) {}
+  ~TraceScope()
+  {
+    if (stage_) Tracer::record(stage_, begin_ns, Tracer::now_ns());
+  }
+
+ private:
+  TraceStage *stage_;
+  int64_t begin_ns;
+};
+
+#define TRACE_CAT_(a, b) a##b
+#define TRACE_CAT(a, b)  TRACE_CAT_(a, b)
+
+#ifdef TRACE_DISABLE
+#define TRACE_SCOPE(name)
+#define TRACE_RECORD(name, dur_s)
+#else
+// name 必须是字符串常量，阶段在第一次执行时注册
+#define TRACE_SCOPE(name) \
+  static TraceStage *TRACE_CAT(trace_stage_, __LINE__) = Tracer::stage(name); \
+  TraceScope TRACE_CAT(trace_scope_, __LINE__)(TRACE_CAT(trace_stage_, __LINE__))
+// 记录一个到当前时刻结束、耗时为 dur_s 秒的区间，用于已有的 omp_get_wtime 计时
+#define TRACE_RECORD(name, dur_s) \
+  do { \
+    if (Tracer::enabled()) { \
+      static TraceStage *trace_stage_ = Tracer::stage(name); \
+      Tracer::record_duration(trace_stage_, dur_s); \
+    } \
+  } while (0)
+#endif
+#endif
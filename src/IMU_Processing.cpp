@@ -5,8 +5,150 @@ const bool time_list(PointType &x, PointType &y)
   return (x.curvature < y.curvature);
 }
 
+/**
+ * @brief 协方差传播的稠密实现 cov = F_x * cov * F_x^T + cov_w，作为分块实现的参考
+ */
+void PropagateCovDense(MD(DIM_STATE, DIM_STATE) &cov, const M3D &Exp_neg, const M3D &R_imu, const M3D &acc_avr_skew, double dt,
+                       const V3D &cov_gyr, const V3D &cov_acc, const V3D &cov_bias_gyr, const V3D &cov_bias_acc)
+{
+  MD(DIM_STATE, DIM_STATE) F_x, cov_w;
+  F_x.setIdentity();
+  cov_w.setZero();
+
+  F_x.block<3,3>(0,0)  = Exp_neg;
+  F_x.block<3,3>(0,9)  = - Eye3d * dt;
+  // F_x.block<3,3>(3,0)  = R_imu * off_vel_skew * dt;
+  F_x.block<3,3>(3,6)  = Eye3d * dt;
+  F_x.block<3,3>(6,0)  = - R_imu * acc_avr_skew * dt;
+  F_x.block<3,3>(6,12) = - R_imu * dt;
+  F_x.block<3,3>(6,15) = Eye3d * dt;
+
+  cov_w.block<3,3>(0,0).diagonal()   = cov_gyr * dt * dt;
+  cov_w.block<3,3>(6,6)              = R_imu * cov_acc.asDiagonal() * R_imu.transpose() * dt * dt;
+  cov_w.block<3,3>(9,9).diagonal()   = cov_bias_gyr * dt * dt; // bias gyro covariance
+  cov_w.block<3,3>(12,12).diagonal() = cov_bias_acc * dt * dt; // bias acc covariance
+
+  cov = F_x * cov * F_x.transpose() + cov_w;
+}
+
+/**
+ * @brief 按3x3分块的协方差传播，结果与 PropagateCovDense 一致
+ *        状态顺序为 R p v bg ba g，F_x 只有 R、p、v 三个行块不是单位阵：
+ *        R' = Exp_neg * R - dt * bg
+ *        p' = p + dt * v
+ *        v' = v + F_vr * R + F_va * ba + dt * g
+ *        因此 F_x * cov 只需更新三个行块，(F_x * cov) * F_x^T 只需更新三个列块
+ */
+void PropagateCovBlock(MD(DIM_STATE, DIM_STATE) &cov, const M3D &Exp_neg, const M3D &R_imu, const M3D &acc_avr_skew, double dt,
+                       const V3D &cov_gyr, const V3D &cov_acc, const V3D &cov_bias_gyr, const V3D &cov_bias_acc)
+{
+  const M3D F_vr = - R_imu * acc_avr_skew * dt;
+  const M3D F_va = - R_imu * dt;
+
+  // 左乘 F_x：先算 v 行（用到原始的 R 行），再算 p 行（用到原始的 v 行），最后算 R 行
+  Matrix<double, 3, DIM_STATE> row_v = cov.block<3, DIM_STATE>(6, 0);
+  Matrix<double, 3, DIM_STATE> row_tmp = F_vr * cov.block<3, DIM_STATE>(0, 0);
+  row_tmp.noalias() += F_va * cov.block<3, DIM_STATE>(12, 0);
+  cov.block<3, DIM_STATE>(6, 0) += row_tmp + dt * cov.block<3, DIM_STATE>(15, 0);
+  cov.block<3, DIM_STATE>(3, 0) += dt * row_v;
+  row_tmp.noalias() = Exp_neg * cov.block<3, DIM_STATE>(0, 0);
+  cov.block<3, DIM_STATE>(0, 0) = row_tmp - dt * cov.block<3, DIM_STATE>(9, 0);
+
+  // 右乘 F_x^T：列块的更新顺序同上
+  Matrix<double, DIM_STATE, 3> col_v = cov.block<DIM_STATE, 3>(0, 6);
+  Matrix<double, DIM_STATE, 3> col_tmp = cov.block<DIM_STATE, 3>(0, 0) * F_vr.transpose();
+  col_tmp.noalias() += cov.block<DIM_STATE, 3>(0, 12) * F_va.transpose();
+  cov.block<DIM_STATE, 3>(0, 6) += col_tmp + dt * cov.block<DIM_STATE, 3>(0, 15);
+  cov.block<DIM_STATE, 3>(0, 3) += dt * col_v;
+  col_tmp.noalias() = cov.block<DIM_STATE, 3>(0, 0) * Exp_neg.transpose();
+  cov.block<DIM_STATE, 3>(0, 0) = col_tmp - dt * cov.block<DIM_STATE, 3>(0, 9);
+
+  // 过程噪声只在对角块上
+  cov.block<3,3>(0,0).diagonal()   += cov_gyr * dt * dt;
+  cov.block<3,3>(6,6)              += R_imu * cov_acc.asDiagonal() * R_imu.transpose() * dt * dt;
+  cov.block<3,3>(9,9).diagonal()   += cov_bias_gyr * dt * dt; // bias gyro covariance
+  cov.block<3,3>(12,12).diagonal() += cov_bias_acc * dt * dt; // bias acc covariance
+}
+
+/**
+ * @brief 构建一个IMU段内的去畸变模型
+ *        段内点的补偿为 P' = extR_Ri * (R_i * (R_L * P + t_L) + T_ei) - exrR_extT，
+ *        其中 R_i = R_head * Exp(gyr, dt)，T_ei = pos + vel * dt + 0.5 * acc * dt^2 - pos_end。
+ *        Exp(gyr, dt) = I + s * W + c * W^2，s = sin(θ) / |gyr|，c = (1 - cos(θ)) / |gyr|^2，θ = |gyr| * dt，
+ *        s、c 取到 θ^4 的展开（θ < 0.3 时误差小于 1e-7），则 P' = (M0 + s * M1 + c * M2) * P + b0 + s * b1 + c * b2 + dt * bv + dt^2 * ba
+ */
+void BuildDeskewModel(DeskewModel &model, const M3D &R_head, const V3D &pos_head, const V3D &vel_head, const V3D &acc_head,
+                      const V3D &gyr_head, const M3D &extR_Ri, const V3D &pos_end, const M3D &Lid_rot_to_IMU,
+                      const V3D &Lid_offset_to_IMU, const V3D &exrR_extT, double time_offset)
+{
+  M3D W;
+  W<<SKEW_SYM_MATRX(gyr_head);
+  const M3D ER  = extR_Ri * R_head;
+  const M3D ERW = ER * W;
+  const M3D ERW2 = ERW * W;
+  Map<Matrix<float, 3, 3, RowMajor>>(model.M0) = (ER * Lid_rot_to_IMU).cast<float>();
+  Map<Matrix<float, 3, 3, RowMajor>>(model.M1) = (ERW * Lid_rot_to_IMU).cast<float>();
+  Map<Matrix<float, 3, 3, RowMajor>>(model.M2) = (ERW2 * Lid_rot_to_IMU).cast<float>();
+  Map<V3F>(model.b0) = (ER * Lid_offset_to_IMU + extR_Ri * (pos_head - pos_end) - exrR_extT).cast<float>();
+  Map<V3F>(model.b1) = (ERW * Lid_offset_to_IMU).cast<float>();
+  Map<V3F>(model.b2) = (ERW2 * Lid_offset_to_IMU).cast<float>();
+  Map<V3F>(model.bv) = (extR_Ri * vel_head).cast<float>();
+  Map<V3F>(model.ba) = (0.5 * extR_Ri * acc_head).cast<float>();
+  model.w2 = gyr_head.squaredNorm();
+  model.time_offset = time_offset;
+}
+
+/**
+ * @brief 用段内模型变换 n 个点，点的时间为 curvature（毫秒，相对扫描起点）
+ *        点按块拷贝到连续的 float 数组中再做 SIMD 变换，避免对 PointType 的跨步访问
+ */
+void ApplyDeskewModel(const DeskewModel &model, PointType *pts, int n)
+{
+  const float *M0 = model.M0, *M1 = model.M1, *M2 = model.M2;
+  const float *b0 = model.b0, *b1 = model.b1, *b2 = model.b2, *bv = model.bv, *ba = model.ba;
+  const float w2 = model.w2;
+  const float t_off = model.time_offset;
+  float px[DESKEW_BLOCK], py[DESKEW_BLOCK], pz[DESKEW_BLOCK], pt[DESKEW_BLOCK];
+  for (int beg = 0; beg < n; beg += DESKEW_BLOCK)
+  {
+    const int m = min(DESKEW_BLOCK, n - beg);
+    PointType *blk = pts + beg;
+    for (int i = 0; i < m; i++)
+    {
+      px[i] = blk[i].x;
+      py[i] = blk[i].y;
+      pz[i] = blk[i].z;
+      pt[i] = blk[i].curvature;
+    }
+
+    #pragma omp simd
+    for (int i = 0; i < m; i++)
+    {
+      const float dt  = pt[i] * 0.001f - t_off;
+      const float dt2 = dt * dt;
+      const float th2 = w2 * dt2;
+      const float s   = dt * (1.0f - th2 * (1.0f / 6.0f) * (1.0f - th2 * (1.0f / 20.0f)));
+      const float c   = dt2 * (0.5f - th2 * (1.0f / 24.0f) * (1.0f - th2 * (1.0f / 30.0f)));
+      const float x = px[i], y = py[i], z = pz[i];
+      px[i] = M0[0] * x + M0[1] * y + M0[2] * z + s * (M1[0] * x + M1[1] * y + M1[2] * z + b1[0]) \
+            + c * (M2[0] * x + M2[1] * y + M2[2] * z + b2[0]) + b0[0] + dt * bv[0] + dt2 * ba[0];
+      py[i] = M0[3] * x + M0[4] * y + M0[5] * z + s * (M1[3] * x + M1[4] * y + M1[5] * z + b1[1]) \
+            + c * (M2[3] * x + M2[4] * y + M2[5] * z + b2[1]) + b0[1] + dt * bv[1] + dt2 * ba[1];
+      pz[i] = M0[6] * x + M0[7] * y + M0[8] * z + s * (M1[6] * x + M1[7] * y + M1[8] * z + b1[2]) \
+            + c * (M2[6] * x + M2[7] * y + M2[8] * z + b2[2]) + b0[2] + dt * bv[2] + dt2 * ba[2];
+    }
+
+    for (int i = 0; i < m; i++)
+    {
+      blk[i].x = px[i];
+      blk[i].y = py[i];
+      blk[i].z = pz[i];
+    }
+  }
+}
+
 ImuProcess::ImuProcess()
-    : b_first_frame_(true), imu_need_init_(true), start_timestamp_(-1)
+    : b_first_frame_(true), imu_need_init_(true), start_timestamp_(-1), last_lidar_end_time_(0)
 {
   init_iter_num = 1;
   #ifdef USE_IKFOM
@@ -224,7 +366,7 @@ void ImuProcess::UndistortPcl(const MeasureGroup &meas, esekfom::esekf<state_ikf
                 0.5 * (head->linear_acceleration.z + tail->linear_acceleration.z);
 
     // #ifdef DEBUG_PRINT
-    fout_imu << setw(10) << head->header.stamp.toSec() - first_lidar_time << " " << angvel_avr.transpose() << " " << acc_avr.transpose() << endl;
+    if (logger) logger->log_imu(head->header.stamp.toSec() - first_lidar_time, angvel_avr, acc_avr);
     // #endif
 
     acc_avr     = acc_avr * G_m_s2 / mean_acc.norm(); // - state_inout.ba;
@@ -312,6 +454,7 @@ void ImuProcess::UndistortPcl(const MeasureGroup &meas, esekfom::esekf<state_ikf
 
 void ImuProcess::Forward(const MeasureGroup &meas, StatesGroup &state_inout, double pcl_beg_time, double end_time)
 {
+  TRACE_SCOPE("imu_forward");
   /*** add the imu of the last frame-tail to the of current frame-head ***/
   auto v_imu = meas.imu;
   v_imu.push_front(last_imu_);
@@ -330,7 +473,6 @@ void ImuProcess::Forward(const MeasureGroup &meas, StatesGroup &state_inout, dou
   V3D acc_imu=acc_s_last, angvel_avr=angvel_last, acc_avr, vel_imu(state_inout.vel_end), pos_imu(state_inout.pos_end);
   M3D R_imu(state_inout.rot_end);
   //  last_state = state_inout;
-  MD(DIM_STATE, DIM_STATE) F_x, cov_w;
   
   double dt = 0;
   for (auto it_imu = v_imu.begin(); it_imu < (v_imu.end() - 1); it_imu++)
@@ -352,7 +494,7 @@ void ImuProcess::Forward(const MeasureGroup &meas, StatesGroup &state_inout, dou
     last_acc = acc_avr;
     last_ang = angvel_avr;
     // #ifdef DEBUG_PRINT
-      fout_imu << setw(10) << head->header.stamp.toSec() - first_lidar_time << " " << angvel_avr.transpose() << " " << acc_avr.transpose() << endl;
+      if (logger) logger->log_imu(head->header.stamp.toSec() - first_lidar_time, angvel_avr, acc_avr);
     // #endif
 
     angvel_avr -= state_inout.bias_g;
@@ -372,23 +514,9 @@ void ImuProcess::Forward(const MeasureGroup &meas, StatesGroup &state_inout, dou
     M3D Exp_f   = Exp(angvel_avr, dt);
     acc_avr_skew<<SKEW_SYM_MATRX(acc_avr);
 
-    F_x.setIdentity();
-    cov_w.setZero();
-
-    F_x.block<3,3>(0,0)  = Exp(angvel_avr, - dt);
-    F_x.block<3,3>(0,9)  = - Eye3d * dt;
-    // F_x.block<3,3>(3,0)  = R_imu * off_vel_skew * dt;
-    F_x.block<3,3>(3,6)  = Eye3d * dt;
-    F_x.block<3,3>(6,0)  = - R_imu * acc_avr_skew * dt;
-    F_x.block<3,3>(6,12) = - R_imu * dt;
-    F_x.block<3,3>(6,15) = Eye3d * dt;
-
-    cov_w.block<3,3>(0,0).diagonal()   = cov_gyr * dt * dt;
-    cov_w.block<3,3>(6,6)              = R_imu * cov_acc.asDiagonal() * R_imu.transpose() * dt * dt;
-    cov_w.block<3,3>(9,9).diagonal()   = cov_bias_gyr * dt * dt; // bias gyro covariance
-    cov_w.block<3,3>(12,12).diagonal() = cov_bias_acc * dt * dt; // bias acc covariance
-
-    state_inout.cov = F_x * state_inout.cov * F_x.transpose() + cov_w;
+    // 按3x3分块传播协方差，等价于 F_x * cov * F_x^T + cov_w
+    PropagateCovBlock(state_inout.cov, Exp(angvel_avr, - dt), R_imu, acc_avr_skew, dt, \
+                      cov_gyr, cov_acc, cov_bias_gyr, cov_bias_acc);
 
     /* propogation of IMU attitude */
     R_imu = R_imu * Exp_f;
@@ -501,7 +629,6 @@ void ImuProcess::Process(const LidarMeasureGroup &lidar_meas,  esekfom::esekf<st
       // cout<<"mean acc: "<<mean_acc<<" acc measures in word frame:"<<state.rot_end.transpose()*mean_acc<<endl;
       ROS_INFO("IMU Initials: Gravity: %.4f %.4f %.4f %.4f; state.bias_g: %.4f %.4f %.4f; acc covarience: %.8f %.8f %.8f; gry covarience: %.8f %.8f %.8f",\
                imu_state.grav[0], imu_state.grav[1], imu_state.grav[2], mean_acc.norm(), cov_bias_gyr[0], cov_bias_gyr[1], cov_bias_gyr[2], cov_acc[0], cov_acc[1], cov_acc[2], cov_gyr[0], cov_gyr[1], cov_gyr[2]);
-      fout_imu.open(DEBUG_FILE_DIR("imu.txt"),ios::out);
     }
 
     return;
@@ -561,7 +688,6 @@ void ImuProcess::Process(const LidarMeasureGroup &lidar_meas, StatesGroup &stat,
       // cout<<"mean acc: "<<mean_acc<<" acc measures in word frame:"<<state.rot_end.transpose()*mean_acc<<endl;
       ROS_INFO("IMU Initials: Gravity: %.4f %.4f %.4f %.4f; state.bias_g: %.4f %.4f %.4f; acc covarience: %.8f %.8f %.8f; gry covarience: %.8f %.8f %.8f",\
                stat.gravity[0], stat.gravity[1], stat.gravity[2], mean_acc.norm(), cov_bias_gyr[0], cov_bias_gyr[1], cov_bias_gyr[2], cov_acc[0], cov_acc[1], cov_acc[2], cov_gyr[0], cov_gyr[1], cov_gyr[2]);
-      fout_imu.open(DEBUG_FILE_DIR("imu.txt"),ios::out);
     }
 
     return;
@@ -613,6 +739,7 @@ void ImuProcess::Process(const LidarMeasureGroup &lidar_meas, StatesGroup &stat,
 // 完成滤波器的预测步并用于点云去畸变，和fast-lio基本一致
 void ImuProcess::UndistortPcl(LidarMeasureGroup &lidar_meas, StatesGroup &state_inout, PointCloudXYZI &pcl_out)
 {
+  TRACE_SCOPE("imu_undistort");
   /*** add the imu of the last frame-tail to the of current frame-head ***/
   MeasureGroup meas;
   meas = lidar_meas.measures.back();
@@ -631,7 +758,9 @@ void ImuProcess::UndistortPcl(LidarMeasureGroup &lidar_meas, StatesGroup &state_
   const double pcl_end_time = lidar_meas.is_lidar_end? 
                                         lidar_meas.lidar_beg_time + lidar_meas.lidar->points.back().curvature / double(1000):
                                         lidar_meas.lidar_beg_time + lidar_meas.measures.back().img_offset_time;
-  const double pcl_offset_time = lidar_meas.is_lidar_end? 
+  // 图像帧的更新不消耗点云，扫描结束和子扫描（slice）的更新消耗到更新时刻为止的点
+  const bool consume_pcl = lidar_meas.is_lidar_end || meas.img == nullptr;
+  const double pcl_offset_time = consume_pcl? 
                                         (pcl_end_time - lidar_meas.lidar_beg_time) * double(1000):
                                         0.0;
   while (pcl_it != pcl_it_end && pcl_it->curvature <= pcl_offset_time)
@@ -660,7 +789,6 @@ void ImuProcess::UndistortPcl(LidarMeasureGroup &lidar_meas, StatesGroup &state_
   /*** forward propagation at each imu point ***/
   V3D acc_imu(acc_s_last), angvel_avr(angvel_last), acc_avr, vel_imu(state_inout.vel_end), pos_imu(state_inout.pos_end);
   M3D R_imu(state_inout.rot_end);
-  MD(DIM_STATE, DIM_STATE) F_x, cov_w;
   
   // 正向传播，计算每个IMU点的预测状态
   double dt = 0;
@@ -682,7 +810,7 @@ void ImuProcess::UndistortPcl(LidarMeasureGroup &lidar_meas, StatesGroup &state_
                 0.5 * (head->linear_acceleration.z + tail->linear_acceleration.z);
 
     // #ifdef DEBUG_PRINT
-      fout_imu << setw(10) << head->header.stamp.toSec() - first_lidar_time << " " << angvel_avr.transpose() << " " << acc_avr.transpose() << endl;
+      if (logger) logger->log_imu(head->header.stamp.toSec() - first_lidar_time, angvel_avr, acc_avr);
     // #endif
 
     angvel_avr -= state_inout.bias_g;
@@ -702,23 +830,9 @@ void ImuProcess::UndistortPcl(LidarMeasureGroup &lidar_meas, StatesGroup &state_
     M3D Exp_f   = Exp(angvel_avr, dt);
     acc_avr_skew<<SKEW_SYM_MATRX(acc_avr);
 
-    F_x.setIdentity();
-    cov_w.setZero();
-
-    F_x.block<3,3>(0,0)  = Exp(angvel_avr, - dt);
-    F_x.block<3,3>(0,9)  = - Eye3d * dt;
-    // F_x.block<3,3>(3,0)  = R_imu * off_vel_skew * dt;
-    F_x.block<3,3>(3,6)  = Eye3d * dt;
-    F_x.block<3,3>(6,0)  = - R_imu * acc_avr_skew * dt;
-    F_x.block<3,3>(6,12) = - R_imu * dt;
-    F_x.block<3,3>(6,15) = Eye3d * dt;
-
-    cov_w.block<3,3>(0,0).diagonal()   = cov_gyr * dt * dt;
-    cov_w.block<3,3>(6,6)              = R_imu * cov_acc.asDiagonal() * R_imu.transpose() * dt * dt;
-    cov_w.block<3,3>(9,9).diagonal()   = cov_bias_gyr * dt * dt; // bias gyro covariance
-    cov_w.block<3,3>(12,12).diagonal() = cov_bias_acc * dt * dt; // bias acc covariance
-
-    state_inout.cov = F_x * state_inout.cov * F_x.transpose() + cov_w;
+    // 按3x3分块传播协方差，等价于 F_x * cov * F_x^T + cov_w
+    PropagateCovBlock(state_inout.cov, Exp(angvel_avr, - dt), R_imu, acc_avr_skew, dt, \
+                      cov_gyr, cov_acc, cov_bias_gyr, cov_bias_acc);
 
     /* propogation of IMU attitude */
     R_imu = R_imu * Exp_f;
@@ -777,40 +891,53 @@ void ImuProcess::UndistortPcl(LidarMeasureGroup &lidar_meas, StatesGroup &state_
   if (pcl_out.points.size() < 1) return;
 
   // 反向传播，点云去畸变，计算每个点的实际位置，将点云转换至lidar_end_time时刻下
+  // 点的时间相对于扫描起点，IMUpose的时间相对于pcl_beg_time（上次更新时刻），需要统一时间基准；
+  // 早于pcl_beg_time的点（例如图像或子扫描更新之前的点）用第一段的运动反向外推
   /*** undistort each lidar point (backward propagation) ***/
-  auto it_pcl = pcl_out.points.end() - 1;
-  for (auto it_kp = IMUpose.end() - 1; it_kp != IMUpose.begin(); it_kp--)
+  const double pcl_offs_time = pcl_beg_time - lidar_meas.lidar_beg_time;
+  const int seg_num = IMUpose.size() - 1;
+  if (seg_num < 1) return;
+
+  // 1. 按IMU段划分点的区间，划分规则与逐点反向遍历一致，只比较时间
+  seg_pcl_beg.assign(seg_num + 1, 0);
+  seg_pcl_beg[seg_num] = pcl_out.points.size();
+  int i_pcl = pcl_out.points.size() - 1;
+  for (int k = seg_num - 1; k >= 0; k--)
   {
-    auto head = it_kp - 1;
-    auto tail = it_kp;
-    R_imu<<MAT_FROM_ARRAY(head->rot);
-    acc_imu<<VEC_FROM_ARRAY(head->acc);
-    // cout<<"head imu acc: "<<acc_imu.transpose()<<endl;
-    vel_imu<<VEC_FROM_ARRAY(head->vel);
-    pos_imu<<VEC_FROM_ARRAY(head->pos);
-    angvel_avr<<VEC_FROM_ARRAY(head->gyr);
-
-    for(; it_pcl->curvature / double(1000) > head->offset_time; it_pcl --)
+    const double head_time = pcl_offs_time + IMUpose[k].offset_time;
+    if (k > 0)
     {
-      dt = it_pcl->curvature / double(1000) - head->offset_time;
-
-      /* Transform to the 'end' frame, using only the rotation
-       * Note: Compensation direction is INVERSE of Frame's moving direction
-       * So if we want to compensate a point at timestamp-i to the frame-e
-       * P_compensate = R_imu_e ^ T * (R_i * P_i + T_ei) where T_ei is represented in global frame */
-      M3D R_i(R_imu * Exp(angvel_avr, dt));
-      V3D T_ei(pos_imu + vel_imu * dt + 0.5 * acc_imu * dt * dt - state_inout.pos_end);
-
-      V3D P_i(it_pcl->x, it_pcl->y, it_pcl->z);
-      V3D P_compensate = (extR_Ri * (R_i * (Lid_rot_to_IMU * P_i + Lid_offset_to_IMU) + T_ei) - exrR_extT);
-
-      /// save Undistorted points and their rotation
-      it_pcl->x = P_compensate(0);
-      it_pcl->y = P_compensate(1);
-      it_pcl->z = P_compensate(2);
-
-      if (it_pcl == pcl_out.points.begin()) break;
+      while (i_pcl >= 0 && pcl_out.points[i_pcl].curvature / double(1000) - head_time > 0) i_pcl --;
+    }
+    else
+    {
+      i_pcl = -1;
     }
+    seg_pcl_beg[k] = i_pcl + 1;
+  }
+
+  // 2. 每段构建一次运动模型，段内用float SIMD变换，各段并行
+  #ifdef MP_EN
+      omp_set_num_threads(MP_PROC_NUM);
+      #pragma omp parallel for schedule(dynamic)
+  #endif
+  for (int k = 0; k < seg_num; k++)
+  {
+    const int n = seg_pcl_beg[k + 1] - seg_pcl_beg[k];
+    if (n <= 0) continue;
+    const Pose6D &head = IMUpose[k];
+    M3D R_head;
+    V3D acc_head, vel_head, pos_head, gyr_head;
+    R_head<<MAT_FROM_ARRAY(head.rot);
+    acc_head<<VEC_FROM_ARRAY(head.acc);
+    vel_head<<VEC_FROM_ARRAY(head.vel);
+    pos_head<<VEC_FROM_ARRAY(head.pos);
+    gyr_head<<VEC_FROM_ARRAY(head.gyr);
+
+    DeskewModel model;
+    BuildDeskewModel(model, R_head, pos_head, vel_head, acc_head, gyr_head, extR_Ri, state_inout.pos_end, \
+                     Lid_rot_to_IMU, Lid_offset_to_IMU, exrR_extT, pcl_offs_time + head.offset_time);
+    ApplyDeskewModel(model, &pcl_out.points[seg_pcl_beg[k]], n);
   }
 }
 
@@ -847,7 +974,6 @@ void ImuProcess::Process2(LidarMeasureGroup &lidar_meas, StatesGroup &stat, Poin
       // cout<<"mean acc: "<<mean_acc<<" acc measures in word frame:"<<state.rot_end.transpose()*mean_acc<<endl;
       ROS_INFO("IMU Initials: Gravity: %.4f %.4f %.4f %.4f; state.bias_g: %.4f %.4f %.4f; acc covarience: %.8f %.8f %.8f; gry covarience: %.8f %.8f %.8f",\
                stat.gravity[0], stat.gravity[1], stat.gravity[2], mean_acc.norm(), cov_bias_gyr[0], cov_bias_gyr[1], cov_bias_gyr[2], cov_acc[0], cov_acc[1], cov_acc[2], cov_gyr[0], cov_gyr[1], cov_gyr[2]);
-      fout_imu.open(DEBUG_FILE_DIR("imu.txt"),ios::out);
     }
 
     return;
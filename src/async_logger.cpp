@@ -0,0 +1,138 @@
+#include "async_logger.h"
+#include <chrono>
+#include <cstring>
+
+AsyncLogger::AsyncLogger()
+    : ring(new Record[LOG_RING_SIZE]), head_(0), tail_(0), dropped_(0), running(false), fp(nullptr)
+{
+}
+
+AsyncLogger::~AsyncLogger()
+{
+  stop();
+  delete[] ring;
+}
+
+bool AsyncLogger::start(const std::string &file_name)
+{
+  fp = fopen(file_name.c_str(), "wb");
+  if (fp == nullptr)
+  {
+    printf("[ LOG ]: failed to open %s, logging disabled.\n", file_name.c_str());
+    return false;
+  }
+  const char magic[8] = LOG_MAGIC;
+  fwrite(magic, 1, sizeof(magic), fp);
+  running = true;
+  thread_ = std::thread(&AsyncLogger::worker, this);
+  return true;
+}
+
+void AsyncLogger::stop()
+{
+  if (!running) return;
+  running = false;
+  if (thread_.joinable()) thread_.join();
+  drain();
+  fclose(fp);
+  fp = nullptr;
+  if (dropped_ > 0) printf("[ LOG ]: %lu records dropped, ring buffer full.\n", (unsigned long)dropped_.load());
+}
+
+/**
+ * @brief 取一个空闲槽位，缓冲区满时返回 nullptr，不阻塞生产者
+ */
+AsyncLogger::Record *AsyncLogger::acquire()
+{
+  if (!running) return nullptr;
+  const uint64_t head = head_.load(std::memory_order_relaxed);
+  if (head - tail_.load(std::memory_order_acquire) >= LOG_RING_SIZE)
+  {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  return &ring[head & (LOG_RING_SIZE - 1)];
+}
+
+void AsyncLogger::commit()
+{
+  head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void AsyncLogger::log_imu(double time, const Eigen::Vector3d &gyr, const Eigen::Vector3d &acc)
+{
+  Record *rec = acquire();
+  if (rec == nullptr) return;
+  rec->type    = LOG_IMU;
+  rec->num     = 7;
+  rec->data[0] = time;
+  for (int i = 0; i < 3; i++)
+  {
+    rec->data[1 + i] = gyr(i);
+    rec->data[4 + i] = acc(i);
+  }
+  commit();
+}
+
+void AsyncLogger::log_state(uint32_t type, double time, const Eigen::Vector3d &euler, const Eigen::Vector3d &pos, const Eigen::Vector3d &vel,
+                            const Eigen::Vector3d &bg, const Eigen::Vector3d &ba, const Eigen::Vector3d &grav, int feats_num)
+{
+  Record *rec = acquire();
+  if (rec == nullptr) return;
+  rec->type    = type;
+  rec->num     = feats_num < 0 ? 19 : 20;
+  rec->data[0] = time;
+  for (int i = 0; i < 3; i++)
+  {
+    rec->data[1 + i]  = euler(i);
+    rec->data[4 + i]  = pos(i);
+    rec->data[7 + i]  = vel(i);
+    rec->data[10 + i] = bg(i);
+    rec->data[13 + i] = ba(i);
+    rec->data[16 + i] = grav(i);
+  }
+  if (feats_num >= 0) rec->data[19] = feats_num;
+  commit();
+}
+
+void AsyncLogger::log_pose(double time, const Eigen::Vector3d &t, const Eigen::Quaterniond &q)
+{
+  Record *rec = acquire();
+  if (rec == nullptr) return;
+  rec->type    = LOG_POSE_TUM;
+  rec->num     = 8;
+  rec->data[0] = time;
+  rec->data[1] = t.x();
+  rec->data[2] = t.y();
+  rec->data[3] = t.z();
+  rec->data[4] = q.x();
+  rec->data[5] = q.y();
+  rec->data[6] = q.z();
+  rec->data[7] = q.w();
+  commit();
+}
+
+/**
+ * @brief 把缓冲区中已提交的记录写入文件，返回写入的记录数
+ */
+size_t AsyncLogger::drain()
+{
+  const uint64_t head = head_.load(std::memory_order_acquire);
+  uint64_t tail = tail_.load(std::memory_order_relaxed);
+  const size_t n = head - tail;
+  for (; tail != head; tail++)
+  {
+    const Record &rec = ring[tail & (LOG_RING_SIZE - 1)];
+    fwrite(&rec, sizeof(uint32_t) * 2 + sizeof(double) * rec.num, 1, fp);
+  }
+  tail_.store(tail, std::memory_order_release);
+  return n;
+}
+
+void AsyncLogger::worker()
+{
+  while (running)
+  {
+    if (drain() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+}
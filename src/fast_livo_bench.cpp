@@ -0,0 +1,582 @@
+// 热点函数的微基准测试，不依赖ROS master和数据集，输入均为固定随机种子生成的合成数据
+// 用法：rosrun fast_livo fast_livo_bench [重复次数] [结果json文件]
+// 每项结果以 CSV 行（BENCH_CSV 前缀）输出 ns/op 和吞吐量，给出文件名时同时写成 JSON，便于版本间对比
+#include <omp.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <so3_math.h>
+#include <common_lib.h>
+#include "IMU_Processing.h"
+#include <ikd-Tree/ikd_Tree.h>
+#include <vikit/pinhole_camera.h>
+#include "lidar_selection.h"
+
+M3D Eye3d(M3D::Identity());
+M3F Eye3f(M3F::Identity());
+V3D Zero3d(0, 0, 0);
+V3F Zero3f(0, 0, 0);
+
+// 一帧扫描对应的IMU传播步数：10Hz雷达，200Hz IMU
+#define BENCH_IMU_STEPS (20)
+
+struct BenchResult
+{
+  string name;
+  long ops;              // 计时的操作次数
+  double ns_per_op;
+  double items_per_s;    // 吞吐量，单位见 unit
+  string unit;
+};
+static vector<BenchResult> bench_results;
+
+/**
+ * @brief 记录一项结果：seconds 内完成 ops 次操作，每次处理 items_per_op 个 unit
+ */
+static void report(const string &name, double seconds, long ops, double items_per_op, const string &unit)
+{
+  BenchResult res;
+  res.name        = name;
+  res.ops         = ops;
+  res.ns_per_op   = seconds / max(ops, 1L) * 1e9;
+  res.items_per_s = seconds > 0 ? ops * items_per_op / seconds : 0.0;
+  res.unit        = unit;
+  bench_results.push_back(res);
+  printf("[ BENCH ]:   %-28s %14.1f ns/op %14.4g %s/s\n", name.c_str(), res.ns_per_op, res.items_per_s, unit.c_str());
+}
+
+static void print_results_csv()
+{
+  printf("BENCH_CSV,name,ops,ns_per_op,items_per_s,unit\n");
+  for (const BenchResult &res : bench_results)
+    printf("BENCH_CSV,%s,%ld,%.3f,%.6g,%s\n", res.name.c_str(), res.ops, res.ns_per_op, res.items_per_s, res.unit.c_str());
+}
+
+static bool write_results_json(const char *file_name)
+{
+  FILE *fp = fopen(file_name, "w");
+  if (fp == nullptr)
+  {
+    printf("[ BENCH ]: failed to open %s.\n", file_name);
+    return false;
+  }
+  fprintf(fp, "{\"results\":[\n");
+  for (size_t i = 0; i < bench_results.size(); i++)
+  {
+    const BenchResult &res = bench_results[i];
+    fprintf(fp, "{\"name\":\"%s\",\"ops\":%ld,\"ns_per_op\":%.3f,\"items_per_s\":%.6g,\"unit\":\"%s\"}%s\n",
+            res.name.c_str(), res.ops, res.ns_per_op, res.items_per_s, res.unit.c_str(), i + 1 < bench_results.size() ? "," : "");
+  }
+  fprintf(fp, "]}\n");
+  fclose(fp);
+  printf("[ BENCH ]: %d results written to %s.\n", int(bench_results.size()), file_name);
+  return true;
+}
+
+struct CovStep
+{
+  M3D Exp_neg, R_imu, acc_avr_skew;
+  double dt;
+};
+
+/**
+ * @brief 生成一帧扫描的传播输入，角速度和加速度为随机的合理量级
+ */
+static void make_cov_steps(vector<CovStep> &steps)
+{
+  srand(1);
+  M3D R_imu(Eye3d);
+  steps.resize(BENCH_IMU_STEPS);
+  for (CovStep &s : steps)
+  {
+    V3D angvel_avr = V3D::Random() * 0.5;
+    V3D acc_avr    = V3D::Random() * 2.0 + V3D(0, 0, G_m_s2);
+    s.dt           = 0.005;
+    s.Exp_neg      = Exp(angvel_avr, - s.dt);
+    s.R_imu        = R_imu;
+    s.acc_avr_skew << SKEW_SYM_MATRX(acc_avr);
+    R_imu = R_imu * Exp(angvel_avr, s.dt);
+  }
+}
+
+/**
+ * @brief 协方差传播：稠密 18x18 乘法与 3x3 分块实现的耗时和误差对比
+ */
+static void bench_cov_propagation(int rounds)
+{
+  vector<CovStep> steps;
+  make_cov_steps(steps);
+  const V3D cov_gyr(0.1, 0.1, 0.1), cov_acc(0.1, 0.1, 0.1);
+  const V3D cov_bias_gyr(0.00001, 0.00001, 0.00001), cov_bias_acc(0.00001, 0.00001, 0.00001);
+
+  MD(DIM_STATE, DIM_STATE) cov_init = MD(DIM_STATE, DIM_STATE)::Identity() * INIT_COV;
+  MD(DIM_STATE, DIM_STATE) cov_dense, cov_block;
+
+  double t0 = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+  {
+    cov_dense = cov_init;
+    for (const CovStep &s : steps)
+      PropagateCovDense(cov_dense, s.Exp_neg, s.R_imu, s.acc_avr_skew, s.dt, cov_gyr, cov_acc, cov_bias_gyr, cov_bias_acc);
+  }
+  double t1 = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+  {
+    cov_block = cov_init;
+    for (const CovStep &s : steps)
+      PropagateCovBlock(cov_block, s.Exp_neg, s.R_imu, s.acc_avr_skew, s.dt, cov_gyr, cov_acc, cov_bias_gyr, cov_bias_acc);
+  }
+  double t2 = omp_get_wtime();
+
+  const double err = (cov_dense - cov_block).cwiseAbs().maxCoeff() / cov_dense.cwiseAbs().maxCoeff();
+  printf("[ BENCH ]: cov propagation, %d steps per scan, %d rounds\n", BENCH_IMU_STEPS, rounds);
+  report("cov_propagation_dense", t1 - t0, rounds, BENCH_IMU_STEPS, "steps");
+  report("cov_propagation_block", t2 - t1, rounds, BENCH_IMU_STEPS, "steps");
+  printf("[ BENCH ]:   block speedup %.2fx, max rel err %.3e\n", (t1 - t0) / (t2 - t1), err);
+}
+
+/**
+ * @brief 反向去畸变：逐点双精度（原实现）与分段 float SIMD 模型的耗时和误差对比
+ *        模拟 240k 点的 Ouster 扫描，100ms 内 BENCH_IMU_STEPS 个IMU段
+ */
+static void bench_deskew(int rounds)
+{
+  const int pcl_num = 240000;
+  const double scan_time = 0.1;
+  srand(2);
+  PointCloudXYZI pcl_in;
+  pcl_in.resize(pcl_num);
+  for (int i = 0; i < pcl_num; i++)
+  {
+    V3D p = V3D::Random() * 50.0;
+    pcl_in.points[i].x = p(0);
+    pcl_in.points[i].y = p(1);
+    pcl_in.points[i].z = p(2);
+    pcl_in.points[i].curvature = scan_time * 1000.0 * i / pcl_num;
+  }
+
+  // 匀角速度、匀加速度的IMU段
+  const V3D gyr(0.3, -0.5, 1.5), acc(0.5, -0.2, 0.1);
+  vector<M3D> seg_rot(BENCH_IMU_STEPS);
+  vector<V3D> seg_pos(BENCH_IMU_STEPS), seg_vel(BENCH_IMU_STEPS);
+  const double seg_dt = scan_time / BENCH_IMU_STEPS;
+  M3D R(Eye3d);
+  V3D pos(Zero3d), vel(1.0, 0.5, 0.0);
+  for (int k = 0; k < BENCH_IMU_STEPS; k++)
+  {
+    seg_rot[k] = R;
+    seg_pos[k] = pos;
+    seg_vel[k] = vel;
+    R   = R * Exp(gyr, seg_dt);
+    pos = pos + vel * seg_dt + 0.5 * acc * seg_dt * seg_dt;
+    vel = vel + acc * seg_dt;
+  }
+  const M3D Lid_rot_to_IMU(Eye3d);
+  const V3D Lid_offset_to_IMU(0.04165, 0.02326, -0.0284);
+  const M3D extR_Ri(Lid_rot_to_IMU.transpose() * R.transpose());
+  const V3D exrR_extT(Lid_rot_to_IMU.transpose() * Lid_offset_to_IMU);
+  const int seg_pcl = pcl_num / BENCH_IMU_STEPS;
+
+  PointCloudXYZI pcl_ref, pcl_simd;
+  double t_ref = 0, t_simd = 0;
+  for (int r = 0; r < rounds; r++)
+  {
+    pcl_ref = pcl_in;
+    double t_beg = omp_get_wtime();
+    for (int i = 0; i < pcl_num; i++)
+    {
+      PointType &pt = pcl_ref.points[i];
+      const int k = min(i / seg_pcl, BENCH_IMU_STEPS - 1);
+      const double dt = pt.curvature / double(1000) - k * seg_dt;
+      M3D R_i(seg_rot[k] * Exp(gyr, dt));
+      V3D T_ei(seg_pos[k] + seg_vel[k] * dt + 0.5 * acc * dt * dt - pos);
+      V3D P_i(pt.x, pt.y, pt.z);
+      V3D P_compensate = (extR_Ri * (R_i * (Lid_rot_to_IMU * P_i + Lid_offset_to_IMU) + T_ei) - exrR_extT);
+      pt.x = P_compensate(0);
+      pt.y = P_compensate(1);
+      pt.z = P_compensate(2);
+    }
+    t_ref += omp_get_wtime() - t_beg;
+  }
+  for (int r = 0; r < rounds; r++)
+  {
+    pcl_simd = pcl_in;
+    double t_beg = omp_get_wtime();
+    #ifdef MP_EN
+        omp_set_num_threads(MP_PROC_NUM);
+        #pragma omp parallel for schedule(dynamic)
+    #endif
+    for (int k = 0; k < BENCH_IMU_STEPS; k++)
+    {
+      const int beg = k * seg_pcl;
+      const int n = (k == BENCH_IMU_STEPS - 1) ? pcl_num - beg : seg_pcl;
+      DeskewModel model;
+      BuildDeskewModel(model, seg_rot[k], seg_pos[k], seg_vel[k], acc, gyr, extR_Ri, pos, \
+                       Lid_rot_to_IMU, Lid_offset_to_IMU, exrR_extT, k * seg_dt);
+      ApplyDeskewModel(model, &pcl_simd.points[beg], n);
+    }
+    t_simd += omp_get_wtime() - t_beg;
+  }
+
+  double err = 0;
+  for (int i = 0; i < pcl_num; i++)
+  {
+    V3F d(pcl_ref.points[i].x - pcl_simd.points[i].x, pcl_ref.points[i].y - pcl_simd.points[i].y, pcl_ref.points[i].z - pcl_simd.points[i].z);
+    err = max(err, double(d.norm()));
+  }
+  printf("[ BENCH ]: backward deskew, %d points, %d segments, %d rounds\n", pcl_num, BENCH_IMU_STEPS, rounds);
+  report("deskew_point_double", t_ref, rounds, pcl_num, "points");
+  report("deskew_segment_simd", t_simd, rounds, pcl_num, "points");
+  printf("[ BENCH ]:   simd speedup %.2fx, max err %.3e m\n", t_ref / t_simd, err);
+}
+
+/**
+ * @brief 合成的室内扫描：20m x 20m x 4m 房间的四面墙、地面和天花板，带 2cm 噪声
+ */
+static void make_room_scan(PointVector &pts, int num, unsigned seed)
+{
+  srand(seed);
+  pts.resize(num);
+  for (int i = 0; i < num; i++)
+  {
+    V3D p = V3D::Random();
+    p(0) *= 10.0;
+    p(1) *= 10.0;
+    p(2) = (p(2) + 1.0) * 2.0;
+    switch (i % 6)
+    {
+      case 0: p(0) = -10.0; break;
+      case 1: p(0) =  10.0; break;
+      case 2: p(1) = -10.0; break;
+      case 3: p(1) =  10.0; break;
+      case 4: p(2) =   0.0; break;
+      default: p(2) =  4.0; break;
+    }
+    p += V3D::Random() * 0.02;
+    pts[i].x = p(0);
+    pts[i].y = p(1);
+    pts[i].z = p(2);
+    pts[i].intensity = 0;
+  }
+}
+
+/**
+ * @brief ikd-Tree 的建树、近邻搜索、增量插入（带降采样）、按盒删除；
+ *        近邻搜索的结果同时作为 esti_plane 的输入
+ *        每轮新建的树只计时被测的调用，构造和预先建树不计入
+ */
+static void bench_ikdtree(int rounds)
+{
+  const int map_num = 100000, query_num = 20000, add_num = 20000;
+  PointVector map_pts, query_pts, add_pts;
+  make_room_scan(map_pts, map_num, 3);
+  make_room_scan(query_pts, query_num, 4);
+  make_room_scan(add_pts, add_num, 5);
+  vector<BoxPointType> boxes(4);
+  for (int k = 0; k < 4; k++)
+  {
+    const float c = -8.0f + 4.0f * k;
+    boxes[k].vertex_min[0] = c - 1.0f; boxes[k].vertex_max[0] = c + 1.0f;
+    boxes[k].vertex_min[1] = -10.5f;   boxes[k].vertex_max[1] = 10.5f;
+    boxes[k].vertex_min[2] = -0.5f;    boxes[k].vertex_max[2] = 4.5f;
+  }
+  printf("[ BENCH ]: ikd-Tree, %d map points, %d queries, %d inserted points, %d rounds\n", map_num, query_num, add_num, rounds);
+
+  double t_build = 0, t_add = 0, t_delete = 0;
+  for (int r = 0; r < rounds; r++)
+  {
+    KD_TREE tree(0.5, 0.6, 0.2);
+    double t_beg = omp_get_wtime();
+    tree.Build(map_pts);
+    t_build += omp_get_wtime() - t_beg;
+
+    KD_TREE tree_add(0.5, 0.6, 0.2);
+    tree_add.Build(map_pts);
+    t_beg = omp_get_wtime();
+    tree_add.Add_Points(add_pts, true);
+    t_add += omp_get_wtime() - t_beg;
+
+    KD_TREE tree_delete(0.5, 0.6, 0.2);
+    tree_delete.Build(map_pts);
+    t_beg = omp_get_wtime();
+    tree_delete.Delete_Point_Boxes(boxes);
+    t_delete += omp_get_wtime() - t_beg;
+  }
+  report("ikdtree_build", t_build, rounds, map_num, "points");
+  report("ikdtree_add_points", t_add, rounds, add_num, "points");
+  report("ikdtree_delete_point_boxes", t_delete, rounds, boxes.size(), "boxes");
+
+  KD_TREE tree(0.5, 0.6, 0.2);
+  tree.Build(map_pts);
+  vector<PointVector> near_sets(query_num);
+  vector<float> sq_dis;
+  double t_beg = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < query_num; i++)
+      tree.Nearest_Search(query_pts[i], NUM_MATCH_POINTS, near_sets[i], sq_dis);
+  report("ikdtree_nearest_search_k5", omp_get_wtime() - t_beg, long(rounds) * query_num, 1, "queries");
+
+  VF(4) pabcd;
+  int valid = 0;
+  t_beg = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < query_num; i++)
+      if (near_sets[i].size() == NUM_MATCH_POINTS) valid += esti_plane(pabcd, near_sets[i], 0.1f);
+  report("esti_plane", omp_get_wtime() - t_beg, long(rounds) * query_num, 1, "planes");
+  printf("[ BENCH ]:   %.1f%% of the fitted planes are valid\n", 100.0 * valid / max(long(rounds) * query_num, 1L));
+}
+
+/**
+ * @brief LIO 一次迭代中的测量雅克比构建与卡尔曼更新（与 laserMapping 非 IKFOM 分支相同的计算）
+ */
+static void bench_lio_update(int rounds)
+{
+  const int feat_num = 2000;
+  const double laser_point_cov = 0.001;
+  srand(6);
+  vector<V3D> points(feat_num), normals(feat_num);
+  vector<double> dists(feat_num);
+  for (int i = 0; i < feat_num; i++)
+  {
+    points[i]  = V3D::Random() * 30.0;
+    normals[i] = V3D::Random().normalized();
+    dists[i]   = V3D::Random()(0) * 0.05;
+  }
+  const M3D Lidar_rot_to_IMU(Eye3d);
+  const V3D Lidar_offset_to_IMU(0.04165, 0.02326, -0.0284);
+  StatesGroup state_init, state_propagat, state;
+  state_init.rot_end = Exp(V3D(0.1, -0.2, 0.3), 1.0);
+  state_init.pos_end = V3D(1.0, 2.0, 0.5);
+  state_propagat = state_init;
+  Matrix<double, DIM_STATE, DIM_STATE> G, H_T_H;
+  G.setZero();
+  H_T_H.setZero();
+  VD(DIM_STATE) solution;
+  MatrixXd Hsub(feat_num, 6);
+  VectorXd meas_vec(feat_num);
+  printf("[ BENCH ]: LIO update, %d effective features, %d rounds\n", feat_num, rounds);
+
+  double t_h = 0, t_update = 0;
+  for (int r = 0; r < rounds; r++)
+  {
+    state = state_init;
+    double t_beg = omp_get_wtime();
+    for (int i = 0; i < feat_num; i++)
+    {
+      V3D point_this = Lidar_rot_to_IMU * points[i] + Lidar_offset_to_IMU;
+      M3D point_crossmat;
+      point_crossmat << SKEW_SYM_MATRX(point_this);
+      V3D A(point_crossmat * state.rot_end.transpose() * normals[i]);
+      Hsub.row(i) << VEC_FROM_ARRAY(A), normals[i](0), normals[i](1), normals[i](2);
+      meas_vec(i) = - dists[i];
+    }
+    double t_mid = omp_get_wtime();
+    auto &&Hsub_T = Hsub.transpose();
+    auto &&HTz = Hsub_T * meas_vec;
+    H_T_H.block<6,6>(0,0) = Hsub_T * Hsub;
+    MD(DIM_STATE, DIM_STATE) &&K_1 = (H_T_H + (state.cov / laser_point_cov).inverse()).inverse();
+    G.block<DIM_STATE,6>(0,0) = K_1.block<DIM_STATE,6>(0,0) * H_T_H.block<6,6>(0,0);
+    auto vec = state_propagat - state;
+    solution = K_1.block<DIM_STATE,6>(0,0) * HTz + vec - G.block<DIM_STATE,6>(0,0) * vec.block<6,1>(0,0);
+    state += solution;
+    t_h      += t_mid - t_beg;
+    t_update += omp_get_wtime() - t_mid;
+  }
+  report("lio_jacobian", t_h, rounds, feat_num, "features");
+  report("lio_update", t_update, rounds, feat_num, "features");
+}
+
+/**
+ * @brief 一帧扫描的 ImuProcess::UndistortPcl：200Hz IMU 正向传播 + 逐点反向去畸变
+ *        每轮使用新的 ImuProcess，构造不计入
+ */
+static void bench_undistort(int rounds)
+{
+  const int pcl_num = 100000;
+  const double scan_time = 0.1;
+  srand(7);
+  LidarMeasureGroup meas_init;
+  meas_init.lidar_beg_time = 0.0;
+  meas_init.is_lidar_end   = true;
+  meas_init.lidar->resize(pcl_num);
+  for (int i = 0; i < pcl_num; i++)
+  {
+    PointType &pt = meas_init.lidar->points[i];
+    V3D p = V3D::Random() * 50.0;
+    pt.x = p(0);
+    pt.y = p(1);
+    pt.z = p(2);
+    pt.curvature = scan_time * 1000.0 * (i + 1) / pcl_num;
+  }
+  MeasureGroup imu_meas;
+  for (int k = 1; k <= BENCH_IMU_STEPS; k++)
+  {
+    sensor_msgs::Imu::Ptr imu(new sensor_msgs::Imu());
+    imu->header.stamp = ros::Time(scan_time * k / BENCH_IMU_STEPS);
+    imu->angular_velocity.x = 0.3;
+    imu->angular_velocity.y = -0.5;
+    imu->angular_velocity.z = 1.5;
+    imu->linear_acceleration.x = 0.05 * sin(k);
+    imu->linear_acceleration.y = -0.02;
+    imu->linear_acceleration.z = 1.0;
+    imu_meas.imu.push_back(imu);
+  }
+  meas_init.measures.push_back(imu_meas);
+  printf("[ BENCH ]: UndistortPcl, %d points, %d imu samples, %d rounds\n", pcl_num, BENCH_IMU_STEPS, rounds);
+
+  PointCloudXYZI pcl_out;
+  double t_undistort = 0;
+  for (int r = 0; r < rounds; r++)
+  {
+    ImuProcess imu_process;
+    LidarMeasureGroup meas = meas_init;
+    StatesGroup state;
+    state.vel_end = V3D(1.0, 0.5, 0.0);
+    double t_beg = omp_get_wtime();
+    imu_process.UndistortPcl(meas, state, pcl_out);
+    t_undistort += omp_get_wtime() - t_beg;
+  }
+  report("undistort_pcl", t_undistort, rounds, pcl_num, "points");
+}
+
+/**
+ * @brief VIO 的 patch 相关热点：getpatch、warpAffine、NCC、角点得分表以及一次 UpdateState（光度误差的迭代 EKF）
+ *        640x512 的合成纹理图像，相机与 IMU、雷达系重合
+ */
+static void bench_vio(int rounds)
+{
+  const int width = 640, height = 512, border = 20;
+  cv::Mat img(height, width, CV_8UC1);
+  for (int v = 0; v < height; v++)
+    for (int u = 0; u < width; u++)
+      img.at<uchar>(v, u) = cv::saturate_cast<uchar>(128.0 + 60.0 * sin(u * 0.15) * cos(v * 0.11) + 30.0 * sin((u + v) * 0.05));
+
+  StatesGroup state, state_propagat;
+  vk::PinholeCamera cam(width, height, 450.0, 450.0, width / 2.0, height / 2.0);
+  lidar_selection::LidarSelector selector(40, new SparseMap);
+  selector.cam = &cam;
+  selector.patch_size = 8;
+  selector.set_extrinsic(Zero3d, Eye3d);
+  selector.state = &state;
+  selector.state_propagat = &state_propagat;
+  selector.NUM_MAX_ITERATIONS = 3;
+  selector.img_point_cov = 100;
+  selector.fx = selector.fy = 450.0;
+  selector.cx = width / 2.0;
+  selector.cy = height / 2.0;
+  selector.init();
+  const int patch_total = selector.patch_size_total;
+
+  const int patch_num = 10000;
+  srand(8);
+  vector<V2D> centers(patch_num);
+  for (V2D &c : centers)
+    c = V2D(border + (width - 2 * border) * (rand() / double(RAND_MAX)), border + (height - 2 * border) * (rand() / double(RAND_MAX)));
+  vector<float> patches(size_t(patch_num) * patch_total * 3);
+  printf("[ BENCH ]: VIO patches, %d patches of %d px, %d rounds\n", patch_num, patch_total, rounds);
+
+  double t_beg = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < patch_num; i++)
+      selector.getpatch(img, centers[i], &patches[size_t(i) * patch_total * 3], 0);
+  report("vio_getpatch", omp_get_wtime() - t_beg, long(rounds) * patch_num, patch_total, "pixels");
+
+  Matrix2d A_cur_ref;
+  A_cur_ref << 1.05, 0.08, -0.06, 0.97;
+  vector<float> patch_warp(patch_total * 3);
+  t_beg = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < patch_num; i++)
+      selector.warpAffine(A_cur_ref, img, centers[i], 0, 0, 0, selector.patch_size_half, patch_warp.data());
+  report("vio_warp_affine", omp_get_wtime() - t_beg, long(rounds) * patch_num, patch_total, "pixels");
+
+  double ncc_sum = 0;
+  t_beg = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i + 1 < patch_num; i++)
+      ncc_sum += selector.NCC(&patches[size_t(i) * patch_total * 3], &patches[size_t(i + 1) * patch_total * 3], patch_total);
+  report("vio_ncc", omp_get_wtime() - t_beg, long(rounds) * (patch_num - 1), patch_total, "pixels");
+
+  t_beg = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+    selector.computeShiTomasiMap(img);
+  report("vio_shi_tomasi_map", omp_get_wtime() - t_beg, rounds, width * height, "pixels");
+
+  double score_sum = 0;
+  t_beg = omp_get_wtime();
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < patch_num; i++)
+      score_sum += selector.shiTomasiScore(centers[i](0), centers[i](1));
+  report("vio_shi_tomasi_score", omp_get_wtime() - t_beg, long(rounds) * patch_num, 1, "points");
+
+  // 地图点的参考 patch 取自偏移约 1 像素的位置，使 UpdateState 有非零的光度残差
+  const int map_num = 300;
+  selector.sub_sparse_map->reset();
+  for (int i = 0; i < map_num; i++)
+  {
+    const V2D &px = centers[i];
+    const double depth = 2.0 + 6.0 * (rand() / double(RAND_MAX));
+    V3D pos = cam.cam2world(px(0), px(1)) * depth;
+    vector<float> patch(patch_total * 3);
+    selector.getpatch(img, V2D(px(0) + 0.7, px(1) - 0.4), patch.data(), 0);
+    selector.sub_sparse_map->voxel_points.push_back(lidar_selection::PointPtr(new lidar_selection::Point(pos)));
+    selector.sub_sparse_map->patch.push_back(patch);
+    selector.sub_sparse_map->search_levels.push_back(0);
+    selector.sub_sparse_map->index.push_back(i);
+    selector.sub_sparse_map->errors.push_back(0.0f);
+    selector.sub_sparse_map->propa_errors.push_back(0.0f);
+  }
+  const StatesGroup state_init = state;
+  const int update_rounds = max(rounds * 10, 1);
+  double t_update = 0;
+  for (int r = 0; r < update_rounds; r++)
+  {
+    state = state_init;
+    state_propagat = state_init;
+    t_beg = omp_get_wtime();
+    selector.UpdateState(img, 1e10f, 0);
+    t_update += omp_get_wtime() - t_beg;
+  }
+  report("vio_update_state", t_update, update_rounds, map_num, "patches");
+
+  // 新建并释放地图点，每点带 4 个观测，对象取自 Point/Feature 的对象池
+  selector.sub_sparse_map->reset();
+  const int alloc_rounds = max(rounds * 10, 1);
+  vector<lidar_selection::PointPtr> alloc_points(map_num);
+  t_beg = omp_get_wtime();
+  for (int r = 0; r < alloc_rounds; r++)
+  {
+    for (int i = 0; i < map_num; i++)
+    {
+      alloc_points[i].reset(new lidar_selection::Point(V3D(i, r, 1.0)));
+      for (int k = 0; k < 4; k++)
+        alloc_points[i]->addFrameRef(lidar_selection::FeaturePtr(new lidar_selection::Feature(centers[i], V3D(0, 0, 1), SE3(), 0.0f, 0)));
+    }
+    for (int i = 0; i < map_num; i++) alloc_points[i].reset();
+  }
+  report("vio_point_alloc", omp_get_wtime() - t_beg, long(alloc_rounds) * map_num, 1, "points");
+  const PoolStats point_pool = ObjectPool<lidar_selection::Point>::stats();
+  const PoolStats feature_pool = ObjectPool<lidar_selection::Feature>::stats();
+  printf("[ BENCH ]:   point pool %lu B x %lu slots, feature pool %lu B x %lu slots\n",
+         (unsigned long)point_pool.object_size, (unsigned long)point_pool.capacity,
+         (unsigned long)feature_pool.object_size, (unsigned long)feature_pool.capacity);
+  printf("[ BENCH ]:   mean ncc %.4f\n", ncc_sum / max(long(rounds) * (patch_num - 1), 1L));
+  printf("[ BENCH ]:   mean shi-tomasi score %.4f\n", score_sum / max(long(rounds) * patch_num, 1L));
+}
+
+int main(int argc, char** argv)
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 10000;
+  const int heavy_rounds = max(rounds / 1000, 1);
+  bench_cov_propagation(rounds);
+  bench_deskew(heavy_rounds);
+  bench_ikdtree(heavy_rounds);
+  bench_lio_update(max(rounds / 10, 1));
+  bench_undistort(max(rounds / 100, 1));
+  bench_vio(heavy_rounds);
+  print_results_csv();
+  if (argc > 2) write_results_json(argv[2]);
+  return 0;
+}
@@ -37,6 +37,15 @@ Frame::Frame(vk::AbstractCamera* cam, const cv::Mat& img) :
   initFrame(img);
 }
 
+Frame::Frame(vk::AbstractCamera* cam, const ImgPyr& img_pyr) :
+    id_(frame_counter_++), 
+    cam_(cam), 
+    key_pts_(5), 
+    is_keyframe_(false)
+{
+  initFrame(img_pyr);
+}
+
 Frame::~Frame()
 {
   std::for_each(fts_.begin(), fts_.end(), [&](FeaturePtr i){i.reset();});
@@ -62,6 +71,17 @@ void Frame::initFrame(const cv::Mat& img)
   // frame_utils::createImgPyramid(img, 5, img_pyr_); 
 }
 
+// 使用图像预处理线程中已经建好的金字塔初始化，不再拷贝图像
+void Frame::initFrame(const ImgPyr& img_pyr)
+{
+  if(img_pyr.empty() || img_pyr[0].type() != CV_8UC1 || img_pyr[0].cols != cam_->width() || img_pyr[0].rows != cam_->height())
+    throw std::runtime_error("Frame: provided image has not the same size as the camera model or image is not grayscale");
+
+  std::for_each(key_pts_.begin(), key_pts_.end(), [&](FeaturePtr ftr){ ftr=nullptr; });
+
+  img_pyr_ = img_pyr;
+}
+
 void Frame::setKeyframe()
 {
   is_keyframe_ = true;
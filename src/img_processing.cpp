@@ -0,0 +1,222 @@
+#include "img_processing.h"
+#include <frame.h>
+#include <vikit/pinhole_camera.h>
+#include <omp.h>
+
+ImgProcess::ImgProcess()
+    : width(0), height(0), pyr_levels(1), running(false)
+{
+  rgb_en    = true;
+  canvas_en = true;
+}
+
+ImgProcess::~ImgProcess()
+{
+  stop();
+}
+
+void ImgProcess::set(int width_, int height_, int pyr_levels_)
+{
+  width      = width_;
+  height     = height_;
+  pyr_levels = max(pyr_levels_, 1);
+}
+
+void ImgProcess::start(FrameCallback cb)
+{
+  frame_cbk = cb;
+  running   = true;
+  thread_   = std::thread(&ImgProcess::worker, this);
+}
+
+void ImgProcess::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    running = false;
+  }
+  cond_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+void ImgProcess::push(const sensor_msgs::ImageConstPtr &msg, double time, int epoch)
+{
+  std::unique_lock<std::mutex> lock(mtx_);
+  if (!running)
+  {
+    // 未启动处理线程时（例如离线回放），直接在调用线程中处理
+    lock.unlock();
+    ImgFramePtr frame = process(msg, time);
+    frame->epoch = epoch;
+    if (frame_cbk) frame_cbk(frame);
+    return;
+  }
+  msg_buffer.push_back({msg, time, epoch});
+  lock.unlock();
+  cond_.notify_one();
+}
+
+/**
+ * @brief 图像一次性预处理：解码、缩放、灰度化、构建金字塔
+ *        彩色图和绘制副本只在需要时生成。金字塔第0层会被地图特征作为参考图像长期持有，
+ *        没有缩放时 toCvShare 得到的图像指向消息内存，不归 cv::Mat 的引用计数管理，因此复制一份
+ */
+ImgFramePtr ImgProcess::process(const sensor_msgs::ImageConstPtr &msg, double time)
+{
+  ImgFramePtr frame(new ImgFrame());
+  frame->time = time;
+
+  const bool need_bgr = rgb_en || canvas_en;
+  cv_bridge::CvImageConstPtr cv_ptr = cv_bridge::toCvShare(msg, need_bgr ? "bgr8" : "mono8");
+  cv::Mat img = cv_ptr->image;
+  bool shared = true;   // img 是否仍指向消息内存
+  if (img.cols != width || img.rows != height)
+  {
+    // 和相机模型分辨率不一致时缩放一半
+    double scale = 0.5;
+    cv::Mat img_resized;
+    cv::resize(img, img_resized, cv::Size(img.cols*scale, img.rows*scale), 0, 0, CV_INTER_LINEAR);
+    img = img_resized;
+    shared = false;
+  }
+
+  if (need_bgr)
+  {
+    cv::cvtColor(img, frame->gray, CV_BGR2GRAY);
+    if (rgb_en)    frame->rgb = shared ? img.clone() : img;
+    if (canvas_en) frame->canvas = img.clone();
+  }
+  else
+  {
+    frame->gray = shared ? img.clone() : img;
+  }
+
+  lidar_selection::frame_utils::createImgPyramid(frame->gray, pyr_levels, frame->pyr);
+  return frame;
+}
+
+void ImgProcess::worker()
+{
+  while (true)
+  {
+    Item item;
+    {
+      std::unique_lock<std::mutex> lock(mtx_);
+      cond_.wait(lock, [this]{ return !running || !msg_buffer.empty(); });
+      if (msg_buffer.empty()) return;
+      item = msg_buffer.front();
+      msg_buffer.pop_front();
+    }
+    ImgFramePtr frame = process(item.msg, item.time);
+    frame->epoch = item.epoch;
+    if (frame_cbk) frame_cbk(frame);
+  }
+}
+
+void BuildColorizeModel(ColorizeModel &model, const M3D &Rcw, const V3D &Pcw, double fx, double fy, double cx, double cy,
+                        const double *d, int width, int height, const vk::AbstractCamera *cam)
+{
+  for (int r = 0; r < 3; r++)
+  {
+    for (int c = 0; c < 3; c++) model.R[r * 3 + c] = Rcw(r, c);
+    model.t[r] = Pcw(r);
+  }
+  model.fx = fx;
+  model.fy = fy;
+  model.cx = cx;
+  model.cy = cy;
+  for (int i = 0; i < 4; i++) model.d[i] = d[i];
+  model.width  = width;
+  model.height = height;
+  model.cam    = dynamic_cast<const vk::PinholeCamera *>(cam) ? nullptr : cam;
+}
+
+/**
+ * @brief 批量给世界系点着色：每块 COLORIZE_BLOCK 个点先无分支地投影（SIMD），再对落在图像内的点双线性采样 BGR；
+ *        块之间并行，结果按输入顺序紧凑地写入 out（复用 out 已分配的内存），返回着色的点数
+ *        只保留相机前方、双线性采样的四个像素都在图像内的点；非 Pinhole 相机逐点用 world2cam 投影
+ */
+int ColorizePoints(const ColorizeModel &model, const cv::Mat &img_bgr, const PointType *pts, int n, PointCloudXYZRGB &out)
+{
+  out.points.resize(n);
+  vector<uint8_t> valid(n);
+  const float *R = model.R, *t = model.t, *d = model.d;
+  const float fx = model.fx, fy = model.fy, cx = model.cx, cy = model.cy;
+  const float u_max = model.width - 1, v_max = model.height - 1;
+  const size_t step = img_bgr.step;
+  const int blocks = (n + COLORIZE_BLOCK - 1) / COLORIZE_BLOCK;
+  #ifdef MP_EN
+      omp_set_num_threads(MP_PROC_NUM);
+      #pragma omp parallel for schedule(static)
+  #endif
+  for (int b = 0; b < blocks; b++)
+  {
+    const int beg = b * COLORIZE_BLOCK;
+    const int m = min(COLORIZE_BLOCK, n - beg);
+    const PointType *blk = pts + beg;
+    float pu[COLORIZE_BLOCK], pv[COLORIZE_BLOCK];
+    uint8_t ok[COLORIZE_BLOCK];
+
+    if (model.cam)
+    {
+      for (int i = 0; i < m; i++)
+      {
+        const float x = blk[i].x, y = blk[i].y, z = blk[i].z;
+        const float xc = R[0] * x + R[1] * y + R[2] * z + t[0];
+        const float yc = R[3] * x + R[4] * y + R[5] * z + t[1];
+        const float zc = R[6] * x + R[7] * y + R[8] * z + t[2];
+        const V2D px = model.cam->world2cam(V3D(xc, yc, zc));
+        pu[i] = px[0];
+        pv[i] = px[1];
+        ok[i] = (zc > 0.0f) & (pu[i] >= 0.0f) & (pv[i] >= 0.0f) & (pu[i] < u_max) & (pv[i] < v_max);
+      }
+    }
+    else
+    {
+      #pragma omp simd
+      for (int i = 0; i < m; i++)
+      {
+        const float x = blk[i].x, y = blk[i].y, z = blk[i].z;
+        const float xc = R[0] * x + R[1] * y + R[2] * z + t[0];
+        const float yc = R[3] * x + R[4] * y + R[5] * z + t[1];
+        const float zc = R[6] * x + R[7] * y + R[8] * z + t[2];
+        const float iz = 1.0f / zc;
+        const float xn = xc * iz, yn = yc * iz;
+        const float r2 = xn * xn + yn * yn;
+        const float cdist = 1.0f + d[0] * r2 + d[1] * r2 * r2;
+        const float xd = xn * cdist + 2.0f * d[2] * xn * yn + d[3] * (r2 + 2.0f * xn * xn);
+        const float yd = yn * cdist + d[2] * (r2 + 2.0f * yn * yn) + 2.0f * d[3] * xn * yn;
+        pu[i] = fx * xd + cx;
+        pv[i] = fy * yd + cy;
+        ok[i] = (zc > 0.0f) & (pu[i] >= 0.0f) & (pv[i] >= 0.0f) & (pu[i] < u_max) & (pv[i] < v_max);
+      }
+    }
+
+    for (int i = 0; i < m; i++)
+    {
+      valid[beg + i] = ok[i];
+      if (!ok[i]) continue;
+      const int ui = int(pu[i]), vi = int(pv[i]);
+      const float su = pu[i] - ui, sv = pv[i] - vi;
+      const float w_tl = (1.0f - su) * (1.0f - sv), w_tr = su * (1.0f - sv);
+      const float w_bl = (1.0f - su) * sv,          w_br = su * sv;
+      const uint8_t *p0 = img_bgr.data + vi * step + ui * 3;
+      const uint8_t *p1 = p0 + step;
+      PointTypeRGB &q = out.points[beg + i];
+      q.x = blk[i].x;
+      q.y = blk[i].y;
+      q.z = blk[i].z;
+      q.b = uint8_t(w_tl * p0[0] + w_tr * p0[3] + w_bl * p1[0] + w_br * p1[3]);
+      q.g = uint8_t(w_tl * p0[1] + w_tr * p0[4] + w_bl * p1[1] + w_br * p1[4]);
+      q.r = uint8_t(w_tl * p0[2] + w_tr * p0[5] + w_bl * p1[2] + w_br * p1[5]);
+    }
+  }
+
+  int num = 0;
+  for (int i = 0; i < n; i++)
+    if (valid[i]) out.points[num++] = out.points[i];
+  out.points.resize(num);
+  out.width  = num;
+  out.height = 1;
+  return num;
+}
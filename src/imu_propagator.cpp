@@ -0,0 +1,148 @@
+#include "imu_propagator.h"
+
+ImuPropagator::ImuPropagator()
+    : state_time(-1.0)
+{
+  rot_imu    = Eye3d;
+  pos_imu    = Zero3d;
+  vel_imu    = Zero3d;
+  angvel_imu = Zero3d;
+}
+
+ImuPropagator::~ImuPropagator()
+{
+  stop();
+}
+
+void ImuPropagator::start(const ros::NodeHandle &nh, const string &imu_topic, const string &odom_topic)
+{
+  nh_.reset(new ros::NodeHandle(nh));
+  nh_->setCallbackQueue(&queue_);
+  sub_imu  = nh_->subscribe(imu_topic, 200000, &ImuPropagator::imu_cbk, this, ros::TransportHints().tcpNoDelay());
+  pub_odom = nh_->advertise<nav_msgs::Odometry>(odom_topic, 100);
+  spinner_.reset(new ros::AsyncSpinner(1, &queue_));
+  spinner_->start();
+}
+
+void ImuPropagator::stop()
+{
+  if (spinner_) spinner_->stop();
+  sub_imu.shutdown();
+}
+
+/**
+ * @brief EKF更新后由估计线程调用，整体替换锚点，不阻塞估计线程
+ */
+void ImuPropagator::set_anchor(const StatesGroup &state, double time, double acc_scale)
+{
+  std::shared_ptr<Anchor> anchor(new Anchor());
+  anchor->time      = time;
+  anchor->acc_scale = acc_scale;
+  anchor->rot       = state.rot_end;
+  anchor->pos       = state.pos_end;
+  anchor->vel       = state.vel_end;
+  anchor->bias_g    = state.bias_g;
+  anchor->bias_a    = state.bias_a;
+  anchor->gravity   = state.gravity;
+  std::atomic_store(&anchor_, AnchorConstPtr(anchor));
+}
+
+void ImuPropagator::imu_cbk(const sensor_msgs::Imu::ConstPtr &msg)
+{
+  imu_buffer.push_back(msg);
+  AnchorConstPtr anchor = std::atomic_load(&anchor_);
+  if (!anchor)
+  {
+    if (imu_buffer.size() > MAX_PROP_IMU_BUFFER) imu_buffer.pop_front();
+    return;
+  }
+
+  if (anchor != anchor_used)
+  {
+    // 锚点更新：丢弃锚点之前的IMU，从锚点重新积分缓存的IMU
+    reset_to(anchor);
+    while (imu_buffer.size() > 1 && imu_buffer[1]->header.stamp.toSec() <= anchor->time) imu_buffer.pop_front();
+    for (size_t i = 0; i + 1 < imu_buffer.size(); i++)
+    {
+      integrate(*imu_buffer[i], *imu_buffer[i + 1]);
+    }
+  }
+  else if (imu_buffer.size() > 1)
+  {
+    integrate(*imu_buffer[imu_buffer.size() - 2], *imu_buffer.back());
+  }
+  if (imu_buffer.size() > MAX_PROP_IMU_BUFFER) imu_buffer.pop_front();
+
+  if (state_time >= msg->header.stamp.toSec()) publish(*msg);
+}
+
+void ImuPropagator::reset_to(const AnchorConstPtr &anchor)
+{
+  anchor_used = anchor;
+  rot_imu     = anchor->rot;
+  pos_imu     = anchor->pos;
+  vel_imu     = anchor->vel;
+  state_time  = anchor->time;
+}
+
+/**
+ * @brief 和 ImuProcess::Forward 相同的中值积分，head 早于当前状态时只积分 state_time 之后的部分
+ */
+void ImuPropagator::integrate(const sensor_msgs::Imu &head, const sensor_msgs::Imu &tail)
+{
+  const double tail_time = tail.header.stamp.toSec();
+  if (tail_time <= state_time) return;
+  const double dt = tail_time - max(head.header.stamp.toSec(), state_time);
+
+  V3D angvel_avr, acc_avr, acc_imu;
+  angvel_avr<<0.5 * (head.angular_velocity.x + tail.angular_velocity.x),
+              0.5 * (head.angular_velocity.y + tail.angular_velocity.y),
+              0.5 * (head.angular_velocity.z + tail.angular_velocity.z);
+  acc_avr   <<0.5 * (head.linear_acceleration.x + tail.linear_acceleration.x),
+              0.5 * (head.linear_acceleration.y + tail.linear_acceleration.y),
+              0.5 * (head.linear_acceleration.z + tail.linear_acceleration.z);
+
+  angvel_avr -= anchor_used->bias_g;
+  acc_avr     = acc_avr * anchor_used->acc_scale - anchor_used->bias_a;
+
+  /* propogation of IMU attitude */
+  rot_imu = rot_imu * Exp(angvel_avr, dt);
+
+  /* Specific acceleration (global frame) of IMU */
+  acc_imu = rot_imu * acc_avr + anchor_used->gravity;
+
+  /* propogation of IMU */
+  pos_imu = pos_imu + vel_imu * dt + 0.5 * acc_imu * dt * dt;
+
+  /* velocity of IMU */
+  vel_imu = vel_imu + acc_imu * dt;
+
+  angvel_imu = angvel_avr;
+  state_time = tail_time;
+}
+
+/**
+ * @brief 发布IMU系在世界系下的位姿，线速度为世界系，角速度为IMU系（已减去零偏）
+ */
+void ImuPropagator::publish(const sensor_msgs::Imu &msg)
+{
+  nav_msgs::Odometry odom;
+  odom.header.frame_id = "camera_init";
+  odom.header.stamp    = msg.header.stamp;
+  odom.child_frame_id  = "aft_mapped";
+  Eigen::Quaterniond q(rot_imu);
+  odom.pose.pose.position.x    = pos_imu(0);
+  odom.pose.pose.position.y    = pos_imu(1);
+  odom.pose.pose.position.z    = pos_imu(2);
+  odom.pose.pose.orientation.x = q.x();
+  odom.pose.pose.orientation.y = q.y();
+  odom.pose.pose.orientation.z = q.z();
+  odom.pose.pose.orientation.w = q.w();
+  odom.twist.twist.linear.x    = vel_imu(0);
+  odom.twist.twist.linear.y    = vel_imu(1);
+  odom.twist.twist.linear.z    = vel_imu(2);
+  odom.twist.twist.angular.x   = angvel_imu(0);
+  odom.twist.twist.angular.y   = angvel_imu(1);
+  odom.twist.twist.angular.z   = angvel_imu(2);
+  pub_odom.publish(odom);
+}
@@ -34,6 +34,10 @@
 // POSSIBILITY OF SUCH DAMAGE.
 #include <omp.h>
 #include <mutex>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
 #include <math.h>
 #include <thread>
 #include <fstream>
@@ -61,10 +65,28 @@
 #include <geometry_msgs/Vector3.h>
 #include <livox_ros_driver/CustomMsg.h>
 #include "preprocess.h"
+#include "img_processing.h"
+#include "imu_propagator.h"
+#include "trace.h"
+#include "metrics.h"
+#include "tile_writer.h"
+#include "rgb_map.h"
+#include "map_delta.h"
+#include "map_snapshot.h"
+#include "static_kdtree.h"
+#include <fast_livo/MapDelta.h>
+#include <fast_livo/VioStats.h>
+#include <std_msgs/Empty.h>
 #include <cv_bridge/cv_bridge.h>
 #include <opencv2/opencv.hpp>
 #include <vikit/camera_loader.h>
 #include"lidar_selection.h"
+#ifdef OFFLINE_REPLAY
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include <sensor_msgs/CompressedImage.h>
+#include <vikit/pinhole_camera.h>
+#endif
 
 #ifdef USE_ikdtree
     #ifdef USE_ikdforest
@@ -77,7 +99,6 @@
 #endif
 
 #define INIT_TIME           (0.5)
-#define MAXN                (360000)
 #define PUBFRAME_PERIOD     (20)
 
 float DET_RANGE = 300.0f;
@@ -92,6 +113,35 @@ float DET_RANGE = 300.0f;
 
 mutex mtx_buffer;
 condition_variable sig_buffer;
+bool buffer_updated = false;    // 回调写入了新数据，主线程等待 sig_buffer 时的条件
+
+// 发布线程：点云的着色、消息转换和发布在后台完成，与下一帧的估计重叠
+#define PUB_MAX_DISPLAY  (8)    // 队列中最多保留的仅用于显示的任务数，超过时丢弃最旧的
+#define PUB_MAX_SAVE     (4)    // 队列中最多保留的不可丢弃任务数，达到时估计线程等待
+struct PublishTask
+{
+    function<void()> run;
+    bool display;               // 只发布消息，可以丢弃；否则还负责存图等，必须执行
+};
+mutex mtx_pub;
+condition_variable sig_pub, sig_pub_pop;
+deque<PublishTask> pub_tasks;
+int pub_display_queued = 0;     // pub_tasks 中 display 任务的个数
+int pub_save_queued = 0;        // pub_tasks 中不可丢弃任务的个数
+size_t pub_dropped = 0;         // 累计丢弃的 display 任务数
+bool pub_running = false;
+thread pub_thread;
+
+// 地图插入线程：Add_Points 在后台执行，下一次访问ikdtree前等待插入完成
+mutex mtx_map;
+condition_variable sig_map;
+PointVector map_add_points;         // 待插入的world系点
+bool map_add_pending = false;       // 有未完成的插入
+bool map_running = false;
+thread map_thread;
+double map_add_time = 0.0;          // 最近一次插入的耗时（后台线程）
+double map_enqueue_time = 0.0;      // 最近一次提交插入的时刻
+double map_done_time = 0.0;         // 最近一次插入完成的时刻
 
 // mutex mtx_buffer_pointcloud;
 
@@ -104,7 +154,8 @@ V3F Zero3f(0, 0, 0);
 Vector3d Lidar_offset_to_IMU(Zero3d);
 M3D Lidar_rot_to_IMU(Eye3d);
 int iterCount = 0, feats_down_size = 0, NUM_MAX_ITERATIONS = 0, laserCloudValidNum = 0,\
-    effct_feat_num = 0, time_log_counter = 0, publish_count = 0;
+    effct_feat_num = 0;
+atomic<int> publish_count(0);   // IMU回调和发布线程都会修改
 int MIN_IMG_COUNT = 0;
 
 double res_mean_last = 0.05;
@@ -122,13 +173,16 @@ double kdtree_incremental_time = 0, kdtree_search_time = 0, kdtree_delete_time =
 int kdtree_search_counter = 0, kdtree_size_st = 0, kdtree_size_end = 0, add_point_size = 0, kdtree_delete_counter = 0;;
 //double copy_time, readd_time, fov_check_time, readd_box_time, delete_box_time;
 double copy_time = 0, readd_time = 0, fov_check_time = 0, readd_box_time = 0, delete_box_time = 0;
-double T1[MAXN], T2[MAXN], s_plot[MAXN], s_plot2[MAXN], s_plot3[MAXN], s_plot4[MAXN], s_plot5[MAXN], s_plot6[MAXN], s_plot7[MAXN];
+// 每帧的调试指标，固定容量的环形缓冲区，/metrics_dump 或退出时写入 Log/metrics.txt
+FrameMetrics frame_metrics({"lidar_beg_time", "aver_time_consu", "kdtree_incremental_time", "kdtree_search_time", "map_size", "total_time"});
 
 double match_time = 0, solve_time = 0, solve_const_H_time = 0;
 
 bool lidar_pushed, flg_reset, flg_exit = false;
 bool ncc_en;
 int dense_map_en = 1;
+int lio_slice_num = 1;
+int img_pyr_levels = 1;
 int img_en = 1;
 int lidar_en = 1;
 int debug = 0;
@@ -143,8 +197,10 @@ vector<BoxPointType> cub_needad;
 deque<PointCloudXYZI::Ptr>  lidar_buffer;
 deque<double>          time_buffer;
 deque<sensor_msgs::Imu::ConstPtr> imu_buffer;
-deque<cv::Mat> img_buffer;
+deque<ImgFramePtr> img_buffer;
 deque<double>          img_time_buffer;
+deque<double>          img_pending_time;  // 已交给图像预处理线程、还未进入 img_buffer 的图像时间戳
+int                    img_epoch = 0;     // 图像时间戳回退的次数，之前交给预处理线程的帧完成后丢弃
 vector<bool> point_selected_surf; 
 vector<vector<int>> pointSearchInd_surf; 
 vector<PointVector> Nearest_Points; 
@@ -154,7 +210,7 @@ vector<double> extrinR(9, 0.0);
 vector<double> cameraextrinT(3, 0.0);
 vector<double> cameraextrinR(9, 0.0);
 double total_residual;
-double LASER_POINT_COV, IMG_POINT_COV, cam_fx, cam_fy, cam_cx, cam_cy; 
+double LASER_POINT_COV, IMG_POINT_COV, cam_fx, cam_fy, cam_cx, cam_cy, cam_d0, cam_d1, cam_d2, cam_d3;
 bool flg_EKF_inited, flg_EKF_converged, EKF_stop_flg = 0;
 //surf feature in map
 PointCloudXYZI::Ptr featsFromMap(new PointCloudXYZI());
@@ -206,14 +262,58 @@ geometry_msgs::Quaternion geoQuat;
 geometry_msgs::PoseStamped msg_body_pose;
 
 shared_ptr<Preprocess> p_pre(new Preprocess());
-
-PointCloudXYZRGB::Ptr pcl_wait_save(new PointCloudXYZRGB());  //add save rbg map
-PointCloudXYZI::Ptr pcl_wait_save_lidar(new PointCloudXYZI());  //add save xyzi map
+shared_ptr<ImgProcess> p_img(new ImgProcess());
+shared_ptr<ImuPropagator> p_prop(new ImuPropagator());
+
+// 地图按块流式写入 PCD/ 下的 rgb_tiles 或 intensity_tiles，只由发布任务写入
+TileWriter tile_writer;
+vector<TilePoint> pcd_stage;    // 凑满 pcd_save_interval 帧后交给写盘线程
+int pcd_stage_scans = 0;
+double pcd_tile_size = 50.0;
+// rgb_voxel_size > 0 时彩色点先按体素融合，保存融合后的地图，并每 pcd_save_interval 帧在 /rgb_map 发布有变化的体素
+RGBVoxelMap rgb_map;
+double rgb_voxel_size = 0.0;
+int rgb_map_scans = 0;
+ros::Publisher pubRGBMap;
+// 增量地图：ikdtree 的插入和删除同步到分块的多层 LOD 地图，每 map_pub_interval 帧在 /map_delta 发布有变化的块，
+// 每 map_pub_keyframe_interval 次或有新订阅者时发布整层
+MapDeltaTracker map_delta;
+vector<double> map_pub_resolutions;
+double map_pub_block_size = 10.0;
+int map_pub_interval = 10, map_pub_keyframe_interval = 30;
+int map_pub_scans = 0, map_pub_count = 0, map_pub_subscribers = 0;
+vector<uint32_t> map_pub_seq;
+ros::Publisher pubMapDelta;
+ros::Publisher pubVioStats;
+// VIO 自适应迭代：先验误差小时跳过粗层，代价相对下降小时结束本层，每帧用时不超过 vio_time_budget
+bool vio_adaptive_en = false;
+double vio_skip_error = 50.0, vio_min_decrease = 0.01, vio_time_budget = 0.0;
+// 地图快照：ikdtree 的点和视觉地图（点、法向、观测位姿和参考图像）由后台线程写入 snapshot_path，
+// 启动时 mmap 加载并直接建树，在已建图的场地重启时不必重新探索。
+// 激光点取自与 ikdtree 同步增删的体素副本 snapshot_map，由写盘线程取出；视觉地图在估计线程中每帧收集一部分
+MapSnapshotWriter snapshot_writer;
+MapSnapshot map_snapshot;       // 恢复的视觉地图的参考图像指向其映射的内存，保留到退出
+MapDeltaTracker snapshot_map;
+SnapshotData snapshot_pending;
+SnapshotVioCursor snapshot_cursor;
+bool snapshot_collecting = false;
+string snapshot_path;
+bool snapshot_save_en = false, snapshot_load_en = false;
+double snapshot_interval = 0.0, snapshot_last_time = 0.0;
+// 定位模式：从 snapshot_path 加载建好的地图，激光用只读的静态kd树匹配，视觉地图只读；
+// 不插入地图、不删除地图范围外的点、不写快照
+bool localization_en = false;
+StaticKdTree static_map;
 
 bool pcd_save_en = true;
 bool pose_output_en = true;
+bool publish_en = true;     // 是否发布ROS话题，离线回放时关闭
+bool imu_odom_en = false;   // 是否按IMU频率发布里程计
+bool map_async_en = true;   // 是否在后台线程插入地图点
+bool trace_en = false;      // 是否记录各阶段耗时，见 trace.h
+bool map_pub_en = false;    // 是否发布增量地图
 
-int pcd_save_interval = 20, pcd_index = 0;
+int pcd_save_interval = 20;
 
 
 void SigHandle(int sig)
@@ -419,6 +519,8 @@ void lasermap_fov_segment()
     points_cache_collect();
     double delete_begin = omp_get_wtime();
     if(cub_needrm.size() > 0) kdtree_delete_counter = ikdtree.Delete_Point_Boxes(cub_needrm);
+    if(map_pub_en) map_delta.remove_boxes(cub_needrm);
+    if(snapshot_save_en) snapshot_map.remove_boxes(cub_needrm);
     kdtree_delete_time = omp_get_wtime() - delete_begin;
     // printf("Delete time: %0.6f, delete size: %d\n",kdtree_delete_time,kdtree_delete_counter);
     // printf("Delete Box: %d\n",int(cub_needrm.size()));
@@ -427,6 +529,13 @@ void lasermap_fov_segment()
 
 void standard_pcl_cbk(const sensor_msgs::PointCloud2::ConstPtr &msg) 
 {
+    // 预处理和按时间排序在回调线程中完成，不持有缓冲区锁，可以与上一帧的估计重叠
+    PointCloudXYZI::Ptr  ptr(new PointCloudXYZI());
+    p_pre->process(msg, ptr);
+    sort(ptr->points.begin(), ptr->points.end(), time_list); // sort by sample timestamp
+    // ROS_INFO("get point cloud at time: %.6f and size: %d", msg->header.stamp.toSec() - 0.1, ptr->points.size());
+    printf("[ INFO ]: get point cloud at time: %.6f and size: %d.\n", msg->header.stamp.toSec(), int(ptr->points.size()));
+
     mtx_buffer.lock();
     // cout<<"got feature"<<endl;
     if (msg->header.stamp.toSec() < last_timestamp_lidar)
@@ -434,16 +543,12 @@ void standard_pcl_cbk(const sensor_msgs::PointCloud2::ConstPtr &msg)
         ROS_ERROR("lidar loop back, clear buffer");
         lidar_buffer.clear();
     }
-    
-    PointCloudXYZI::Ptr  ptr(new PointCloudXYZI());
-    p_pre->process(msg, ptr);
-    // ROS_INFO("get point cloud at time: %.6f and size: %d", msg->header.stamp.toSec() - 0.1, ptr->points.size());
-    printf("[ INFO ]: get point cloud at time: %.6f and size: %d.\n", msg->header.stamp.toSec(), int(ptr->points.size()));
     lidar_buffer.push_back(ptr);
     // time_buffer.push_back(msg->header.stamp.toSec() - 0.1);
     // last_timestamp_lidar = msg->header.stamp.toSec() - 0.1;
     time_buffer.push_back(msg->header.stamp.toSec());
     last_timestamp_lidar = msg->header.stamp.toSec();
+    buffer_updated = true;
     mtx_buffer.unlock();
     sig_buffer.notify_all();
 }
@@ -451,21 +556,24 @@ void standard_pcl_cbk(const sensor_msgs::PointCloud2::ConstPtr &msg)
 // livox lidar回调函数
 void livox_pcl_cbk(const livox_ros_driver::CustomMsg::ConstPtr &msg) 
 {
+    printf("[ INFO ]: get point cloud at time: %.6f.\n", msg->header.stamp.toSec());
+    PointCloudXYZI::Ptr ptr(new PointCloudXYZI());
+    // 对lidar点云进行预处理，转换成pcl点云格式，并按时间排序；不持有缓冲区锁
+    p_pre->process(msg, ptr);
+    sort(ptr->points.begin(), ptr->points.end(), time_list); // sort by sample timestamp
+
     mtx_buffer.lock();
     if (msg->header.stamp.toSec() < last_timestamp_lidar)
     {
         ROS_ERROR("lidar loop back, clear buffer");
         lidar_buffer.clear();
     }
-    printf("[ INFO ]: get point cloud at time: %.6f.\n", msg->header.stamp.toSec());
-    PointCloudXYZI::Ptr ptr(new PointCloudXYZI());
-    // 对lidar点云进行预处理，转换成pcl点云格式
-    p_pre->process(msg, ptr);
     // 将点云和时间戳存入缓冲区
     lidar_buffer.push_back(ptr);
     time_buffer.push_back(msg->header.stamp.toSec());
     last_timestamp_lidar = msg->header.stamp.toSec();
 
+    buffer_updated = true;
     mtx_buffer.unlock();
     sig_buffer.notify_all();
 }
@@ -492,14 +600,30 @@ void imu_cbk(const sensor_msgs::Imu::ConstPtr &msg_in)
     // 将IMU数据存入缓冲区
     imu_buffer.push_back(msg);
     // cout<<"got imu: "<<timestamp<<" imu size "<<imu_buffer.size()<<endl;
+    buffer_updated = true;
     mtx_buffer.unlock();
     sig_buffer.notify_all();
 }
 
-cv::Mat getImageFromMsg(const sensor_msgs::ImageConstPtr& img_msg) {
-  cv::Mat img;
-  img = cv_bridge::toCvCopy(img_msg, "bgr8")->image;
-  return img;
+// 图像预处理完成的回调，在图像预处理线程中调用
+void img_frame_cbk(ImgFramePtr frame)
+{
+    mtx_buffer.lock();
+    // 时间戳回退前提交的帧，缓冲区已清空，不再使用
+    if (frame->epoch != img_epoch)
+    {
+        mtx_buffer.unlock();
+        return;
+    }
+
+    // 将预处理好的图像和时间戳存入缓冲区
+    img_buffer.push_back(frame);
+    img_time_buffer.push_back(frame->time);
+    if (!img_pending_time.empty()) img_pending_time.pop_front();
+
+    buffer_updated = true;
+    mtx_buffer.unlock();
+    sig_buffer.notify_all();
 }
 
 // 图像回调函数
@@ -512,26 +636,49 @@ void img_cbk(const sensor_msgs::ImageConstPtr& msg)
     // 校正图像时间戳，与激光雷达时间戳同源
     double msg_header_time = msg->header.stamp.toSec() + delta_time;
     printf("[ INFO ]: get img at time: %.6f.\n", msg_header_time);
+    mtx_buffer.lock();
     if (msg_header_time < last_timestamp_img)
     {
         ROS_ERROR("img loop back, clear buffer");
         img_buffer.clear();
         img_time_buffer.clear();
+        img_pending_time.clear();
+        img_epoch ++;
     }
-    mtx_buffer.lock();
-
-    // 将图像和时间戳存入缓冲区
-    img_buffer.push_back(getImageFromMsg(msg));
-    img_time_buffer.push_back(msg_header_time);
     last_timestamp_img = msg_header_time;
-
+    img_pending_time.push_back(msg_header_time);
+    const int epoch = img_epoch;
     mtx_buffer.unlock();
-    sig_buffer.notify_all();
+
+    // 缩放、灰度化、建金字塔在图像预处理线程中完成
+    p_img->push(msg, msg_header_time, epoch);
+}
+
+// 收到 /trace_dump 时输出各阶段耗时分位数，并导出 Chrome trace 到 Log/trace.json
+void trace_dump_cbk(const std_msgs::Empty::ConstPtr &msg)
+{
+    if (!Tracer::enabled())
+    {
+        printf("[ TRACE ]: tracing disabled, set trace_en: true.\n");
+        return;
+    }
+    Tracer::print_summary();
+    Tracer::dump_chrome(DEBUG_FILE_DIR("trace.json"));
+}
+
+// 收到 /metrics_dump 时输出每帧指标的统计，并把缓冲区中的帧写入 Log/metrics.txt
+void metrics_dump_cbk(const std_msgs::Empty::ConstPtr &msg)
+{
+    frame_metrics.print_summary();
+    frame_metrics.dump(DEBUG_FILE_DIR("metrics.txt"));
 }
 
 // 同步激光雷达、IMU和图像数据
 bool sync_packages(LidarMeasureGroup &meas)
 {
+    // 回调在 AsyncSpinner 的线程中并发执行，整个同步过程持有缓冲区锁
+    std::lock_guard<std::mutex> lock(mtx_buffer);
+    buffer_updated = false;
     if ((lidar_buffer.empty() && img_buffer.empty())) { // has lidar topic or img topic?
         return false;
     }
@@ -553,27 +700,60 @@ bool sync_packages(LidarMeasureGroup &meas)
         meas.lidar = lidar_buffer.front(); // push the firsrt lidar topic
         if(meas.lidar->points.size() <= 1)
         {
-            mtx_buffer.lock();
             if (img_buffer.size()>0) // temp method, ignore img topic when no lidar points, keep sync
             {
                 lidar_buffer.pop_front();
                 img_buffer.pop_front();
             }
-            mtx_buffer.unlock();
             sig_buffer.notify_all();
             // ROS_ERROR("out sync");
             return false;
         }
-        // 按时间戳排序点云
-        sort(meas.lidar->points.begin(), meas.lidar->points.end(), time_list); // sort by sample timestamp
+        // 点云已在回调中按时间戳排序
         // 计算激光帧开始时间和结束时间
         meas.lidar_beg_time = time_buffer.front(); // generate lidar_beg_time
         lidar_end_time = meas.lidar_beg_time + meas.lidar->points.back().curvature / double(1000); // calc lidar scan end time
+        meas.lidar_slice_index = 0;
         lidar_pushed = true; // flag
     }
 
+    // 子扫描模式：把一帧扫描按时间等分为 lio_slice_num 段，每段的IMU数据到齐后立即做一次去畸变和EKF更新，
+    // 最后一段仍按整帧结束处理。段内有图像时先处理图像
+    double slice_end_time = lidar_end_time;
+    if (lio_slice_num > 1 && meas.lidar_slice_index < lio_slice_num - 1)
+    {
+        slice_end_time = meas.lidar_beg_time + (lidar_end_time - meas.lidar_beg_time) * (meas.lidar_slice_index + 1) / lio_slice_num;
+    }
+    // 还在预处理的图像按顺序进入 img_buffer，时间戳不晚于 t 时要等它处理完，不能先按纯激光雷达结束该段
+    auto img_pending = [](double t) { return !img_pending_time.empty() && img_pending_time.front() <= t; };
+    if (slice_end_time < lidar_end_time && (img_buffer.empty() || img_time_buffer.front() > slice_end_time))
+    {
+        if (img_pending(slice_end_time)) {
+            return false;
+        }
+        if (last_timestamp_imu < slice_end_time) { // imu message needs to cover the slice end
+            return false;
+        }
+        struct MeasureGroup m;
+        m.img_offset_time = slice_end_time - meas.lidar_beg_time; // slice end time, it should be the Kalman update timestamp.
+        while (!imu_buffer.empty()) {
+            double imu_time = imu_buffer.front()->header.stamp.toSec();
+            if(imu_time > slice_end_time) break;
+            m.imu.push_back(imu_buffer.front());
+            imu_buffer.pop_front();
+        }
+        sig_buffer.notify_all();
+        meas.lidar_slice_index ++;
+        meas.is_lidar_end = false; // lidar scan is not finished yet
+        meas.measures.push_back(m);
+        return true;
+    }
+
     // 只有激光雷达数据没有图像数据时
     if (img_buffer.empty()) { // no img topic, means only has lidar topic
+        if (img_pending(lidar_end_time)) {
+            return false;
+        }
         // 等待和当前帧雷达数据同步的IMU数据都到来
         if (last_timestamp_imu < lidar_end_time+0.02) { // imu message needs to be larger than lidar_end_time, keep complete propagate.
             // ROS_ERROR("out sync");
@@ -582,7 +762,6 @@ bool sync_packages(LidarMeasureGroup &meas)
         struct MeasureGroup m; //standard method to keep imu message.
         double imu_time = imu_buffer.front()->header.stamp.toSec();
         m.imu.clear();
-        mtx_buffer.lock();
         while ((!imu_buffer.empty() && (imu_time<lidar_end_time))) {
             imu_time = imu_buffer.front()->header.stamp.toSec();
             if(imu_time > lidar_end_time) break;
@@ -591,7 +770,6 @@ bool sync_packages(LidarMeasureGroup &meas)
         }
         lidar_buffer.pop_front();
         time_buffer.pop_front();
-        mtx_buffer.unlock();
         sig_buffer.notify_all();
         lidar_pushed = false; // sync one whole lidar scan.
         meas.is_lidar_end = true; // process lidar topic, so timestamp should be lidar scan end.
@@ -614,7 +792,6 @@ bool sync_packages(LidarMeasureGroup &meas)
         }
         double imu_time = imu_buffer.front()->header.stamp.toSec();
         m.imu.clear();
-        mtx_buffer.lock();
         while ((!imu_buffer.empty() && (imu_time<lidar_end_time))) 
         {
             imu_time = imu_buffer.front()->header.stamp.toSec();
@@ -624,7 +801,6 @@ bool sync_packages(LidarMeasureGroup &meas)
         }
         lidar_buffer.pop_front();
         time_buffer.pop_front();
-        mtx_buffer.unlock();
         sig_buffer.notify_all();
         lidar_pushed = false;
         meas.is_lidar_end = true;
@@ -643,7 +819,6 @@ bool sync_packages(LidarMeasureGroup &meas)
         m.imu.clear();
         m.img_offset_time = img_start_time - meas.lidar_beg_time; // record img offset time, it shoule be the Kalman update timestamp.
         m.img = img_buffer.front();
-        mtx_buffer.lock();
         // 只取图像帧前的IMU数据
         // ???: 那图像帧时间戳和雷达帧结束时间戳之间的IMU数据怎么处理？
         while ((!imu_buffer.empty() && (imu_time<img_start_time))) 
@@ -655,7 +830,6 @@ bool sync_packages(LidarMeasureGroup &meas)
         }
         img_buffer.pop_front();
         img_time_buffer.pop_front();
-        mtx_buffer.unlock();
         sig_buffer.notify_all();
         meas.is_lidar_end = false; // has img topic in lidar scan, so flag "is_lidar_end=false" 
         meas.measures.push_back(m);
@@ -718,6 +892,81 @@ bool sync_packages(LidarMeasureGroup &meas)
  * @brief 往ikdtree中添加当前帧的点云
  * 
  */
+void map_add_points_now(PointVector &points)
+{
+#ifdef USE_ikdtree
+    #ifdef USE_ikdforest
+    ikdforest.Add_Points(points, lidar_end_time);
+    #else
+    ikdtree.Add_Points(points, true);
+    #endif
+#endif
+    if (map_pub_en) map_delta.insert(points);
+    if (snapshot_save_en) snapshot_map.insert(points);
+}
+
+/**
+ * @brief 地图插入线程，每次处理一帧提交的点
+ * 
+ */
+void map_worker()
+{
+    unique_lock<mutex> lock(mtx_map);
+    while (true)
+    {
+        sig_map.wait(lock, []{ return map_add_pending || !map_running; });
+        if (!map_add_pending) break;
+        lock.unlock();
+        double t_add = omp_get_wtime();
+        map_add_points_now(map_add_points);
+        t_add = omp_get_wtime() - t_add;
+        lock.lock();
+        map_add_time = t_add;
+        map_done_time = omp_get_wtime();
+        map_add_pending = false;
+        sig_map.notify_all();
+    }
+}
+
+void start_map_worker()
+{
+    map_running = true;
+    map_thread = thread(map_worker);
+}
+
+void stop_map_worker()
+{
+    if (!map_thread.joinable()) return;
+    {
+        lock_guard<mutex> lock(mtx_map);
+        map_running = false;
+    }
+    sig_map.notify_all();
+    map_thread.join();
+}
+
+/**
+ * @brief 等待上一次提交的插入完成。下一帧访问ikdtree（删除、建树、近邻搜索）前调用，
+ *        保证搜索看到的是插入完成后的地图
+ * 
+ * @param wait_time 本次等待的时间，即异步插入给下一帧增加的延迟
+ * @param add_time 上一次插入在后台的耗时，同步插入时这部分会计入上一帧
+ * @param stale_time 从提交插入到插入完成的时间，这段时间内ikdtree落后于状态估计
+ */
+void wait_map_incremental(double &wait_time, double &add_time, double &stale_time)
+{
+    wait_time = add_time = stale_time = 0.0;
+    if (!map_thread.joinable()) return;
+    double t_wait = omp_get_wtime();
+    unique_lock<mutex> lock(mtx_map);
+    if (map_add_pending) sig_map.wait(lock, []{ return !map_add_pending; });
+    wait_time = omp_get_wtime() - t_wait;
+    if (map_enqueue_time == 0.0) return;
+    add_time = map_add_time;
+    stale_time = map_done_time - map_enqueue_time;
+    map_enqueue_time = 0.0;
+}
+
 void map_incremental()
 {
     for (int i = 0; i < feats_down_size; i++)
@@ -725,24 +974,129 @@ void map_incremental()
         /* transform to world frame */
         pointBodyToWorld(&(feats_down_body->points[i]), &(feats_down_world->points[i]));
     }
-#ifdef USE_ikdtree
-    #ifdef USE_ikdforest
-    ikdforest.Add_Points(feats_down_world->points, lidar_end_time);
-    #else
-    ikdtree.Add_Points(feats_down_world->points, true);
-    #endif
-#endif
+    if (!map_thread.joinable())
+    {
+        map_add_points_now(feats_down_world->points);
+        return;
+    }
+    // 上一次插入已在本帧搜索前完成，这里直接提交
+    {
+        lock_guard<mutex> lock(mtx_map);
+        map_add_points.assign(feats_down_world->points.begin(), feats_down_world->points.end());
+        map_add_pending = true;
+        map_enqueue_time = omp_get_wtime();
+    }
+    sig_map.notify_all();
+}
+
+/**
+ * @brief 发布线程：依次执行估计线程提交的发布任务
+ * 
+ */
+void publish_worker()
+{
+    while (true)
+    {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(mtx_pub);
+            sig_pub.wait(lock, []{ return !pub_tasks.empty() || !pub_running; });
+            if (pub_tasks.empty()) break;
+            task = move(pub_tasks.front().run);
+            if (pub_tasks.front().display) pub_display_queued --;
+            else pub_save_queued --;
+            pub_tasks.pop_front();
+        }
+        sig_pub_pop.notify_all();
+        task();
+    }
+}
+
+void start_publish_worker()
+{
+    pub_running = true;
+    pub_thread = thread(publish_worker);
+}
+
+/**
+ * @brief 执行完已提交的任务后退出发布线程
+ * 
+ */
+void stop_publish_worker()
+{
+    if (!pub_thread.joinable()) return;
+    {
+        lock_guard<mutex> lock(mtx_pub);
+        pub_running = false;
+    }
+    sig_pub.notify_all();
+    sig_pub_pop.notify_all();
+    pub_thread.join();
 }
 
 /**
- * @brief 发布RGB点云，没RGB信息时发布普通点云
+ * @brief 提交发布任务。任务只能访问按值捕获的数据，不能读估计线程会修改的全局变量；
+ *        发布线程未启动时（离线回放）直接在当前线程执行。
+ *        发布线程跟不上时，display 任务（只发布消息）最多排队 PUB_MAX_DISPLAY 个，多出的丢弃最旧的，
+ *        队列中的点云和图像副本因此有界；存图等必须执行的任务不丢弃，最多排队 PUB_MAX_SAVE 个，
+ *        再多时估计线程在这里等待，写盘变慢（TileWriter::push 阻塞发布线程）时反压到估计线程，而不是在队列中堆积
+ * 
+ */
+void push_publish_task(function<void()> task, bool display = true)
+{
+    size_t dropped = 0;
+    {
+        unique_lock<mutex> lock(mtx_pub);
+        if (!display) sig_pub_pop.wait(lock, []{ return pub_save_queued < PUB_MAX_SAVE || !pub_running; });
+        if (pub_running)
+        {
+            if (display && pub_display_queued >= PUB_MAX_DISPLAY)
+            {
+                for (auto it = pub_tasks.begin(); it != pub_tasks.end(); ++it)
+                {
+                    if (!it->display) continue;
+                    pub_tasks.erase(it);
+                    pub_display_queued --;
+                    dropped = ++pub_dropped;
+                    break;
+                }
+            }
+            pub_tasks.push_back({move(task), display});
+            if (display) pub_display_queued ++;
+            else pub_save_queued ++;
+            task = nullptr;
+        }
+    }
+    if (dropped == 1 || (dropped > 0 && dropped % 100 == 0))
+        printf("[ PUB ]: publish thread is behind, %lu display tasks dropped so far.\n", (unsigned long)dropped);
+    if (task) task();
+    else sig_pub.notify_one();
+}
+
+/**
+ * @brief 一帧地图点已写入 pcd_stage，每 pcd_save_interval 帧交给后台线程按块写盘，
+ *        内存只保留这几帧和写盘队列，估计线程不参与
+ */
+void stage_pcd_scan(bool flush = false)
+{
+    if (!flush && ++pcd_stage_scans < max(pcd_save_interval, 1)) return;
+    tile_writer.push(std::move(pcd_stage));
+    pcd_stage = vector<TilePoint>();
+    pcd_stage_scans = 0;
+}
+
+/**
+ * @brief 发布RGB点云，没RGB信息时发布普通点云。在发布线程中执行
  * 
  * @param pubLaserCloudFullRes 
- * @param lidar_selector 
+ * @param pcl_wait_pub world系下的点云副本
+ * @param frame 当前图像帧，用于投影着色
+ * @param img_rgb 当前帧彩色图
  */
-// PointCloudXYZRGB::Ptr pcl_wait_pub_RGB(new PointCloudXYZRGB(500000, 1));
+PointCloudXYZRGB::Ptr laserCloudWorldRGB(new PointCloudXYZRGB()); // 着色后的点云，只在发布任务中使用，复用内存
 PointCloudXYZI::Ptr pcl_wait_pub(new PointCloudXYZI()); // 上一帧world系下的点云
-void publish_frame_world_rgb(const ros::Publisher & pubLaserCloudFullRes, lidar_selection::LidarSelectorPtr lidar_selector)
+PointCloudXYZI::Ptr pcl_scan_accum(new PointCloudXYZI()); // 子扫描模式下当前帧已处理的world系点云
+void publish_frame_world_rgb(const ros::Publisher & pubLaserCloudFullRes, PointCloudXYZI::ConstPtr pcl_wait_pub, lidar_selection::FramePtr frame, cv::Mat img_rgb)
 {
     // PointCloudXYZI::Ptr laserCloudFullRes(dense_map_en ? feats_undistort : feats_down_body);
     // int size = laserCloudFullRes->points.size();
@@ -754,41 +1108,23 @@ void publish_frame_world_rgb(const ros::Publisher & pubLaserCloudFullRes, lidar_
     //     RGBpointBodyToWorld(&laserCloudFullRes->points[i], \
     //                         &laserCloudWorld->points[i]);
     // }
-    uint size = pcl_wait_pub->points.size();
-    PointCloudXYZRGB::Ptr laserCloudWorldRGB(new PointCloudXYZRGB(size, 1));
-    if(img_en)
+    // 预处理阶段没有保留彩色图时（无订阅且不保存地图）跳过着色
+    laserCloudWorldRGB->clear();
+    if(img_en && !img_rgb.empty())
     {
-        laserCloudWorldRGB->clear();
-        cv::Mat img_rgb = lidar_selector->img_rgb;
-        for (int i=0; i<size; i++)
-        {
-            PointTypeRGB pointRGB;
-            pointRGB.x =  pcl_wait_pub->points[i].x;
-            pointRGB.y =  pcl_wait_pub->points[i].y;
-            pointRGB.z =  pcl_wait_pub->points[i].z;
-            V3D p_w(pcl_wait_pub->points[i].x, pcl_wait_pub->points[i].y, pcl_wait_pub->points[i].z);
-            V3D pf(lidar_selector->new_frame_->w2f(p_w));
-            if (pf[2] < 0) continue;
-            V2D pc(lidar_selector->new_frame_->w2c(p_w));
-            // 根据当前帧位姿将点云投影到图像平面获取对应像素的RGB
-            if (lidar_selector->new_frame_->cam_->isInFrame(pc.cast<int>(),0))
-            {
-                V3F pixel = lidar_selector->getpixel(img_rgb, pc);
-                pointRGB.r = pixel[2];
-                pointRGB.g = pixel[1];
-                pointRGB.b = pixel[0];
-                laserCloudWorldRGB->push_back(pointRGB);
-            }
-
-        }
-
+        // 根据当前帧位姿将点云投影到图像平面，双线性插值获取对应像素的RGB
+        ColorizeModel model;
+        const double cam_d[4] = {cam_d0, cam_d1, cam_d2, cam_d3};
+        BuildColorizeModel(model, frame->T_f_w_.rotation_matrix(), frame->T_f_w_.translation(), cam_fx, cam_fy, cam_cx, cam_cy,
+                           cam_d, img_rgb.cols, img_rgb.rows, frame->cam_);
+        ColorizePoints(model, img_rgb, pcl_wait_pub->points.data(), pcl_wait_pub->points.size(), *laserCloudWorldRGB);
     }
     // else
     // {
     //*pcl_wait_pub = *laserCloudWorld;
     // }
     // mtx_buffer_pointcloud.lock();
-    if (1)//if(publish_count >= PUBFRAME_PERIOD)
+    if (publish_en)//if(publish_count >= PUBFRAME_PERIOD)
     {
         sensor_msgs::PointCloud2 laserCloudmsg;
         if (img_en)
@@ -808,12 +1144,33 @@ void publish_frame_world_rgb(const ros::Publisher & pubLaserCloudFullRes, lidar_
     }
     // mtx_buffer_pointcloud.unlock();
     /**************** save map ****************/
-    /* 1. make sure you have enough memories
-    /* 2. noted that pcd save will influence the real-time performences **/
-    if (pcd_save_en) *pcl_wait_save += *laserCloudWorldRGB;          
+    if (pcd_save_en && rgb_voxel_size > 0)
+    {
+        rgb_map.insert(*laserCloudWorldRGB);
+        if (++rgb_map_scans >= max(pcd_save_interval, 1))
+        {
+            rgb_map_scans = 0;
+            PointCloudXYZRGB rgb_map_delta;
+            rgb_map.take_updated(rgb_map_delta);
+            if (publish_en && pubRGBMap.getNumSubscribers() > 0)
+            {
+                sensor_msgs::PointCloud2 rgb_map_msg;
+                pcl::toROSMsg(rgb_map_delta, rgb_map_msg);
+                rgb_map_msg.header.stamp = ros::Time::now();
+                rgb_map_msg.header.frame_id = "camera_init";
+                pubRGBMap.publish(rgb_map_msg);
+            }
+        }
+    }
+    else if (pcd_save_en)
+    {
+        for (const PointTypeRGB &p : laserCloudWorldRGB->points)
+            pcd_stage.push_back({p.x, p.y, p.z, p.rgb});
+        stage_pcd_scan();
+    }
 }
 
-void publish_frame_world(const ros::Publisher & pubLaserCloudFullRes)
+void publish_frame_world(const ros::Publisher & pubLaserCloudFullRes, PointCloudXYZI::ConstPtr pcl_wait_pub)
 {
     // PointCloudXYZI::Ptr laserCloudFullRes(dense_map_en ? feats_undistort : feats_down_body);
     // int size = laserCloudFullRes->points.size();
@@ -832,7 +1189,7 @@ void publish_frame_world(const ros::Publisher & pubLaserCloudFullRes)
     //*pcl_wait_pub = *laserCloudWorld;
     // }
     // mtx_buffer_pointcloud.lock();
-    if (1)//if(publish_count >= PUBFRAME_PERIOD)
+    if (publish_en)//if(publish_count >= PUBFRAME_PERIOD)
     {
         sensor_msgs::PointCloud2 laserCloudmsg;
 
@@ -845,7 +1202,12 @@ void publish_frame_world(const ros::Publisher & pubLaserCloudFullRes)
         // pcl_wait_pub->clear();
     }
     // mtx_buffer_pointcloud.unlock();
-    if (pcd_save_en) *pcl_wait_save_lidar += *pcl_wait_pub;
+    if (pcd_save_en)
+    {
+        for (const PointType &p : pcl_wait_pub->points)
+            pcd_stage.push_back({p.x, p.y, p.z, p.intensity});
+        stage_pcd_scan();
+    }
 }
 
 void publish_visual_world_map(const ros::Publisher & pubVisualCloud)
@@ -863,7 +1225,7 @@ void publish_visual_world_map(const ros::Publisher & pubVisualCloud)
     // mtx_buffer_pointcloud.lock();
     PointCloudXYZI::Ptr pcl_visual_wait_pub(new PointCloudXYZI());
     *pcl_visual_wait_pub = *laserCloudFullRes;
-    if (1)//if(publish_count >= PUBFRAME_PERIOD)
+    if (publish_en)//if(publish_count >= PUBFRAME_PERIOD)
     {
         sensor_msgs::PointCloud2 laserCloudmsg;
         pcl::toROSMsg(*pcl_visual_wait_pub, laserCloudmsg);
@@ -880,11 +1242,11 @@ void publish_visual_world_map(const ros::Publisher & pubVisualCloud)
  * @brief 发布当前帧tracking的点图点
  * 
  * @param pubSubVisualCloud 
+ * @param laserCloudFullRes 点图点的副本
  */
 
-void publish_visual_world_sub_map(const ros::Publisher & pubSubVisualCloud)
+void publish_visual_world_sub_map(const ros::Publisher & pubSubVisualCloud, PointCloudXYZI::ConstPtr laserCloudFullRes)
 {
-    PointCloudXYZI::Ptr laserCloudFullRes(sub_map_cur_frame_point);
     int size = laserCloudFullRes->points.size();
     if (size==0) return;
     // PointCloudXYZI::Ptr laserCloudWorld( new PointCloudXYZI(size, 1));
@@ -897,7 +1259,7 @@ void publish_visual_world_sub_map(const ros::Publisher & pubSubVisualCloud)
     // mtx_buffer_pointcloud.lock();
     PointCloudXYZI::Ptr sub_pcl_visual_wait_pub(new PointCloudXYZI());
     *sub_pcl_visual_wait_pub = *laserCloudFullRes;
-    if (1)//if(publish_count >= PUBFRAME_PERIOD)
+    if (publish_en)//if(publish_count >= PUBFRAME_PERIOD)
     {
         sensor_msgs::PointCloud2 laserCloudmsg;
         pcl::toROSMsg(*sub_pcl_visual_wait_pub, laserCloudmsg);
@@ -912,6 +1274,7 @@ void publish_visual_world_sub_map(const ros::Publisher & pubSubVisualCloud)
 
 void publish_effect_world(const ros::Publisher & pubLaserCloudEffect)
 {
+    if (!publish_en) return;
     PointCloudXYZI::Ptr laserCloudWorld( \
                     new PointCloudXYZI(effct_feat_num, 1));
     for (int i = 0; i < effct_feat_num; i++)
@@ -919,15 +1282,20 @@ void publish_effect_world(const ros::Publisher & pubLaserCloudEffect)
         RGBpointBodyToWorld(&laserCloudOri->points[i], \
                             &laserCloudWorld->points[i]);
     }
-    sensor_msgs::PointCloud2 laserCloudFullRes3;
-    pcl::toROSMsg(*laserCloudWorld, laserCloudFullRes3);
-    laserCloudFullRes3.header.stamp = ros::Time::now();//.fromSec(last_timestamp_lidar);
-    laserCloudFullRes3.header.frame_id = "camera_init";
-    pubLaserCloudEffect.publish(laserCloudFullRes3);
+    // 转换到world系依赖当前状态，在估计线程完成；消息序列化和发布交给发布线程
+    push_publish_task([pubLaserCloudEffect, laserCloudWorld]()
+    {
+        sensor_msgs::PointCloud2 laserCloudFullRes3;
+        pcl::toROSMsg(*laserCloudWorld, laserCloudFullRes3);
+        laserCloudFullRes3.header.stamp = ros::Time::now();//.fromSec(last_timestamp_lidar);
+        laserCloudFullRes3.header.frame_id = "camera_init";
+        pubLaserCloudEffect.publish(laserCloudFullRes3);
+    });
 }
 
 void publish_map(const ros::Publisher & pubLaserCloudMap)
 {
+    if (!publish_en) return;
     sensor_msgs::PointCloud2 laserCloudMap;
     pcl::toROSMsg(*featsFromMap, laserCloudMap);
     laserCloudMap.header.stamp = ros::Time::now();
@@ -935,6 +1303,61 @@ void publish_map(const ros::Publisher & pubLaserCloudMap)
     pubLaserCloudMap.publish(laserCloudMap);
 }
 
+/**
+ * @brief 发布各层LOD地图自上次发布以来的变化，周期性地或在订阅者增加时发布整层
+ * 
+ */
+void publish_map_delta(const ros::Publisher & pubMapDelta)
+{
+    const int subscribers = pubMapDelta.getNumSubscribers();
+    const bool keyframe = subscribers > map_pub_subscribers || ++map_pub_count >= map_pub_keyframe_interval;
+    map_pub_subscribers = subscribers;
+    if (keyframe) map_pub_count = 0;
+    MapDeltaLevel delta;
+    for (int level = 0; level < map_delta.levels(); level++)
+    {
+        // 没有订阅者时也要取出，变化记录才不会累积
+        map_delta.take(level, keyframe, delta);
+        if (subscribers == 0) continue;
+        fast_livo::MapDelta msg;
+        msg.header.stamp = ros::Time::now();
+        msg.header.frame_id = "camera_init";
+        msg.seq = map_pub_seq[level]++;
+        msg.keyframe = delta.keyframe;
+        msg.level = level;
+        msg.resolution = delta.resolution;
+        msg.block_size = map_delta.block();
+        msg.updated_blocks = delta.updated;
+        msg.updated_counts = delta.counts;
+        msg.removed_blocks = delta.removed;
+        pcl::toROSMsg(delta.points, msg.points);
+        msg.points.header = msg.header;
+        pubMapDelta.publish(msg);
+    }
+}
+
+/**
+ * @brief 发布本帧 VIO 各金字塔层的迭代次数和误差
+ * 
+ */
+void publish_vio_stats(const ros::Publisher & pubVioStats, const lidar_selection::VioStats &stats)
+{
+    if (!publish_en) return;
+    push_publish_task([pubVioStats, stats]()
+    {
+        fast_livo::VioStats msg;
+        msg.header.stamp = ros::Time::now();
+        msg.header.frame_id = "camera_init";
+        msg.patches = stats.patches;
+        for (int level = 0; level < 3; level++) msg.iterations[level] = stats.iterations[level];
+        msg.prior_error = stats.prior_error;
+        msg.final_error = stats.final_error;
+        msg.time = stats.time;
+        msg.deadline_hit = stats.deadline_hit;
+        pubVioStats.publish(msg);
+    });
+}
+
 template<typename T>
 void set_posestamp(T & out)
 {
@@ -961,6 +1384,7 @@ void set_posestamp(T & out)
  */
 void publish_odometry(const ros::Publisher & pubOdomAftMapped)
 {
+    if (!publish_en) return;
     odomAftMapped.header.frame_id = "camera_init";
     odomAftMapped.child_frame_id = "aft_mapped";
     odomAftMapped.header.stamp = ros::Time::now();//.ros::Time()fromSec(last_timestamp_lidar);
@@ -989,6 +1413,7 @@ void publish_odometry(const ros::Publisher & pubOdomAftMapped)
 
 void publish_mavros(const ros::Publisher & mavros_pose_publisher)
 {
+    if (!publish_en) return;
     msg_body_pose.header.stamp = ros::Time::now();
     msg_body_pose.header.frame_id = "camera_odom_frame";
     set_posestamp(msg_body_pose.pose);
@@ -1000,6 +1425,7 @@ void publish_path(const ros::Publisher pubPath)
     set_posestamp(msg_body_pose.pose);
     msg_body_pose.header.stamp = ros::Time::now();
     msg_body_pose.header.frame_id = "camera_init";
+    if (!publish_en) return;
     path.poses.push_back(msg_body_pose);
     pubPath.publish(path);
 }
@@ -1046,7 +1472,8 @@ void h_share_model(state_ikfom &s, esekfom::dyn_share_datastruct<double> &ekfom_
                 uint8_t search_flag = 0;                        
                 search_flag = ikdforest.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis, first_lidar_time, 5);                            
             #else
-                ikdtree.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
+                if (localization_en) static_map.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
+                else ikdtree.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
             #endif
         #else
             kdtreeSurfFromMap->nearestKSearch(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
@@ -1140,10 +1567,12 @@ void h_share_model(state_ikfom &s, esekfom::dyn_share_datastruct<double> &ekfom_
 }
 #endif         
 
-// 读取参数
-void readParameters(ros::NodeHandle &nh)
+// 读取参数，NodeT 为 ros::NodeHandle 或离线回放的 YamlParam
+template<typename NodeT>
+void readParameters(NodeT &nh)
 {
     nh.param<int>("dense_map_enable",dense_map_en,1);                               // 显示稠密地图
+    nh.param<int>("img_pyr_levels",img_pyr_levels,1);                               // 图像预处理时构建的金字塔层数
     nh.param<int>("img_enable",img_en,1);                                           // 使用图像
     nh.param<int>("lidar_enable",lidar_en,1);                                       // 使用激光雷达
     nh.param<int>("debug", debug, 0);                                               // 调试模式
@@ -1154,6 +1583,10 @@ void readParameters(ros::NodeHandle &nh)
     nh.param<double>("laserMapping/cam_fy",cam_fy, 400);                            // 相机内参 fy
     nh.param<double>("laserMapping/cam_cx",cam_cx, 300);                            // 相机内参 cx
     nh.param<double>("laserMapping/cam_cy",cam_cy, 300);                            // 相机内参 cy
+    nh.param<double>("laserMapping/cam_d0", cam_d0, 0.0);                           // 相机畸变参数 k1 k2 p1 p2
+    nh.param<double>("laserMapping/cam_d1", cam_d1, 0.0);
+    nh.param<double>("laserMapping/cam_d2", cam_d2, 0.0);
+    nh.param<double>("laserMapping/cam_d3", cam_d3, 0.0);
     nh.param<double>("laser_point_cov",LASER_POINT_COV,0.001);                      // 激光点云协方差，即权重
     nh.param<double>("img_point_cov",IMG_POINT_COV,10);                             // 图像特征点协方差，即权重
     nh.param<string>("map_file_path",map_file_path,"");                             // 地图文件路径
@@ -1178,64 +1611,148 @@ void readParameters(ros::NodeHandle &nh)
     nh.param<int>("grid_size", grid_size, 40);                                      // 图像网格块大小，单位像素
     nh.param<int>("patch_size", patch_size, 4);                                     // 图像块大小，单位像素
     nh.param<double>("outlier_threshold",outlier_threshold,100);                    // 图像特征点误差阈值
-    nh.param<double>("ncc_thre", ncc_thre, 100);                                    // 图像特征点匹配NCC阈值
+    nh.param<double>("ncc_thre", ncc_thre, 0.5);                                    // 图像特征点匹配NCC阈值
+    nh.param<bool>("vio_budget/adaptive_en", vio_adaptive_en, false);               // VIO 自适应迭代
+    nh.param<double>("vio_budget/skip_error", vio_skip_error, 50.0);                // 先验每像素平均误差平方低于该值时跳过金字塔粗层
+    nh.param<double>("vio_budget/min_decrease", vio_min_decrease, 0.01);            // 代价相对下降低于该值时结束本层迭代
+    nh.param<double>("vio_budget/time_budget", vio_time_budget, 0.0);               // 每帧 VIO 用时上限，单位秒，0为不限制
     nh.param<bool>("pcd_save/pcd_save_en", pcd_save_en, false);                     // 是否保存pcd地图
+    nh.param<int>("pcd_save/interval", pcd_save_interval, 20);                      // 每多少帧把暂存的地图点交给写盘线程
+    nh.param<double>("pcd_save/tile_size", pcd_tile_size, 50.0);                    // 地图分块边长，单位米
+    nh.param<double>("pcd_save/rgb_voxel_size", rgb_voxel_size, 0.0);               // 彩色地图的融合体素边长，0为保存所有着色点
     nh.param<bool>("pose_output_en", pose_output_en, false);                        // 是否输出位姿
     nh.param<double>("delta_time", delta_time, 0.0);                                // 雷达和图像的时间戳差
+    nh.param<int>("lio_slice_num", lio_slice_num, 1);                               // 每帧扫描切分的子扫描数，1为整帧更新
+    nh.param<bool>("imu_odom_en", imu_odom_en, false);                              // 按IMU频率发布里程计
+    nh.param<bool>("map_async_en", map_async_en, true);                             // 在后台线程插入地图点
+    nh.param<bool>("trace_en", trace_en, false);                                    // 记录各阶段耗时分位数，可导出Chrome trace
+    nh.param<bool>("snapshot/save_en", snapshot_save_en, false);                    // 是否保存地图快照
+    nh.param<bool>("snapshot/load_en", snapshot_load_en, false);                    // 启动时是否加载地图快照
+    nh.param<string>("snapshot/path", snapshot_path, "");                           // 地图快照文件，为空时为 PCD/map.snapshot
+    nh.param<double>("snapshot/interval", snapshot_interval, 0.0);                  // 运行中每多少秒保存一次快照，0为只在退出时保存
+    nh.param<bool>("localization/localization_en", localization_en, false);         // 定位模式，在 snapshot/path 的地图上定位，不建图
+    if (snapshot_path.empty()) snapshot_path = string(ROOT_DIR) + "PCD/map.snapshot";
+    nh.param<bool>("map_pub/map_pub_en", map_pub_en, false);                        // 是否发布增量地图
+    nh.param<vector<double>>("map_pub/resolutions", map_pub_resolutions, vector<double>({0.5, 2.0})); // 各层LOD的体素边长，从精细到粗糙
+    nh.param<double>("map_pub/block_size", map_pub_block_size, 10.0);               // 地图分块边长，单位米
+    nh.param<int>("map_pub/interval", map_pub_interval, 10);                        // 每多少帧发布一次增量
+    nh.param<int>("map_pub/keyframe_interval", map_pub_keyframe_interval, 30);      // 每多少次增量发布一次整层
 }
 
-int main(int argc, char** argv)
-{
-    ros::init(argc, argv, "laserMapping");
-    ros::NodeHandle nh;
-    image_transport::ImageTransport it(nh);
-    readParameters(nh);
-    pcl_wait_pub->clear();
-    // 创建ROS订阅和发布
-    ros::Subscriber sub_pcl = p_pre->lidar_type == AVIA ? \
-        nh.subscribe(lid_topic, 200000, livox_pcl_cbk) : \
-        nh.subscribe(lid_topic, 200000, standard_pcl_cbk);
-    ros::Subscriber sub_imu = nh.subscribe(imu_topic, 200000, imu_cbk);
-    ros::Subscriber sub_img = nh.subscribe(img_topic, 200000, img_cbk);
-    image_transport::Publisher img_pub = it.advertise("/rgb_img", 1);
-    ros::Publisher pubLaserCloudFullRes = nh.advertise<sensor_msgs::PointCloud2>
-            ("/cloud_registered", 100);
-    ros::Publisher pubVisualCloud = nh.advertise<sensor_msgs::PointCloud2>
-            ("/cloud_visual_map", 100);
-    ros::Publisher pubSubVisualCloud = nh.advertise<sensor_msgs::PointCloud2>
-            ("/cloud_visual_sub_map", 100);
-    ros::Publisher pubLaserCloudEffect  = nh.advertise<sensor_msgs::PointCloud2>
-            ("/cloud_effected", 100);
-    ros::Publisher pubLaserCloudMap = nh.advertise<sensor_msgs::PointCloud2>
-            ("/Laser_map", 100);
-    ros::Publisher pubOdomAftMapped = nh.advertise<nav_msgs::Odometry> 
-            ("/aft_mapped_to_init", 10);
-    ros::Publisher pubPath          = nh.advertise<nav_msgs::Path> 
-            ("/path", 10);
-
+/*** variables definition ***/
+// 滤波器相关参数
+#ifndef USE_IKFOM
+VD(DIM_STATE) solution;
+MD(DIM_STATE, DIM_STATE) G, H_T_H, I_STATE;
+V3D rot_add, t_add;
+StatesGroup state_propagat;
+PointType pointOri, pointSel, coeff;
+#endif
+//PointCloudXYZI::Ptr corr_normvect(new PointCloudXYZI(100000, 1));
+// 处理的lidar帧的数量
+int frame_num = 0;
+double deltaT, deltaR;
+// 总体时间、ICP计算时间、匹配时间、滤波器求解时间、计算H时间
+double aver_time_consu = 0, aver_time_icp = 0, aver_time_match = 0, aver_time_solve = 0, aver_time_const_H_time = 0;
+
+shared_ptr<ImuProcess> p_imu;
+lidar_selection::LidarSelectorPtr lidar_selector;
+
+/*** debug record ***/
+FILE *fp;
+shared_ptr<AsyncLogger> p_log(new AsyncLogger());  // 二进制日志，Log/log_convert.py 转为文本
+
+// ROS发布器，离线回放时不创建
+image_transport::Publisher img_pub;
+ros::Publisher pubLaserCloudFullRes, pubVisualCloud, pubSubVisualCloud, pubLaserCloudEffect, pubLaserCloudMap, pubOdomAftMapped, pubPath;
 #ifdef DEPLOY
-    ros::Publisher mavros_pose_publisher = nh.advertise<geometry_msgs::PoseStamped>("/mavros/vision_pose/pose", 10);
+ros::Publisher mavros_pose_publisher;
 #endif
-    
-    path.header.stamp    = ros::Time::now();
-    path.header.frame_id ="camera_init";
 
-    /*** variables definition ***/
-    // 滤波器相关参数
-    #ifndef USE_IKFOM
-    VD(DIM_STATE) solution;
-    MD(DIM_STATE, DIM_STATE) G, H_T_H, I_STATE;
-    V3D rot_add, t_add;
-    StatesGroup state_propagat;
-    PointType pointOri, pointSel, coeff;
+/**
+ * @brief 收集视觉地图，交给后台线程写快照。视觉地图在估计线程中每次收集 SNAPSHOT_VIO_STEP 个点，
+ *        参考图像只取句柄；激光点和像素由写盘线程取出和写出
+ * 
+ * @param finish 为 true 时一次收集完（退出时）
+ * @return 快照已交给写盘线程时返回 true；上一次快照还在写盘，或视觉地图还未收集完时返回 false
+ */
+bool save_map_snapshot(bool finish)
+{
+    if (!snapshot_collecting)
+    {
+        if (snapshot_writer.busy()) return false;
+        snapshot_pending = SnapshotData();
+        if (img_en) snapshot_begin_vio(*lidar_selector, snapshot_cursor, snapshot_pending);
+        snapshot_collecting = true;
+    }
+    double t0 = omp_get_wtime();
+    if (img_en && !snapshot_step_vio(*lidar_selector, snapshot_cursor, snapshot_pending, finish ? SIZE_MAX : SNAPSHOT_VIO_STEP))
+        return false;
+    snapshot_collecting = false;
+    printf("[ SNAPSHOT ]: %d visual points collected, last step %.3f s.\n", int(snapshot_pending.vio.size()), omp_get_wtime() - t0);
+#if defined(USE_ikdtree) && !defined(USE_ikdforest)
+    return snapshot_writer.save(snapshot_path, std::move(snapshot_pending), &snapshot_map);
+#else
+    return snapshot_writer.save(snapshot_path, std::move(snapshot_pending), nullptr);
+#endif
+}
+
+/**
+ * @brief 加载地图快照：用快照中的点直接建ikdtree，并重建视觉地图
+ * 
+ */
+void load_map_snapshot()
+{
+    double t0 = omp_get_wtime();
+    if (!map_snapshot.open(snapshot_path)) return;
+    PointVector points;
+    snapshot_restore_lio(map_snapshot, points);
+#ifdef USE_ikdtree
+    #ifndef USE_ikdforest
+    if (points.size() > 5)
+    {
+        ikdtree.set_downsample_param(filter_size_map_min);
+        ikdtree.Build(points);
+        if (map_pub_en) map_delta.insert(points);
+        if (snapshot_save_en) snapshot_map.insert(points);
+    }
     #endif
-    //PointCloudXYZI::Ptr corr_normvect(new PointCloudXYZI(100000, 1));
-    // 处理的lidar帧的数量
-    int frame_num = 0;
-    double deltaT, deltaR;
-    // 总体时间、ICP计算时间、匹配时间、滤波器求解时间、计算H时间
-    double aver_time_consu = 0, aver_time_icp = 0, aver_time_match = 0, aver_time_solve = 0, aver_time_const_H_time = 0;
+#endif
+    int vio_points = img_en ? snapshot_restore_vio(map_snapshot, *lidar_selector) : 0;
+    printf("[ SNAPSHOT ]: loaded %d lidar points, %d visual points from %s in %.3f s.\n",
+           int(points.size()), vio_points, snapshot_path.c_str(), omp_get_wtime() - t0);
+}
+
+/**
+ * @brief 定位模式：加载快照中的地图，激光点建静态kd树后释放，视觉地图只读
+ * 
+ */
+void load_localization_map()
+{
+    double t0 = omp_get_wtime();
+    if (!map_snapshot.open(snapshot_path))
+        throw std::runtime_error("Localization needs a map snapshot, failed to load " + snapshot_path);
+    {
+        PointVector points;
+        snapshot_restore_lio(map_snapshot, points);
+        static_map.Build(points);
+    }
+    if (static_map.size() < NUM_MATCH_POINTS)
+        throw std::runtime_error("Localization map " + snapshot_path + " has too few lidar points");
+    int vio_points = 0;
+    if (img_en) vio_points = snapshot_restore_vio(map_snapshot, *lidar_selector);
+    lidar_selector->map_update_en = false;
+    printf("[ SNAPSHOT ]: localization map, %d lidar points, %d visual points from %s in %.3f s.\n",
+           int(static_map.size()), vio_points, snapshot_path.c_str(), omp_get_wtime() - t0);
+}
 
+/**
+ * @brief 根据读取的参数初始化IMU处理、VIO和滤波器，ROS节点和离线回放共用
+ * 
+ * @param cam 相机模型
+ */
+void init_estimator(vk::AbstractCamera* cam)
+{
     // 两个降采样滤波器
     downSizeFilterSurf.setLeafSize(filter_size_surf_min, filter_size_surf_min, filter_size_surf_min);
     downSizeFilterMap.setLeafSize(filter_size_map_min, filter_size_map_min, filter_size_map_min);
@@ -1246,13 +1763,12 @@ int main(int argc, char** argv)
         ikdforest.Set_downsample_param(filter_size_map_min);    
     #endif
 
-    shared_ptr<ImuProcess> p_imu(new ImuProcess());
+    p_imu.reset(new ImuProcess());
     Lidar_offset_to_IMU<<VEC_FROM_ARRAY(extrinT);
     Lidar_rot_to_IMU<<MAT_FROM_ARRAY(extrinR);
     // 设置图像处理相关参数
-    lidar_selection::LidarSelectorPtr lidar_selector(new lidar_selection::LidarSelector(grid_size, new SparseMap));
-    if(!vk::camera_loader::loadFromRosNs("laserMapping", lidar_selector->cam))
-        throw std::runtime_error("Camera model not correctly specified.");
+    lidar_selector.reset(new lidar_selection::LidarSelector(grid_size, new SparseMap));
+    lidar_selector->cam = cam;
     lidar_selector->MIN_IMG_COUNT = MIN_IMG_COUNT;
     lidar_selector->debug = debug;
     lidar_selector->patch_size = patch_size;
@@ -1270,7 +1786,15 @@ int main(int argc, char** argv)
     lidar_selector->cx = cam_cx;
     lidar_selector->cy = cam_cy;
     lidar_selector->ncc_en = ncc_en;
+    lidar_selector->vio_adaptive_en = vio_adaptive_en;
+    lidar_selector->vio_skip_error = vio_skip_error;
+    lidar_selector->vio_min_decrease = vio_min_decrease;
+    lidar_selector->vio_time_budget = vio_time_budget;
     lidar_selector->init();
+
+    // 图像预处理线程
+    p_img->set(lidar_selector->cam->width(), lidar_selector->cam->height(), img_pyr_levels);
+    p_img->rgb_en = img_en && pcd_save_en;
     
     // 设置IMU处理相关参数
     p_imu->set_extrinsic(Lidar_offset_to_IMU, Lidar_rot_to_IMU);
@@ -1293,14 +1817,42 @@ int main(int argc, char** argv)
     #endif
     /*** debug record ***/
     // io输出相关
-    FILE *fp;
     string pos_log_dir = root_dir + "/Log/pos_log.txt";
     fp = fopen(pos_log_dir.c_str(),"w");
 
-    ofstream fout_pre, fout_out, fout_tum;
-    fout_pre.open(DEBUG_FILE_DIR("mat_pre.txt"),ios::out);
-    fout_out.open(DEBUG_FILE_DIR("mat_out.txt"),ios::out);
-    fout_tum.open(DEBUG_FILE_DIR("camera_pose.txt"),ios::out);
+    // mat_pre、mat_out、camera_pose、imu 记录由后台线程写入 Log/log.bin
+    p_log->start(DEBUG_FILE_DIR("log.bin"));
+    p_imu->logger = p_log;
+
+    // 定位模式下地图只读
+    if (localization_en)
+    {
+        map_async_en = false;
+        snapshot_save_en = snapshot_load_en = false;
+        map_pub_en = false;
+    }
+
+    // ikdtree地图插入线程
+    if (map_async_en) start_map_worker();
+
+    // 快照的激光点副本，体素与 ikdtree 的降采样分辨率相同
+    if (snapshot_save_en)
+        snapshot_map.set_levels(vector<double>(1, filter_size_map_min), filter_size_map_min * 64, false);
+
+    // 增量地图只在发布话题时跟踪
+    map_pub_en = map_pub_en && publish_en;
+    if (map_pub_en)
+    {
+        map_delta.set_levels(map_pub_resolutions, map_pub_block_size);
+        map_pub_seq.assign(map_delta.levels(), 0);
+    }
+
+    // 地图分块写盘线程，有图像时保存彩色点，否则保存强度点
+    if (rgb_voxel_size > 0) rgb_map.set_resolution(rgb_voxel_size);
+    if (pcd_save_en)
+        tile_writer.start(string(ROOT_DIR) + (img_en ? "PCD/rgb_tiles" : "PCD/intensity_tiles"), img_en ? "rgb" : "intensity", pcd_tile_size);
+
+    Tracer::set_enabled(trace_en);
 
     // if (fout_pre && fout_out)
     //     cout << "~~~~"<<ROOT_DIR<<" file opened" << endl;
@@ -1311,600 +1863,671 @@ int main(int argc, char** argv)
         ikdforest.Set_balance_criterion_param(0.6);
         ikdforest.Set_delete_criterion_param(0.5);
     #endif
-//------------------------------------------------------------------------------------------------------
-    signal(SIGINT, SigHandle);
-    ros::Rate rate(5000);
-    bool status = ros::ok();
-    while (status)
+
+    if (localization_en) load_localization_map();
+    else if (snapshot_load_en) load_map_snapshot();
+}
+
+/**
+ * @brief 处理一组同步好的数据：IMU预测与去畸变，然后是VIO更新（图像）或LIO更新（扫描/子扫描）
+ * 
+ */
+void process_package()
+{
+    static int package_count = 0;
+    Tracer::set_frame(package_count ++);
+    TRACE_SCOPE("package");
+    /*** Packaged got ***/
+    if (flg_reset)
     {
-        if (flg_exit) break;
-        ros::spinOnce();
-        // 同步雷达、图像和IMU数据
-        if(!sync_packages(LidarMeasures))
-        {
-            status = ros::ok();
-            cv::waitKey(1);
-            rate.sleep();
-            continue;
-        }
+        ROS_WARN("reset when rosbag play back");
+        p_imu->Reset();
+        flg_reset = false;
+        return;
+    }
 
-        /*** Packaged got ***/
-        if (flg_reset)
-        {
-            ROS_WARN("reset when rosbag play back");
-            p_imu->Reset();
-            flg_reset = false;
-            continue;
-        }
+    // double t0,t1,t2,t3,t4,t5,match_start, match_time, solve_start, solve_time, svd_time;
+    double t0,t1,t2,t3,t4,t5,match_start, solve_start, svd_time;
 
-        // double t0,t1,t2,t3,t4,t5,match_start, match_time, solve_start, solve_time, svd_time;
-        double t0,t1,t2,t3,t4,t5,match_start, solve_start, svd_time;
+    match_time = kdtree_search_time = kdtree_search_counter = solve_time = solve_const_H_time = svd_time   = 0;
+    t0 = omp_get_wtime();
+    #ifdef USE_IKFOM
+    p_imu->Process(LidarMeasures, kf, feats_undistort);
+    state_point = kf.get_x();
+    pos_lid = state_point.pos + state_point.rot * state_point.offset_T_L_I;
+    #else
+    // 1. 处理IMU数据，没初始化的先初始化
+    // 2. 完成滤波器预测步
+    // 3. 点云去畸变
+    p_imu->Process2(LidarMeasures, state, feats_undistort); 
+    state_propagat = state;
+    #endif
+    TRACE_RECORD("imu_deskew", omp_get_wtime() - t0);
 
-        match_time = kdtree_search_time = kdtree_search_counter = solve_time = solve_const_H_time = svd_time   = 0;
-        t0 = omp_get_wtime();
-        #ifdef USE_IKFOM
-        p_imu->Process(LidarMeasures, kf, feats_undistort);
-        state_point = kf.get_x();
-        pos_lid = state_point.pos + state_point.rot * state_point.offset_T_L_I;
-        #else
-        // 1. 处理IMU数据，没初始化的先初始化
-        // 2. 完成滤波器预测步
-        // 3. 点云去畸变
-        p_imu->Process2(LidarMeasures, state, feats_undistort); 
-        state_propagat = state;
-        #endif
+    if (lidar_selector->debug)
+    {
+        LidarMeasures.debug_show();
+    }
 
-        if (lidar_selector->debug)
+    if (feats_undistort->empty() || (feats_undistort == nullptr))
+    {
+        // cout<<" No point!!!"<<endl;
+        if (!fast_lio_is_ready)
         {
-            LidarMeasures.debug_show();
+            first_lidar_time = LidarMeasures.lidar_beg_time;
+            p_imu->first_lidar_time = first_lidar_time;
+            LidarMeasures.measures.clear();
+            cout<<"FAST-LIO not ready"<<endl;
+            return;
         }
+    }
+    else
+    {
+        int size = feats_undistort->points.size();
+    }
+    fast_lio_is_ready = true;
+    flg_EKF_inited = (LidarMeasures.lidar_beg_time - first_lidar_time) < INIT_TIME ? \
+                    false : true;
 
-        if (feats_undistort->empty() || (feats_undistort == nullptr))
-        {
-            // cout<<" No point!!!"<<endl;
-            if (!fast_lio_is_ready)
-            {
-                first_lidar_time = LidarMeasures.lidar_beg_time;
-                p_imu->first_lidar_time = first_lidar_time;
-                LidarMeasures.measures.clear();
-                cout<<"FAST-LIO not ready"<<endl;
-                continue;
-            }
-        }
-        else
+    // 同步数据中有图像数据
+    if (LidarMeasures.measures.back().img != nullptr) 
+    {
+        cout<<"[ VIO ]: Raw feature num: "<<pcl_wait_pub->points.size() << "." << endl;
+        if (first_lidar_time<10)
         {
-            int size = feats_undistort->points.size();
+            return;
         }
-        fast_lio_is_ready = true;
-        flg_EKF_inited = (LidarMeasures.lidar_beg_time - first_lidar_time) < INIT_TIME ? \
-                        false : true;
-
-        // 同步数据中有图像数据
-        if (! LidarMeasures.is_lidar_end) 
-        {
-            cout<<"[ VIO ]: Raw feature num: "<<pcl_wait_pub->points.size() << "." << endl;
-            if (first_lidar_time<10)
+        double t_vio = omp_get_wtime();
+        // cout<<"cur state:"<<state.rot_end<<endl;
+        if (img_en) {
+            euler_cur = RotMtoEuler(state.rot_end);
+            p_log->log_state(LOG_STATE_PRE, LidarMeasures.last_update_time - first_lidar_time, euler_cur*57.3, state.pos_end, state.vel_end, \
+                             state.bias_g, state.bias_a, state.gravity);
+            
+            // lidar_selector->detect(LidarMeasures.measures.back().img, feats_undistort);
+            // mtx_buffer_pointcloud.lock();
+            
+            // int size = feats_undistort->points.size();
+            // cout<<"size1111111111111111: "<<size<<endl;
+            // PointCloudXYZI::Ptr laserCloudWorld(new PointCloudXYZI(size, 1));
+            // for (int i = 0; i < size; i++)
+            // {
+            //     pointBodyToWorld(&feats_undistort->points[i], \
+            //                         &laserCloudWorld->points[i]);
+            // }
+
+            // ************ vio 的主函数 *****************
+            lidar_selector->detect(LidarMeasures.measures.back().img, pcl_wait_pub);
+            publish_vio_stats(pubVioStats, lidar_selector->vio_stats);
+            // int size = lidar_selector->map_cur_frame_.size();
+            int size_sub = lidar_selector->sub_map_cur_frame_.size();
+            
+            // map_cur_frame_point->clear();
+            sub_map_cur_frame_point->clear();
+            // for(int i=0; i<size; i++)
+            // {
+            //     PointType temp_map;
+            //     temp_map.x = lidar_selector->map_cur_frame_[i]->pos_[0];
+            //     temp_map.y = lidar_selector->map_cur_frame_[i]->pos_[1];
+            //     temp_map.z = lidar_selector->map_cur_frame_[i]->pos_[2];
+            //     temp_map.intensity = 0.;
+            //     map_cur_frame_point->push_back(temp_map);
+            // }
+            
+            // 提取当前帧图像在vio中tracking的地图点，用于显示
+            for(int i=0; i<size_sub; i++)
             {
-                continue;
+                PointType temp_map;
+                temp_map.x = lidar_selector->sub_map_cur_frame_[i]->pos_[0];
+                temp_map.y = lidar_selector->sub_map_cur_frame_[i]->pos_[1];
+                temp_map.z = lidar_selector->sub_map_cur_frame_[i]->pos_[2];
+                temp_map.intensity = 0.;
+                sub_map_cur_frame_point->push_back(temp_map);
             }
-            // cout<<"cur state:"<<state.rot_end<<endl;
-            if (img_en) {
-                euler_cur = RotMtoEuler(state.rot_end);
-                fout_pre << setw(20) << LidarMeasures.last_update_time - first_lidar_time << " " << euler_cur.transpose()*57.3 << " " << state.pos_end.transpose() << " " << state.vel_end.transpose() \
-                                <<" "<<state.bias_g.transpose()<<" "<<state.bias_a.transpose()<<" "<<state.gravity.transpose()<< endl;
-                
-                // lidar_selector->detect(LidarMeasures.measures.back().img, feats_undistort);
-                // mtx_buffer_pointcloud.lock();
-                
-                // int size = feats_undistort->points.size();
-                // cout<<"size1111111111111111: "<<size<<endl;
-                // PointCloudXYZI::Ptr laserCloudWorld(new PointCloudXYZI(size, 1));
-                // for (int i = 0; i < size; i++)
-                // {
-                //     pointBodyToWorld(&feats_undistort->points[i], \
-                //                         &laserCloudWorld->points[i]);
-                // }
-
-                // ************ vio 的主函数 *****************
-                lidar_selector->detect(LidarMeasures.measures.back().img, pcl_wait_pub);
-                // int size = lidar_selector->map_cur_frame_.size();
-                int size_sub = lidar_selector->sub_map_cur_frame_.size();
-                
-                // map_cur_frame_point->clear();
-                sub_map_cur_frame_point->clear();
-                // for(int i=0; i<size; i++)
-                // {
-                //     PointType temp_map;
-                //     temp_map.x = lidar_selector->map_cur_frame_[i]->pos_[0];
-                //     temp_map.y = lidar_selector->map_cur_frame_[i]->pos_[1];
-                //     temp_map.z = lidar_selector->map_cur_frame_[i]->pos_[2];
-                //     temp_map.intensity = 0.;
-                //     map_cur_frame_point->push_back(temp_map);
-                // }
-                
-                // 提取当前帧图像在vio中tracking的地图点，用于显示
-                for(int i=0; i<size_sub; i++)
+            // 在当前帧图像上显示vio跟踪的地图点，用于显示
+            // 以下发布在发布线程中执行，只使用当前帧数据的副本：点云拷贝，图像帧和图像按引用计数持有（下一帧会新建）
+            cv::Mat img_cp = lidar_selector->img_cp;
+            PointCloudXYZI::Ptr sub_map_pub(new PointCloudXYZI(*sub_map_cur_frame_point));
+            PointCloudXYZI::Ptr frame_pub(new PointCloudXYZI(*pcl_wait_pub));
+            lidar_selection::FramePtr frame_cur = lidar_selector->new_frame_;
+            cv::Mat img_rgb = lidar_selector->img_rgb;
+            push_publish_task([img_cp, sub_map_pub, frame_pub, frame_cur, img_rgb]()
+            {
+                if (!img_cp.empty())
                 {
-                    PointType temp_map;
-                    temp_map.x = lidar_selector->sub_map_cur_frame_[i]->pos_[0];
-                    temp_map.y = lidar_selector->sub_map_cur_frame_[i]->pos_[1];
-                    temp_map.z = lidar_selector->sub_map_cur_frame_[i]->pos_[2];
-                    temp_map.intensity = 0.;
-                    sub_map_cur_frame_point->push_back(temp_map);
+                    cv_bridge::CvImage out_msg;
+                    out_msg.header.stamp = ros::Time::now();
+                    // out_msg.header.frame_id = "camera_init";
+                    out_msg.encoding = sensor_msgs::image_encodings::BGR8;
+                    out_msg.image = img_cp;
+                    img_pub.publish(out_msg.toImageMsg());
                 }
-                // 在当前帧图像上显示vio跟踪的地图点，用于显示
-                cv::Mat img_rgb = lidar_selector->img_cp;
-                cv_bridge::CvImage out_msg;
-                out_msg.header.stamp = ros::Time::now();
-                // out_msg.header.frame_id = "camera_init";
-                out_msg.encoding = sensor_msgs::image_encodings::BGR8;
-                out_msg.image = img_rgb;
-                img_pub.publish(out_msg.toImageMsg());
 
                 // 发布RGB和tracking的地图点的点云
-                if(img_en) publish_frame_world_rgb(pubLaserCloudFullRes, lidar_selector);
-                publish_visual_world_sub_map(pubSubVisualCloud);
-                
-                // *map_cur_frame_point = *pcl_wait_pub;
-                // mtx_buffer_pointcloud.unlock();
-                // lidar_selector->detect(LidarMeasures.measures.back().img, feats_down_world);
-                // p_imu->push_update_state(LidarMeasures.measures.back().img_offset_time, state);
-                geoQuat = tf::createQuaternionMsgFromRollPitchYaw(euler_cur(0), euler_cur(1), euler_cur(2));
-                publish_odometry(pubOdomAftMapped);
-                euler_cur = RotMtoEuler(state.rot_end);
-                fout_out << setw(20) << LidarMeasures.last_update_time - first_lidar_time << " " << euler_cur.transpose()*57.3 << " " << state.pos_end.transpose() << " " << state.vel_end.transpose() \
-                <<" "<<state.bias_g.transpose()<<" "<<state.bias_a.transpose()<<" "<<state.gravity.transpose()<<" "<<feats_undistort->points.size()<<endl;
-            }
-            continue;
+                if(img_en) publish_frame_world_rgb(pubLaserCloudFullRes, frame_pub, frame_cur, img_rgb);
+                publish_visual_world_sub_map(pubSubVisualCloud, sub_map_pub);
+            }, !pcd_save_en);
+            
+            // *map_cur_frame_point = *pcl_wait_pub;
+            // mtx_buffer_pointcloud.unlock();
+            // lidar_selector->detect(LidarMeasures.measures.back().img, feats_down_world);
+            // p_imu->push_update_state(LidarMeasures.measures.back().img_offset_time, state);
+            geoQuat = tf::createQuaternionMsgFromRollPitchYaw(euler_cur(0), euler_cur(1), euler_cur(2));
+            publish_odometry(pubOdomAftMapped);
+            if (imu_odom_en) p_prop->set_anchor(state, LidarMeasures.last_update_time, p_imu->get_acc_scale());
+            euler_cur = RotMtoEuler(state.rot_end);
+            p_log->log_state(LOG_STATE_OUT, LidarMeasures.last_update_time - first_lidar_time, euler_cur*57.3, state.pos_end, state.vel_end, \
+                             state.bias_g, state.bias_a, state.gravity, feats_undistort->points.size());
         }
+        TRACE_RECORD("vio", omp_get_wtime() - t_vio);
+        return;
+    }
 
-        // 调整ikdtree地图范围
-        /*** Segment the map in lidar FOV ***/
-        #ifndef USE_ikdforest            
-            lasermap_fov_segment();
-        #endif
-        // 点云降采样
-        /*** downsample the feature points in a scan ***/
-        downSizeFilterSurf.setInputCloud(feats_undistort);
-        downSizeFilterSurf.filter(*feats_down_body);
-    #ifdef USE_ikdtree
-        /*** initialize the map kdtree ***/
-        #ifdef USE_ikdforest
-        if (!ikdforest.initialized){
-            if(feats_down_body->points.size() > 5){
-                ikdforest.Build(feats_down_body->points, true, lidar_end_time);
-            }
-            continue;                
-        }
-        int featsFromMapNum = ikdforest.total_size;
-        #else
-        // 初始化ikdtree
-        if(ikdtree.Root_Node == nullptr)
-        {
-            if(feats_down_body->points.size() > 5)
-            {
-                ikdtree.set_downsample_param(filter_size_map_min);
-                ikdtree.Build(feats_down_body->points);
-            }
-            continue;
+    // 子扫描中没有点时只做预测
+    if (!LidarMeasures.is_lidar_end && feats_undistort->empty())
+    {
+        return;
+    }
+
+    // 等待上一帧的地图插入完成，之后ikdtree只在本线程中访问
+    double map_wait_time, map_add_bg_time, map_stale_time;
+    wait_map_incremental(map_wait_time, map_add_bg_time, map_stale_time);
+    if (map_add_bg_time > 0.0)
+    {
+        printf("[ MAP ]: async insert %0.6f s, stale %0.6f s, added latency %0.6f s.\n", map_add_bg_time, map_stale_time, map_wait_time);
+        TRACE_RECORD("map_wait", map_wait_time);
+        TRACE_RECORD("map_stale", map_stale_time);
+    }
+
+    // 按间隔在后台写地图快照，视觉地图分多帧收集
+    if (snapshot_save_en && snapshot_interval > 0)
+    {
+        if (snapshot_last_time == 0.0) snapshot_last_time = LidarMeasures.last_update_time;
+        else if ((snapshot_collecting || LidarMeasures.last_update_time - snapshot_last_time >= snapshot_interval) && save_map_snapshot(false))
+            snapshot_last_time = LidarMeasures.last_update_time;
+    }
+
+    // 调整ikdtree地图范围
+    /*** Segment the map in lidar FOV ***/
+    #ifndef USE_ikdforest            
+        if (!localization_en) lasermap_fov_segment();
+    #endif
+    // 点云降采样
+    /*** downsample the feature points in a scan ***/
+    downSizeFilterSurf.setInputCloud(feats_undistort);
+    downSizeFilterSurf.filter(*feats_down_body);
+#ifdef USE_ikdtree
+    /*** initialize the map kdtree ***/
+    #ifdef USE_ikdforest
+    if (!ikdforest.initialized){
+        if(feats_down_body->points.size() > 5){
+            ikdforest.Build(feats_down_body->points, true, lidar_end_time);
         }
-        int featsFromMapNum = ikdtree.size();
-        #endif
+        return;                
+    }
+    int featsFromMapNum = ikdforest.total_size;
     #else
-        if(featsFromMap->points.empty())
-        {
-            downSizeFilterMap.setInputCloud(feats_down_body);
-        }
-        else
+    // 初始化ikdtree，定位模式下地图已加载
+    if(!localization_en && ikdtree.Root_Node == nullptr)
+    {
+        if(feats_down_body->points.size() > 5)
         {
-            downSizeFilterMap.setInputCloud(featsFromMap);
+            ikdtree.set_downsample_param(filter_size_map_min);
+            ikdtree.Build(feats_down_body->points);
+            if (map_pub_en) map_delta.insert(feats_down_body->points);
+            if (snapshot_save_en) snapshot_map.insert(feats_down_body->points);
         }
-        downSizeFilterMap.filter(*featsFromMap);
-        int featsFromMapNum = featsFromMap->points.size();
+        return;
+    }
+    int featsFromMapNum = localization_en ? int(static_map.size()) : ikdtree.size();
     #endif
-        feats_down_size = feats_down_body->points.size();
-        cout<<"[ LIO ]: Raw feature num: "<<feats_undistort->points.size()<<" downsamp num "<<feats_down_size<<" Map num: "<<featsFromMapNum<< "." << endl;
-
-        /*** ICP and iterated Kalman filter update ***/
-        normvec->resize(feats_down_size);
-        feats_down_world->resize(feats_down_size);
-        //vector<double> res_last(feats_down_size, 1000.0); // initial //
-        res_last.resize(feats_down_size, 1000.0);
-        
-        t1 = omp_get_wtime();
-        if (lidar_en)
-        {
-            euler_cur = RotMtoEuler(state.rot_end);
-            #ifdef USE_IKFOM
-            //state_ikfom fout_state = kf.get_x();
-            fout_pre << setw(20) << LidarMeasures.last_update_time - first_lidar_time << " " << euler_cur.transpose()*57.3 << " " << state_point.pos.transpose() << " " << state_point.vel.transpose() \
-            <<" "<<state_point.bg.transpose()<<" "<<state_point.ba.transpose()<<" "<<state_point.grav<< endl;
-            #else
-            fout_pre << setw(20) << LidarMeasures.last_update_time  - first_lidar_time << " " << euler_cur.transpose()*57.3 << " " << state.pos_end.transpose() << " " << state.vel_end.transpose() \
-            <<" "<<state.bias_g.transpose()<<" "<<state.bias_a.transpose()<<" "<<state.gravity.transpose()<< endl;
-            #endif
-        }
+#else
+    if(featsFromMap->points.empty())
+    {
+        downSizeFilterMap.setInputCloud(feats_down_body);
+    }
+    else
+    {
+        downSizeFilterMap.setInputCloud(featsFromMap);
+    }
+    downSizeFilterMap.filter(*featsFromMap);
+    int featsFromMapNum = featsFromMap->points.size();
+#endif
+    feats_down_size = feats_down_body->points.size();
+    cout<<"[ LIO ]: Raw feature num: "<<feats_undistort->points.size()<<" downsamp num "<<feats_down_size<<" Map num: "<<featsFromMapNum<< "." << endl;
+
+    /*** ICP and iterated Kalman filter update ***/
+    normvec->resize(feats_down_size);
+    feats_down_world->resize(feats_down_size);
+    //vector<double> res_last(feats_down_size, 1000.0); // initial //
+    res_last.resize(feats_down_size, 1000.0);
+    
+    t1 = omp_get_wtime();
+    if (lidar_en)
+    {
+        euler_cur = RotMtoEuler(state.rot_end);
+        #ifdef USE_IKFOM
+        //state_ikfom fout_state = kf.get_x();
+        p_log->log_state(LOG_STATE_PRE, LidarMeasures.last_update_time - first_lidar_time, euler_cur*57.3, state_point.pos, state_point.vel, \
+                         state_point.bg, state_point.ba, state_point.grav.get_vect());
+        #else
+        p_log->log_state(LOG_STATE_PRE, LidarMeasures.last_update_time - first_lidar_time, euler_cur*57.3, state.pos_end, state.vel_end, \
+                         state.bias_g, state.bias_a, state.gravity);
+        #endif
+    }
 
-    #ifdef USE_ikdtree
-        if(0)
-        {
-            PointVector ().swap(ikdtree.PCL_Storage);
-            ikdtree.flatten(ikdtree.Root_Node, ikdtree.PCL_Storage, NOT_RECORD);
-            featsFromMap->clear();
-            featsFromMap->points = ikdtree.PCL_Storage;
-        }
-    #else
-        kdtreeSurfFromMap->setInputCloud(featsFromMap);
-    #endif
+#ifdef USE_ikdtree
+    if(0)
+    {
+        PointVector ().swap(ikdtree.PCL_Storage);
+        ikdtree.flatten(ikdtree.Root_Node, ikdtree.PCL_Storage, NOT_RECORD);
+        featsFromMap->clear();
+        featsFromMap->points = ikdtree.PCL_Storage;
+    }
+#else
+    kdtreeSurfFromMap->setInputCloud(featsFromMap);
+#endif
 
-        point_selected_surf.resize(feats_down_size, true);
-        pointSearchInd_surf.resize(feats_down_size);
-        Nearest_Points.resize(feats_down_size);
-        int  rematch_num = 0;
-        bool nearest_search_en = true; //
+    point_selected_surf.resize(feats_down_size, true);
+    pointSearchInd_surf.resize(feats_down_size);
+    Nearest_Points.resize(feats_down_size);
+    int  rematch_num = 0;
+    bool nearest_search_en = true; //
 
-        t2 = omp_get_wtime();
-        
-        /*** iterated state estimation ***/
-        #ifdef MP_EN
-        printf("[ LIO ]: Using multi-processor, used core number: %d.\n", MP_PROC_NUM);
-        #endif
-        double t_update_start = omp_get_wtime();
-        #ifdef USE_IKFOM
-        double solve_H_time = 0;
-        kf.update_iterated_dyn_share_modified(LASER_POINT_COV, solve_H_time);
-        //state_ikfom updated_state = kf.get_x();
-        state_point = kf.get_x();
-        //euler_cur = RotMtoEuler(state_point.rot.toRotationMatrix());
-        euler_cur = SO3ToEuler(state_point.rot);
-        pos_lid = state_point.pos + state_point.rot * state_point.offset_T_L_I;
-        // cout<<"position: "<<pos_lid.transpose()<<endl;
-        geoQuat.x = state_point.rot.coeffs()[0];
-        geoQuat.y = state_point.rot.coeffs()[1];
-        geoQuat.z = state_point.rot.coeffs()[2];
-        geoQuat.w = state_point.rot.coeffs()[3];
-        #else
+    t2 = omp_get_wtime();
+    
+    /*** iterated state estimation ***/
+    #ifdef MP_EN
+    printf("[ LIO ]: Using multi-processor, used core number: %d.\n", MP_PROC_NUM);
+    #endif
+    double t_update_start = omp_get_wtime();
+    #ifdef USE_IKFOM
+    double solve_H_time = 0;
+    kf.update_iterated_dyn_share_modified(LASER_POINT_COV, solve_H_time);
+    //state_ikfom updated_state = kf.get_x();
+    state_point = kf.get_x();
+    //euler_cur = RotMtoEuler(state_point.rot.toRotationMatrix());
+    euler_cur = SO3ToEuler(state_point.rot);
+    pos_lid = state_point.pos + state_point.rot * state_point.offset_T_L_I;
+    // cout<<"position: "<<pos_lid.transpose()<<endl;
+    geoQuat.x = state_point.rot.coeffs()[0];
+    geoQuat.y = state_point.rot.coeffs()[1];
+    geoQuat.z = state_point.rot.coeffs()[2];
+    geoQuat.w = state_point.rot.coeffs()[3];
+    #else
 
-        if(img_en)
-        {
-            omp_set_num_threads(MP_PROC_NUM);
-            #pragma omp parallel for
-            for(int i=0;i<1;i++) {}
-        }
+    if(img_en)
+    {
+        omp_set_num_threads(MP_PROC_NUM);
+        #pragma omp parallel for
+        for(int i=0;i<1;i++) {}
+    }
 
-        if(lidar_en)
+    if(lidar_en)
+    {
+        for (iterCount = -1; iterCount < NUM_MAX_ITERATIONS && flg_EKF_inited; iterCount++) 
         {
-            for (iterCount = -1; iterCount < NUM_MAX_ITERATIONS && flg_EKF_inited; iterCount++) 
+            match_start = omp_get_wtime();
+            PointCloudXYZI ().swap(*laserCloudOri);
+            PointCloudXYZI ().swap(*corr_normvect);
+            // laserCloudOri->clear(); 
+            // corr_normvect->clear(); 
+            total_residual = 0.0; 
+
+            /** closest surface search and residual computation **/
+            #ifdef MP_EN
+                omp_set_num_threads(MP_PROC_NUM);
+                #pragma omp parallel for
+            #endif
+            // normvec->resize(feats_down_size);
+            for (int i = 0; i < feats_down_size; i++)
             {
-                match_start = omp_get_wtime();
-                PointCloudXYZI ().swap(*laserCloudOri);
-                PointCloudXYZI ().swap(*corr_normvect);
-                // laserCloudOri->clear(); 
-                // corr_normvect->clear(); 
-                total_residual = 0.0; 
-
-                /** closest surface search and residual computation **/
-                #ifdef MP_EN
-                    omp_set_num_threads(MP_PROC_NUM);
-                    #pragma omp parallel for
+                PointType &point_body  = feats_down_body->points[i];
+                PointType &point_world = feats_down_world->points[i];
+                V3D p_body(point_body.x, point_body.y, point_body.z);
+                /* transform to world frame */
+                pointBodyToWorld(&point_body, &point_world);
+                vector<float> pointSearchSqDis(NUM_MATCH_POINTS);
+                #ifdef USE_ikdtree
+                    auto &points_near = Nearest_Points[i];
+                #else
+                    auto &points_near = pointSearchInd_surf[i];
                 #endif
-                // normvec->resize(feats_down_size);
-                for (int i = 0; i < feats_down_size; i++)
+                uint8_t search_flag = 0;  
+                double search_start = omp_get_wtime();
+                if (nearest_search_en)
                 {
-                    PointType &point_body  = feats_down_body->points[i];
-                    PointType &point_world = feats_down_world->points[i];
-                    V3D p_body(point_body.x, point_body.y, point_body.z);
-                    /* transform to world frame */
-                    pointBodyToWorld(&point_body, &point_world);
-                    vector<float> pointSearchSqDis(NUM_MATCH_POINTS);
+                    /** Find the closest surfaces in the map **/
                     #ifdef USE_ikdtree
-                        auto &points_near = Nearest_Points[i];
-                    #else
-                        auto &points_near = pointSearchInd_surf[i];
-                    #endif
-                    uint8_t search_flag = 0;  
-                    double search_start = omp_get_wtime();
-                    if (nearest_search_en)
-                    {
-                        /** Find the closest surfaces in the map **/
-                        #ifdef USE_ikdtree
-                            #ifdef USE_ikdforest
-                                search_flag = ikdforest.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis, first_lidar_time, 5);
-                            #else
-                                ikdtree.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
-                            #endif
+                        #ifdef USE_ikdforest
+                            search_flag = ikdforest.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis, first_lidar_time, 5);
                         #else
-                            kdtreeSurfFromMap->nearestKSearch(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
+                            if (localization_en) static_map.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
+                            else ikdtree.Nearest_Search(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
                         #endif
+                    #else
+                        kdtreeSurfFromMap->nearestKSearch(point_world, NUM_MATCH_POINTS, points_near, pointSearchSqDis);
+                    #endif
 
-                        point_selected_surf[i] = pointSearchSqDis[NUM_MATCH_POINTS - 1] > 5 ? false : true;
+                    point_selected_surf[i] = pointSearchSqDis[NUM_MATCH_POINTS - 1] > 5 ? false : true;
 
-                        #ifdef USE_ikdforest
-                            point_selected_surf[i] = point_selected_surf[i] && (search_flag == 0);
-                        #endif
-                        kdtree_search_time += omp_get_wtime() - search_start;
-                        kdtree_search_counter ++;                        
-                    }
+                    #ifdef USE_ikdforest
+                        point_selected_surf[i] = point_selected_surf[i] && (search_flag == 0);
+                    #endif
+                    kdtree_search_time += omp_get_wtime() - search_start;
+                    kdtree_search_counter ++;                        
+                }
 
 
-                    // if (!point_selected_surf[i]) continue;
+                // if (!point_selected_surf[i]) continue;
 
 
-                    // Debug
-                    // if (points_near.size()<5) {
-                    //     printf("\nERROR: Return Points is less than 5\n\n");
-                    //     printf("Target Point is: (%0.3f,%0.3f,%0.3f)\n",point_world.x,point_world.y,point_world.z);
-                    // }
-                    if (!point_selected_surf[i] || points_near.size() < NUM_MATCH_POINTS) continue;
+                // Debug
+                // if (points_near.size()<5) {
+                //     printf("\nERROR: Return Points is less than 5\n\n");
+                //     printf("Target Point is: (%0.3f,%0.3f,%0.3f)\n",point_world.x,point_world.y,point_world.z);
+                // }
+                if (!point_selected_surf[i] || points_near.size() < NUM_MATCH_POINTS) continue;
 
-                    // 从 kdtree 中找5个当前点的最近邻点，用于拟合平面
-                    VF(4) pabcd;
-                    point_selected_surf[i] = false;
-                    if (esti_plane(pabcd, points_near, 0.1f)) //(planeValid)
-                    {
-                        // 计算当前点到平面的距离
-                        float pd2 = pabcd(0) * point_world.x + pabcd(1) * point_world.y + pabcd(2) * point_world.z + pabcd(3);
-                        // 计算评分，要求点面距离足够小，以及点在雷达系下的测距距离足够大
-                        float s = 1 - 0.9 * fabs(pd2) / sqrt(p_body.norm());
-
-                        // 满足条件则保存该点作为一个残差
-                        if (s > 0.9)
-                        {
-                            point_selected_surf[i] = true;
-                            normvec->points[i].x = pabcd(0);
-                            normvec->points[i].y = pabcd(1);
-                            normvec->points[i].z = pabcd(2);
-                            normvec->points[i].intensity = pd2;
-                            res_last[i] = abs(pd2);
-                        }
-                    }
-                }
-                // cout<<"pca time test: "<<pca_time1<<" "<<pca_time2<<endl;
-                effct_feat_num = 0;
-                laserCloudOri->resize(feats_down_size);
-                corr_normvect->reserve(feats_down_size);
-                for (int i = 0; i < feats_down_size; i++)
+                // 从 kdtree 中找5个当前点的最近邻点，用于拟合平面
+                VF(4) pabcd;
+                point_selected_surf[i] = false;
+                if (esti_plane(pabcd, points_near, 0.1f)) //(planeValid)
                 {
-                    if (point_selected_surf[i] && (res_last[i] <= 2.0))
+                    // 计算当前点到平面的距离
+                    float pd2 = pabcd(0) * point_world.x + pabcd(1) * point_world.y + pabcd(2) * point_world.z + pabcd(3);
+                    // 计算评分，要求点面距离足够小，以及点在雷达系下的测距距离足够大
+                    float s = 1 - 0.9 * fabs(pd2) / sqrt(p_body.norm());
+
+                    // 满足条件则保存该点作为一个残差
+                    if (s > 0.9)
                     {
-                        laserCloudOri->points[effct_feat_num] = feats_down_body->points[i];
-                        corr_normvect->points[effct_feat_num] = normvec->points[i];
-                        total_residual += res_last[i];
-                        effct_feat_num ++;
+                        point_selected_surf[i] = true;
+                        normvec->points[i].x = pabcd(0);
+                        normvec->points[i].y = pabcd(1);
+                        normvec->points[i].z = pabcd(2);
+                        normvec->points[i].intensity = pd2;
+                        res_last[i] = abs(pd2);
                     }
                 }
-
-                res_mean_last = total_residual / effct_feat_num;
-                // cout << "[ mapping ]: Effective feature num: "<<effct_feat_num<<" res_mean_last "<<res_mean_last<<endl;
-                match_time  += omp_get_wtime() - match_start;
-                solve_start  = omp_get_wtime();
-                
-                // 计算测量雅克比矩阵H
-                /*** Computation of Measuremnt Jacobian matrix H and measurents vector ***/
-                MatrixXd Hsub(effct_feat_num, 6);
-                VectorXd meas_vec(effct_feat_num);
-
-                for (int i = 0; i < effct_feat_num; i++)
+            }
+            // cout<<"pca time test: "<<pca_time1<<" "<<pca_time2<<endl;
+            effct_feat_num = 0;
+            laserCloudOri->resize(feats_down_size);
+            corr_normvect->reserve(feats_down_size);
+            for (int i = 0; i < feats_down_size; i++)
+            {
+                if (point_selected_surf[i] && (res_last[i] <= 2.0))
                 {
-                    const PointType &laser_p  = laserCloudOri->points[i];
-                    V3D point_this(laser_p.x, laser_p.y, laser_p.z);
-                    point_this = Lidar_rot_to_IMU*point_this + Lidar_offset_to_IMU;
-                    M3D point_crossmat;
-                    point_crossmat<<SKEW_SYM_MATRX(point_this);
-
-                    /*** get the normal vector of closest surface/corner ***/
-                    const PointType &norm_p = corr_normvect->points[i];
-                    //! H(p) = n^T
-                    V3D norm_vec(norm_p.x, norm_p.y, norm_p.z);
-
-                    //! H(R) = -n^T * Rp^
-                    /*** calculate the Measuremnt Jacobian matrix H ***/
-                    //! 这里用的用推导形式的转置
-                    V3D A(point_crossmat * state.rot_end.transpose() * norm_vec);
-                    Hsub.row(i) << VEC_FROM_ARRAY(A), norm_p.x, norm_p.y, norm_p.z;
-
-                    /*** Measuremnt: distance to the closest surface/corner ***/
-                    //! 这里用的是负值，所以后面在计算增量δx时，用的是Kz而非推导中的-Kz
-                    meas_vec(i) = - norm_p.intensity;
+                    laserCloudOri->points[effct_feat_num] = feats_down_body->points[i];
+                    corr_normvect->points[effct_feat_num] = normvec->points[i];
+                    total_residual += res_last[i];
+                    effct_feat_num ++;
                 }
-                solve_const_H_time += omp_get_wtime() - solve_start;
+            }
 
-                MatrixXd K(DIM_STATE, effct_feat_num);
+            res_mean_last = total_residual / effct_feat_num;
+            // cout << "[ mapping ]: Effective feature num: "<<effct_feat_num<<" res_mean_last "<<res_mean_last<<endl;
+            match_time  += omp_get_wtime() - match_start;
+            TRACE_RECORD("lio_match", omp_get_wtime() - match_start);
+            solve_start  = omp_get_wtime();
+            
+            // 计算测量雅克比矩阵H
+            /*** Computation of Measuremnt Jacobian matrix H and measurents vector ***/
+            MatrixXd Hsub(effct_feat_num, 6);
+            VectorXd meas_vec(effct_feat_num);
+
+            for (int i = 0; i < effct_feat_num; i++)
+            {
+                const PointType &laser_p  = laserCloudOri->points[i];
+                V3D point_this(laser_p.x, laser_p.y, laser_p.z);
+                point_this = Lidar_rot_to_IMU*point_this + Lidar_offset_to_IMU;
+                M3D point_crossmat;
+                point_crossmat<<SKEW_SYM_MATRX(point_this);
+
+                /*** get the normal vector of closest surface/corner ***/
+                const PointType &norm_p = corr_normvect->points[i];
+                //! H(p) = n^T
+                V3D norm_vec(norm_p.x, norm_p.y, norm_p.z);
+
+                //! H(R) = -n^T * Rp^
+                /*** calculate the Measuremnt Jacobian matrix H ***/
+                //! 这里用的用推导形式的转置
+                V3D A(point_crossmat * state.rot_end.transpose() * norm_vec);
+                Hsub.row(i) << VEC_FROM_ARRAY(A), norm_p.x, norm_p.y, norm_p.z;
+
+                /*** Measuremnt: distance to the closest surface/corner ***/
+                //! 这里用的是负值，所以后面在计算增量δx时，用的是Kz而非推导中的-Kz
+                meas_vec(i) = - norm_p.intensity;
+            }
+            solve_const_H_time += omp_get_wtime() - solve_start;
+
+            MatrixXd K(DIM_STATE, effct_feat_num);
 
-                EKF_stop_flg = false;
-                flg_EKF_converged = false;
-                
-                /*** Iterative Kalman Filter Update ***/
-                if (!flg_EKF_inited)
+            EKF_stop_flg = false;
+            flg_EKF_converged = false;
+            
+            /*** Iterative Kalman Filter Update ***/
+            if (!flg_EKF_inited)
+            {
+                cout<<"||||||||||Initiallizing LiDar||||||||||"<<endl;
+                /*** only run in initialization period ***/
+                MatrixXd H_init(MD(9, DIM_STATE)::Zero());
+                MatrixXd z_init(VD(9)::Zero());
+                H_init.block<3,3>(0,0)  = M3D::Identity();
+                H_init.block<3,3>(3,3)  = M3D::Identity();
+                H_init.block<3,3>(6,15) = M3D::Identity();
+                //! 用的 -z
+                z_init.block<3,1>(0,0)  = - Log(state.rot_end);
+                z_init.block<3,1>(0,0)  = - state.pos_end;
+
+                auto H_init_T = H_init.transpose();
+                //! K = PH^T·(HPH^T + R)^-1
+                auto &&K_init = state.cov * H_init_T * (H_init * state.cov * H_init_T + \
+                                0.0001 * MD(9, 9)::Identity()).inverse();
+                //! delta x = K(z - Hx)
+                solution      = K_init * z_init;
+
+                // solution.block<9,1>(0,0).setZero();
+                // state += solution;
+                // state.cov = (MatrixXd::Identity(DIM_STATE, DIM_STATE) - K_init * H_init) * state.cov;
+
+                //! 上面算的东西其实都没用到，这里直接将状态量重置
+                state.resetpose();
+                EKF_stop_flg = true;
+            }
+            else
+            {
+                // 和视觉部分的滤波器类似
+                auto &&Hsub_T = Hsub.transpose();
+                auto &&HTz = Hsub_T * meas_vec;
+                H_T_H.block<6,6>(0,0) = Hsub_T * Hsub;
+                // EigenSolver<Matrix<double, 6, 6>> es(H_T_H.block<6,6>(0,0));
+                MD(DIM_STATE, DIM_STATE) &&K_1 = \
+                        (H_T_H + (state.cov / LASER_POINT_COV).inverse()).inverse();
+                G.block<DIM_STATE,6>(0,0) = K_1.block<DIM_STATE,6>(0,0) * H_T_H.block<6,6>(0,0);
+                auto vec = state_propagat - state;
+                solution = K_1.block<DIM_STATE,6>(0,0) * HTz + vec - G.block<DIM_STATE,6>(0,0) * vec.block<6,1>(0,0);
+
+                int minRow, minCol;
+                if(0)//if(V.minCoeff(&minRow, &minCol) < 1.0f)
                 {
-                    cout<<"||||||||||Initiallizing LiDar||||||||||"<<endl;
-                    /*** only run in initialization period ***/
-                    MatrixXd H_init(MD(9, DIM_STATE)::Zero());
-                    MatrixXd z_init(VD(9)::Zero());
-                    H_init.block<3,3>(0,0)  = M3D::Identity();
-                    H_init.block<3,3>(3,3)  = M3D::Identity();
-                    H_init.block<3,3>(6,15) = M3D::Identity();
-                    //! 用的 -z
-                    z_init.block<3,1>(0,0)  = - Log(state.rot_end);
-                    z_init.block<3,1>(0,0)  = - state.pos_end;
-
-                    auto H_init_T = H_init.transpose();
-                    //! K = PH^T·(HPH^T + R)^-1
-                    auto &&K_init = state.cov * H_init_T * (H_init * state.cov * H_init_T + \
-                                    0.0001 * MD(9, 9)::Identity()).inverse();
-                    //! delta x = K(z - Hx)
-                    solution      = K_init * z_init;
-
-                    // solution.block<9,1>(0,0).setZero();
-                    // state += solution;
-                    // state.cov = (MatrixXd::Identity(DIM_STATE, DIM_STATE) - K_init * H_init) * state.cov;
-
-                    //! 上面算的东西其实都没用到，这里直接将状态量重置
-                    state.resetpose();
+                    VD(6) V = H_T_H.block<6,6>(0,0).eigenvalues().real();
+                    cout<<"!!!!!! Degeneration Happend, eigen values: "<<V.transpose()<<endl;
                     EKF_stop_flg = true;
+                    solution.block<6,1>(9,0).setZero();
                 }
-                else
-                {
-                    // 和视觉部分的滤波器类似
-                    auto &&Hsub_T = Hsub.transpose();
-                    auto &&HTz = Hsub_T * meas_vec;
-                    H_T_H.block<6,6>(0,0) = Hsub_T * Hsub;
-                    // EigenSolver<Matrix<double, 6, 6>> es(H_T_H.block<6,6>(0,0));
-                    MD(DIM_STATE, DIM_STATE) &&K_1 = \
-                            (H_T_H + (state.cov / LASER_POINT_COV).inverse()).inverse();
-                    G.block<DIM_STATE,6>(0,0) = K_1.block<DIM_STATE,6>(0,0) * H_T_H.block<6,6>(0,0);
-                    auto vec = state_propagat - state;
-                    solution = K_1.block<DIM_STATE,6>(0,0) * HTz + vec - G.block<DIM_STATE,6>(0,0) * vec.block<6,1>(0,0);
-
-                    int minRow, minCol;
-                    if(0)//if(V.minCoeff(&minRow, &minCol) < 1.0f)
-                    {
-                        VD(6) V = H_T_H.block<6,6>(0,0).eigenvalues().real();
-                        cout<<"!!!!!! Degeneration Happend, eigen values: "<<V.transpose()<<endl;
-                        EKF_stop_flg = true;
-                        solution.block<6,1>(9,0).setZero();
-                    }
 
-                    state += solution;
+                state += solution;
 
-                    rot_add = solution.block<3,1>(0,0);
-                    t_add   = solution.block<3,1>(3,0);
+                rot_add = solution.block<3,1>(0,0);
+                t_add   = solution.block<3,1>(3,0);
 
-                    if ((rot_add.norm() * 57.3 < 0.01) && (t_add.norm() * 100 < 0.015))
-                    {
-                        flg_EKF_converged = true;
-                    }
-
-                    deltaR = rot_add.norm() * 57.3;
-                    deltaT = t_add.norm() * 100;
-                }
-                euler_cur = RotMtoEuler(state.rot_end);
-                
-
-                // 当滤波器收敛时，重新搜索近邻点来拟合平面
-                /*** Rematch Judgement ***/
-                nearest_search_en = false;
-                if (flg_EKF_converged || ((rematch_num == 0) && (iterCount == (NUM_MAX_ITERATIONS - 2))))
+                if ((rot_add.norm() * 57.3 < 0.01) && (t_add.norm() * 100 < 0.015))
                 {
-                    nearest_search_en = true;
-                    rematch_num ++;
+                    flg_EKF_converged = true;
                 }
 
-                /*** Convergence Judgements and Covariance Update ***/
-                if (!EKF_stop_flg && (rematch_num >= 2 || (iterCount == NUM_MAX_ITERATIONS - 1)))
+                deltaR = rot_add.norm() * 57.3;
+                deltaT = t_add.norm() * 100;
+            }
+            euler_cur = RotMtoEuler(state.rot_end);
+            
+
+            // 当滤波器收敛时，重新搜索近邻点来拟合平面
+            /*** Rematch Judgement ***/
+            nearest_search_en = false;
+            if (flg_EKF_converged || ((rematch_num == 0) && (iterCount == (NUM_MAX_ITERATIONS - 2))))
+            {
+                nearest_search_en = true;
+                rematch_num ++;
+            }
+
+            /*** Convergence Judgements and Covariance Update ***/
+            if (!EKF_stop_flg && (rematch_num >= 2 || (iterCount == NUM_MAX_ITERATIONS - 1)))
+            {
+                if (flg_EKF_inited)
                 {
-                    if (flg_EKF_inited)
-                    {
-                        // 更新协方差
-                        /*** Covariance Update ***/
-                        // G.setZero();
-                        // G.block<DIM_STATE,6>(0,0) = K * Hsub;
-                        state.cov = (I_STATE - G) * state.cov;
-                        total_distance += (state.pos_end - position_last).norm();
-                        position_last = state.pos_end;
-                        geoQuat = tf::createQuaternionMsgFromRollPitchYaw
-                                    (euler_cur(0), euler_cur(1), euler_cur(2));
-
-                        VD(DIM_STATE) K_sum  = K.rowwise().sum();
-                        VD(DIM_STATE) P_diag = state.cov.diagonal();
-                        // cout<<"K: "<<K_sum.transpose()<<endl;
-                        // cout<<"P: "<<P_diag.transpose()<<endl;
-                        // cout<<"position: "<<state.pos_end.transpose()<<" total distance: "<<total_distance<<endl;
-                    }
-                    EKF_stop_flg = true;
+                    // 更新协方差
+                    /*** Covariance Update ***/
+                    // G.setZero();
+                    // G.block<DIM_STATE,6>(0,0) = K * Hsub;
+                    state.cov = (I_STATE - G) * state.cov;
+                    total_distance += (state.pos_end - position_last).norm();
+                    position_last = state.pos_end;
+                    geoQuat = tf::createQuaternionMsgFromRollPitchYaw
+                                (euler_cur(0), euler_cur(1), euler_cur(2));
+
+                    VD(DIM_STATE) K_sum  = K.rowwise().sum();
+                    VD(DIM_STATE) P_diag = state.cov.diagonal();
+                    // cout<<"K: "<<K_sum.transpose()<<endl;
+                    // cout<<"P: "<<P_diag.transpose()<<endl;
+                    // cout<<"position: "<<state.pos_end.transpose()<<" total distance: "<<total_distance<<endl;
                 }
-                solve_time += omp_get_wtime() - solve_start;
-
-                if (EKF_stop_flg)   break;
+                EKF_stop_flg = true;
             }
-        }
-        
-        // cout<<"[ mapping ]: iteration count: "<<iterCount+1<<endl;
-        #endif
+            solve_time += omp_get_wtime() - solve_start;
+            TRACE_RECORD("lio_solve", omp_get_wtime() - solve_start);
 
-        if(pose_output_en)
-        {
-            SE3 T_cam_world = lidar_selector->new_frame_->T_f_w_;
-            Eigen::Vector3d t = T_cam_world.translation();  
-            Eigen::Quaterniond q(T_cam_world.rotation_matrix()); 
-            fout_tum << std::fixed << std::setprecision(6)
-                    << LidarMeasures.lidar_beg_time << " "
-                    << t.x() << " " << t.y() << " " << t.z() << " "
-                    << q.x() << " " << q.y() << " " << q.z() << " " << q.w()
-                    << std::endl;
+            if (EKF_stop_flg)   break;
         }
-        // SaveTrajTUM(LidarMeasures.lidar_beg_time, state.rot_end, state.pos_end);
-        double t_update_end = omp_get_wtime();
-        /******* Publish odometry *******/
-        euler_cur = RotMtoEuler(state.rot_end);
-        geoQuat = tf::createQuaternionMsgFromRollPitchYaw(euler_cur(0), euler_cur(1), euler_cur(2));
-        publish_odometry(pubOdomAftMapped);
-
-        /*** add the feature points to map kdtree ***/
-        t3 = omp_get_wtime();
-        map_incremental();
-        t5 = omp_get_wtime();
-        kdtree_incremental_time = t5 - t3 + readd_time;
-        /******* Publish points *******/
-
-        PointCloudXYZI::Ptr laserCloudFullRes(dense_map_en ? feats_undistort : feats_down_body);          
-        int size = laserCloudFullRes->points.size();
-        PointCloudXYZI::Ptr laserCloudWorld( new PointCloudXYZI(size, 1));
-
-        // 转到世界坐标系
-        for (int i = 0; i < size; i++)
+    }
+    
+    // cout<<"[ mapping ]: iteration count: "<<iterCount+1<<endl;
+    #endif
+
+    if(pose_output_en)
+    {
+        SE3 T_cam_world = lidar_selector->new_frame_->T_f_w_;
+        Eigen::Vector3d t = T_cam_world.translation();  
+        Eigen::Quaterniond q(T_cam_world.rotation_matrix()); 
+        p_log->log_pose(LidarMeasures.lidar_beg_time, t, q);
+    }
+    // SaveTrajTUM(LidarMeasures.lidar_beg_time, state.rot_end, state.pos_end);
+    double t_update_end = omp_get_wtime();
+    /******* Publish odometry *******/
+    euler_cur = RotMtoEuler(state.rot_end);
+    geoQuat = tf::createQuaternionMsgFromRollPitchYaw(euler_cur(0), euler_cur(1), euler_cur(2));
+    publish_odometry(pubOdomAftMapped);
+    // 以更新后的状态作为高频里程计的锚点
+    if (imu_odom_en) p_prop->set_anchor(state, LidarMeasures.last_update_time, p_imu->get_acc_scale());
+
+    /*** add the feature points to map kdtree ***/
+    t3 = omp_get_wtime();
+    if (!localization_en) map_incremental();
+    t5 = omp_get_wtime();
+    kdtree_incremental_time = t5 - t3 + readd_time;
+    /******* Publish points *******/
+
+    PointCloudXYZI::Ptr laserCloudFullRes(dense_map_en ? feats_undistort : feats_down_body);          
+    int size = laserCloudFullRes->points.size();
+    PointCloudXYZI::Ptr laserCloudWorld( new PointCloudXYZI(size, 1));
+
+    // 转到世界坐标系
+    for (int i = 0; i < size; i++)
+    {
+        RGBpointBodyToWorld(&laserCloudFullRes->points[i], \
+                            &laserCloudWorld->points[i]);
+    }
+    // 子扫描模式下先累积整帧点云，扫描结束时再交给VIO和发布
+    if (lio_slice_num > 1)
+    {
+        *pcl_scan_accum += *laserCloudWorld;
+        if (LidarMeasures.is_lidar_end)
         {
-            RGBpointBodyToWorld(&laserCloudFullRes->points[i], \
-                                &laserCloudWorld->points[i]);
+            *pcl_wait_pub = *pcl_scan_accum;
+            pcl_scan_accum->clear();
         }
+    }
+    else
+    {
         *pcl_wait_pub = *laserCloudWorld;
+    }
 
-        // 发布点云以及路径
-        if(!img_en) publish_frame_world(pubLaserCloudFullRes);
-        // publish_visual_world_map(pubVisualCloud);
-        publish_effect_world(pubLaserCloudEffect);
-        // publish_map(pubLaserCloudMap);
-        publish_path(pubPath);
-        #ifdef DEPLOY
-        publish_mavros(mavros_pose_publisher);
-        #endif
+    // 发布点云以及路径
+    if(!img_en && LidarMeasures.is_lidar_end)
+    {
+        PointCloudXYZI::Ptr frame_pub(new PointCloudXYZI(*pcl_wait_pub));
+        push_publish_task([frame_pub]() { publish_frame_world(pubLaserCloudFullRes, frame_pub); }, !pcd_save_en);
+    }
+    // publish_visual_world_map(pubVisualCloud);
+    publish_effect_world(pubLaserCloudEffect);
+    // publish_map(pubLaserCloudMap);
+    if (map_pub_en && LidarMeasures.is_lidar_end && ++map_pub_scans >= max(map_pub_interval, 1))
+    {
+        map_pub_scans = 0;
+        push_publish_task([]() { publish_map_delta(pubMapDelta); }, false);   // 差量在执行时取出并累积，不能丢
+    }
+    publish_path(pubPath);
+    #ifdef DEPLOY
+    publish_mavros(mavros_pose_publisher);
+    #endif
 
-        /*** Debug variables ***/
-        frame_num ++;
-        aver_time_consu = aver_time_consu * (frame_num - 1) / frame_num + (t5 - t0) / frame_num;
-        aver_time_icp = aver_time_icp * (frame_num - 1)/frame_num + (t_update_end - t_update_start) / frame_num;
-        aver_time_match = aver_time_match * (frame_num - 1)/frame_num + (match_time)/frame_num;
+    /*** Debug variables ***/
+    TRACE_RECORD("lio_update", t_update_end - t_update_start);
+    TRACE_RECORD("map_incremental", t5 - t3);
+    TRACE_RECORD("lio_total", t5 - t0);
+    frame_num ++;
+    aver_time_consu = aver_time_consu * (frame_num - 1) / frame_num + (t5 - t0) / frame_num;
+    aver_time_icp = aver_time_icp * (frame_num - 1)/frame_num + (t_update_end - t_update_start) / frame_num;
+    aver_time_match = aver_time_match * (frame_num - 1)/frame_num + (match_time)/frame_num;
+    #ifdef USE_IKFOM
+    aver_time_solve = aver_time_solve * (frame_num - 1)/frame_num + (solve_time + solve_H_time)/frame_num;
+    aver_time_const_H_time = aver_time_const_H_time * (frame_num - 1)/frame_num + solve_time / frame_num;
+    #else
+    aver_time_solve = aver_time_solve * (frame_num - 1)/frame_num + (solve_time)/frame_num;
+    aver_time_const_H_time = aver_time_const_H_time * (frame_num - 1)/frame_num + solve_const_H_time / frame_num;
+    //cout << "construct H:" << aver_time_const_H_time << std::endl;
+    #endif
+    // aver_time_consu = aver_time_consu * 0.9 + (t5 - t0) * 0.1;
+    frame_metrics.push({LidarMeasures.lidar_beg_time, aver_time_consu, kdtree_incremental_time, \
+                        kdtree_search_counter > 0 ? kdtree_search_time / kdtree_search_counter : NAN, double(featsFromMapNum), t5 - t0});
+    // cout<<"[ mapping ]: time: fov_check "<< fov_check_time <<" fov_check and readd: "<<t1-t0<<" match "<<aver_time_match<<" solve "<<aver_time_solve<<" ICP "<<t3-t1<<" map incre "<<t5-t3<<" total "<<aver_time_consu << "icp:" << aver_time_icp << "construct H:" << aver_time_const_H_time <<endl;
+    printf("[ LIO ]: time: fov_check: %0.6f fov_check and readd: %0.6f match: %0.6f solve: %0.6f  ICP: %0.6f  map incre: %0.6f total: %0.6f icp: %0.6f construct H: %0.6f.\n",fov_check_time,t1-t0,aver_time_match,aver_time_solve,t3-t1,t5-t3,aver_time_consu,aver_time_icp, aver_time_const_H_time);
+    if (lidar_en)
+    {
+        euler_cur = RotMtoEuler(state.rot_end);
         #ifdef USE_IKFOM
-        aver_time_solve = aver_time_solve * (frame_num - 1)/frame_num + (solve_time + solve_H_time)/frame_num;
-        aver_time_const_H_time = aver_time_const_H_time * (frame_num - 1)/frame_num + solve_time / frame_num;
+        p_log->log_state(LOG_STATE_OUT, LidarMeasures.last_update_time - first_lidar_time, euler_cur*57.3, state_point.pos, state_point.vel, \
+                         state_point.bg, state_point.ba, state_point.grav.get_vect(), feats_undistort->points.size());
         #else
-        aver_time_solve = aver_time_solve * (frame_num - 1)/frame_num + (solve_time)/frame_num;
-        aver_time_const_H_time = aver_time_const_H_time * (frame_num - 1)/frame_num + solve_const_H_time / frame_num;
-        //cout << "construct H:" << aver_time_const_H_time << std::endl;
+        p_log->log_state(LOG_STATE_OUT, LidarMeasures.last_update_time - first_lidar_time, euler_cur*57.3, state.pos_end, state.vel_end, \
+                         state.bias_g, state.bias_a, state.gravity, feats_undistort->points.size());
         #endif
-        // aver_time_consu = aver_time_consu * 0.9 + (t5 - t0) * 0.1;
-        T1[time_log_counter] = LidarMeasures.lidar_beg_time;
-        s_plot[time_log_counter] = aver_time_consu;
-        s_plot2[time_log_counter] = kdtree_incremental_time;
-        s_plot3[time_log_counter] = kdtree_search_time/kdtree_search_counter;
-        s_plot4[time_log_counter] = featsFromMapNum;
-        s_plot5[time_log_counter] = t5 - t0;
-        time_log_counter ++;
-        // cout<<"[ mapping ]: time: fov_check "<< fov_check_time <<" fov_check and readd: "<<t1-t0<<" match "<<aver_time_match<<" solve "<<aver_time_solve<<" ICP "<<t3-t1<<" map incre "<<t5-t3<<" total "<<aver_time_consu << "icp:" << aver_time_icp << "construct H:" << aver_time_const_H_time <<endl;
-        printf("[ LIO ]: time: fov_check: %0.6f fov_check and readd: %0.6f match: %0.6f solve: %0.6f  ICP: %0.6f  map incre: %0.6f total: %0.6f icp: %0.6f construct H: %0.6f.\n",fov_check_time,t1-t0,aver_time_match,aver_time_solve,t3-t1,t5-t3,aver_time_consu,aver_time_icp, aver_time_const_H_time);
-        if (lidar_en)
-        {
-            euler_cur = RotMtoEuler(state.rot_end);
-            #ifdef USE_IKFOM
-            fout_out << setw(20) << LidarMeasures.last_update_time - first_lidar_time << " " << euler_cur.transpose()*57.3 << " " << state_point.pos.transpose() << " " << state_point.vel.transpose() \
-            <<" "<<state_point.bg.transpose()<<" "<<state_point.ba.transpose()<<" "<<state_point.grav<<" "<<feats_undistort->points.size()<<endl;
-            #else
-            fout_out << setw(20) << LidarMeasures.last_update_time - first_lidar_time << " " << euler_cur.transpose()*57.3 << " " << state.pos_end.transpose() << " " << state.vel_end.transpose() \
-            <<" "<<state.bias_g.transpose()<<" "<<state.bias_a.transpose()<<" "<<state.gravity.transpose()<<" "<<feats_undistort->points.size()<<endl;
-            #endif
-        }
-        // dump_lio_state_to_log(fp);
     }
+    // dump_lio_state_to_log(fp);
+}
+
+/**
+ * @brief 保存地图并关闭输出文件
+ * 
+ */
+void save_and_close()
+{
+    // 等待发布线程处理完剩余任务，pcd_stage 只由发布任务修改
+    stop_publish_worker();
+    if (pub_dropped > 0) printf("[ PUB ]: %lu display tasks dropped in total.\n", (unsigned long)pub_dropped);
+
     //--------------------------save map---------------
     // string surf_filename(map_file_path + "/surf.pcd");
     // string corner_filename(map_file_path + "/corner.pcd");
@@ -1922,30 +2545,315 @@ int main(int argc, char** argv)
     // pcd_writer.writeBinary(corner_filename, corner_points);
     // }
 
-         /**************** save map ****************/
-    /* 1. make sure you have enough memories
-    /* 2. pcd save will largely influence the real-time performences **/
-    if (pcl_wait_save->size() > 0 && pcd_save_en)
+    for (int level = 0; map_pub_en && level < map_delta.levels(); level++)
+        printf("[ MAP ]: lod map level %d, %d voxels.\n", level, int(map_delta.voxels(level)));
+    if (img_en)
+    {
+        // 视觉地图点和特征的对象池：存活数、峰值和 slab 占用的内存
+        const PoolStats point_pool = ObjectPool<lidar_selection::Point>::stats();
+        const PoolStats feature_pool = ObjectPool<lidar_selection::Feature>::stats();
+        printf("[ VIO ]: %lu map points (peak %lu, %lu allocs), %lu features (peak %lu, %lu allocs), pools %.1f MB.\n",
+               (unsigned long)point_pool.in_use, (unsigned long)point_pool.peak, (unsigned long)point_pool.allocs,
+               (unsigned long)feature_pool.in_use, (unsigned long)feature_pool.peak, (unsigned long)feature_pool.allocs,
+               (point_pool.capacity * point_pool.object_size + feature_pool.capacity * feature_pool.object_size) / 1048576.0);
+    }
+
+    /**************** save map ****************/
+    // 交出最后不足 pcd_save_interval 帧的暂存点，等待写盘完成并写出各块的 PCD 和索引
+    if (pcd_save_en)
+    {
+        if (img_en && rgb_voxel_size > 0)
+        {
+            printf("[ MAP ]: fused rgb map, %d voxels of %.3f m.\n", int(rgb_map.size()), rgb_voxel_size);
+            rgb_map.save(tile_writer);
+        }
+        stage_pcd_scan(true);
+        tile_writer.stop();
+    }
+
+    stop_map_worker();
+    if (snapshot_save_en)
+    {
+        snapshot_writer.wait();
+        save_map_snapshot(true);
+        snapshot_writer.wait();
+    }
+    if (frame_metrics.size() > 0)
+    {
+        frame_metrics.print_summary();
+        frame_metrics.dump(DEBUG_FILE_DIR("metrics.txt"));
+    }
+    p_img->stop();
+    p_prop->stop();
+    p_log->stop();
+}
+
+#ifndef OFFLINE_REPLAY
+int main(int argc, char** argv)
+{
+    ros::init(argc, argv, "laserMapping");
+    ros::NodeHandle nh;
+    image_transport::ImageTransport it(nh);
+    readParameters(nh);
+    pcl_wait_pub->clear();
+    // 创建ROS订阅和发布
+    ros::Subscriber sub_pcl = p_pre->lidar_type == AVIA ? \
+        nh.subscribe(lid_topic, 200000, livox_pcl_cbk) : \
+        nh.subscribe(lid_topic, 200000, standard_pcl_cbk);
+    ros::Subscriber sub_imu = nh.subscribe(imu_topic, 200000, imu_cbk);
+    ros::Subscriber sub_img = nh.subscribe(img_topic, 200000, img_cbk);
+    ros::Subscriber sub_trace = nh.subscribe("/trace_dump", 1, trace_dump_cbk);
+    ros::Subscriber sub_metrics = nh.subscribe("/metrics_dump", 1, metrics_dump_cbk);
+    img_pub = it.advertise("/rgb_img", 1);
+    pubLaserCloudFullRes = nh.advertise<sensor_msgs::PointCloud2>
+            ("/cloud_registered", 100);
+    pubVisualCloud = nh.advertise<sensor_msgs::PointCloud2>
+            ("/cloud_visual_map", 100);
+    pubSubVisualCloud = nh.advertise<sensor_msgs::PointCloud2>
+            ("/cloud_visual_sub_map", 100);
+    pubLaserCloudEffect  = nh.advertise<sensor_msgs::PointCloud2>
+            ("/cloud_effected", 100);
+    pubLaserCloudMap = nh.advertise<sensor_msgs::PointCloud2>
+            ("/Laser_map", 100);
+    pubOdomAftMapped = nh.advertise<nav_msgs::Odometry> 
+            ("/aft_mapped_to_init", 10);
+    pubPath          = nh.advertise<nav_msgs::Path> 
+            ("/path", 10);
+    pubRGBMap        = nh.advertise<sensor_msgs::PointCloud2>
+            ("/rgb_map", 10);
+    pubMapDelta      = nh.advertise<fast_livo::MapDelta>
+            ("/map_delta", 10);
+    pubVioStats      = nh.advertise<fast_livo::VioStats>
+            ("/vio_stats", 10);
+
+#ifdef DEPLOY
+    mavros_pose_publisher = nh.advertise<geometry_msgs::PoseStamped>("/mavros/vision_pose/pose", 10);
+#endif
+    
+    path.header.stamp    = ros::Time::now();
+    path.header.frame_id ="camera_init";
+
+    vk::AbstractCamera* cam;
+    if(!vk::camera_loader::loadFromRosNs("laserMapping", cam))
+        throw std::runtime_error("Camera model not correctly specified.");
+    init_estimator(cam);
+    p_img->start(img_frame_cbk);
+    start_publish_worker();
+    // IMU频率的里程计，在独立线程中处理IMU
+    if (imu_odom_en) p_prop->start(nh, imu_topic, "/aft_mapped_to_init_imu");
+
+//------------------------------------------------------------------------------------------------------
+    signal(SIGINT, SigHandle);
+    // 回调（点云预处理、IMU、图像）在spinner线程中执行，与主线程的估计并行
+    ros::AsyncSpinner spinner(3);
+    spinner.start();
+    bool status = ros::ok();
+    while (status)
+    {
+        if (flg_exit) break;
+        // 彩色图和绘制副本只在需要时由预处理线程生成
+        p_img->rgb_en = img_en && (pcd_save_en || pubLaserCloudFullRes.getNumSubscribers() > 0);
+        p_img->canvas_en = img_pub.getNumSubscribers() > 0;
+        // 同步雷达、图像和IMU数据
+        if(!sync_packages(LidarMeasures))
+        {
+            status = ros::ok();
+            // 只有调试时才刷新OpenCV窗口
+            if (debug) cv::waitKey(1);
+            // 等待回调写入新数据，超时后重新检查 ros::ok() 和订阅者数量
+            unique_lock<mutex> lock(mtx_buffer);
+            sig_buffer.wait_for(lock, chrono::milliseconds(50), []{ return buffer_updated || flg_exit; });
+            continue;
+        }
+
+        process_package();
+    }
+
+    spinner.stop();
+    save_and_close();
+    if (Tracer::enabled()) Tracer::print_summary();
+
+    return 0;
+}
+#endif
+
+#ifdef OFFLINE_REPLAY
+/**
+ * @brief 离线回放时的参数读取，接口与 ros::NodeHandle::param 一致
+ *        主配置文件对应全局命名空间，"laserMapping/" 开头的参数对应相机配置文件（launch中加载到私有命名空间）
+ */
+class YamlParam
+{
+public:
+    YamlParam(const string &config_file, const string &camera_file)
+    {
+        if (!fs_cfg.open(config_file, cv::FileStorage::READ))
+            throw std::runtime_error("Failed to open config file " + config_file);
+        if (!fs_cam.open(camera_file, cv::FileStorage::READ))
+            throw std::runtime_error("Failed to open camera file " + camera_file);
+    }
+
+    template<typename T>
+    bool param(const string &name, T &val, const T &def) const
+    {
+        cv::FileNode node = lookup(name);
+        if (node.empty() || node.isNone())
+        {
+            val = def;
+            return false;
+        }
+        read_node(node, val);
+        return true;
+    }
+
+private:
+    // 按 "/" 逐级查找
+    cv::FileNode lookup(const string &name) const
+    {
+        const string cam_ns = "laserMapping/";
+        const bool is_cam = name.compare(0, cam_ns.size(), cam_ns) == 0;
+        cv::FileNode node = is_cam ? fs_cam.root() : fs_cfg.root();
+        size_t beg = is_cam ? cam_ns.size() : 0;
+        while (true)
+        {
+            size_t pos = name.find('/', beg);
+            node = node[name.substr(beg, pos - beg)];
+            if (node.empty() || pos == string::npos) break;
+            beg = pos + 1;
+        }
+        return node;
+    }
+
+    // yaml中未加引号的 true/false 按字符串读入
+    static void read_node(const cv::FileNode &node, bool &val)
     {
-        string file_name = string("rgb_scan_all.pcd");
-        string all_points_dir(string(string(ROOT_DIR) + "PCD/") + file_name);
-        pcl::PCDWriter pcd_writer;
-        cout << "current rgb scan saved" << endl;
-        pcd_writer.writeBinary(all_points_dir, *pcl_wait_save);
+        if (node.isString()) val = (string)node == "true";
+        else                 val = (int)node != 0;
     }
+    static void read_node(const cv::FileNode &node, string &val)
+    {
+        val = (string)node;
+    }
+    static void read_node(const cv::FileNode &node, vector<double> &val)
+    {
+        val.clear();
+        for (cv::FileNodeIterator it = node.begin(); it != node.end(); ++it)
+            val.push_back((double)*it);
+    }
+    template<typename T>
+    static void read_node(const cv::FileNode &node, T &val)
+    {
+        val = (T)(double)node;
+    }
+
+    cv::FileStorage fs_cfg, fs_cam;
+};
+
+/**
+ * @brief 离线回放：不连接ROS master，按bag中的顺序直接调用回调并尽快处理，结束时输出吞吐量和各阶段耗时分位数
+ *        用法：fastlivo_replay <config.yaml> <camera.yaml> <bag>
+ */
+int main(int argc, char** argv)
+{
+    if (argc < 4)
+    {
+        printf("Usage: fastlivo_replay <config.yaml> <camera.yaml> <bag>\n");
+        return 1;
+    }
+    ros::Time::init();
+    YamlParam nh(argv[1], argv[2]);
+    readParameters(nh);
+    publish_en = false;
+    imu_odom_en = false;
+    pcl_wait_pub->clear();
+
+    // 相机模型，目前只支持 Pinhole
+    string cam_model;
+    int cam_width, cam_height;
+    nh.param<string>("laserMapping/cam_model", cam_model, "Pinhole");
+    nh.param<int>("laserMapping/cam_width", cam_width, 640);
+    nh.param<int>("laserMapping/cam_height", cam_height, 512);
+    if (cam_model != "Pinhole")
+        throw std::runtime_error("Camera model not correctly specified.");
+    vk::AbstractCamera* cam = new vk::PinholeCamera(cam_width, cam_height, cam_fx, cam_fy, cam_cx, cam_cy,
+                                                    cam_d0, cam_d1, cam_d2, cam_d3);
+    init_estimator(cam);
+    // 回放总是记录各阶段耗时
+    Tracer::set_enabled(true);
+    // 不启动图像预处理线程，图像在回放线程中同步处理，保证结果可复现
+    p_img->rgb_en = img_en && pcd_save_en;
+    p_img->canvas_en = false;
+
+    rosbag::Bag bag;
+    bag.open(argv[3], rosbag::bagmode::Read);
+    vector<string> topics{lid_topic, imu_topic, img_topic, img_topic + "/compressed"};
+    rosbag::View view(bag, rosbag::TopicQuery(topics));
 
-    if (pcl_wait_save_lidar->size() > 0 && pcd_save_en)
+    signal(SIGINT, SigHandle);
+    int scan_num = 0, img_num = 0;
+    double bag_beg = -1.0, bag_end = 0.0;
+    const double wall_beg = omp_get_wtime();
+    for (const rosbag::MessageInstance &m : view)
     {
-        string file_name = string("intensity_sacn_all.pcd");
-        string all_points_dir(string(string(ROOT_DIR) + "PCD/") + file_name);
-        pcl::PCDWriter pcd_writer;
-        cout << "current intensity scan saved" << endl;
-        pcd_writer.writeBinary(all_points_dir, *pcl_wait_save_lidar);
+        if (flg_exit) break;
+        bag_end = m.getTime().toSec();
+        if (bag_beg < 0) bag_beg = bag_end;
+
+        double t_cb = omp_get_wtime();
+        const string &topic = m.getTopic();
+        if (topic == lid_topic)
+        {
+            if (p_pre->lidar_type == AVIA)
+            {
+                livox_ros_driver::CustomMsg::ConstPtr msg = m.instantiate<livox_ros_driver::CustomMsg>();
+                if (msg) livox_pcl_cbk(msg);
+            }
+            else
+            {
+                sensor_msgs::PointCloud2::ConstPtr msg = m.instantiate<sensor_msgs::PointCloud2>();
+                if (msg) standard_pcl_cbk(msg);
+            }
+            scan_num ++;
+            TRACE_RECORD("lidar_preprocess", omp_get_wtime() - t_cb);
+        }
+        else if (topic == imu_topic)
+        {
+            sensor_msgs::Imu::ConstPtr msg = m.instantiate<sensor_msgs::Imu>();
+            if (msg) imu_cbk(msg);
+        }
+        else
+        {
+            sensor_msgs::ImageConstPtr msg = m.instantiate<sensor_msgs::Image>();
+            if (!msg)
+            {
+                // 压缩图像先解码，对应launch中的 image_transport republish
+                sensor_msgs::CompressedImageConstPtr cmsg = m.instantiate<sensor_msgs::CompressedImage>();
+                if (cmsg) msg = cv_bridge::toCvCopy(cmsg, "bgr8")->toImageMsg();
+            }
+            if (!msg) continue;
+            img_cbk(msg);
+            img_num ++;
+            TRACE_RECORD("img_preprocess", omp_get_wtime() - t_cb);
+        }
+
+        // 数据到齐后立即处理，不等待
+        while (sync_packages(LidarMeasures))
+        {
+            process_package();
+        }
     }
+    const double wall_time = omp_get_wtime() - wall_beg;
+    bag.close();
 
-    fout_out.close();
-    fout_pre.close();
-    fout_tum.close();
+    save_and_close();
+
+    /*** 回放统计 ***/
+    const double bag_time = max(bag_end - bag_beg, 0.0);
+    printf("[ REPLAY ]: %d scans, %d images, bag %.3f s, wall %.3f s, %.2f scans/s, real-time factor %.2fx.\n",
+           scan_num, img_num, bag_time, wall_time, scan_num / max(wall_time, 1e-9), bag_time / max(wall_time, 1e-9));
+    Tracer::print_summary();
+    Tracer::dump_chrome(DEBUG_FILE_DIR("trace.json"));
 
     return 0;
 }
+#endif
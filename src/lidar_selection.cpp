@@ -1,4 +1,5 @@
 #include "lidar_selection.h"
+#include "trace.h"
 
 namespace lidar_selection {
 
@@ -120,6 +121,92 @@ float LidarSelector::CheckGoodPoints(cv::Mat img, V2D uv)
     return fabs(gu)+fabs(gv);
 }
 
+/**
+ * @brief 每帧计算一次所有像素的 Shi-Tomasi 角点得分，之后 shiTomasiScore 只需查表。
+ *        梯度和窗口与 vk::shiTomasiScore 相同（中心差分，窗口为 [u-4,u+4)x[v-4,v+4)），结构张量 Ixx、Iyy、Ixy 整数累加，
+ *        得分与其一致（差别只在单精度开方的舍入）。图像按行分条并行，条内用滑动的列和做竖直方向的窗口和，每行只加入新的一行、减去移出的一行
+ * 
+ * @param img 
+ */
+void LidarSelector::computeShiTomasiMap(const cv::Mat& img)
+{
+    const int half = 4;
+    const int u_min = half + 1, u_max = width - half - 2, v_min = half + 1, v_max = height - half - 2;
+    // 窗口靠近边界的像素得分为0，与 vk::shiTomasiScore 相同
+    st_score.assign(width * height, 0.0f);
+    if (u_max < u_min || v_max < v_min) return;
+    const int stride = img.step.p[0];
+    const int strip = 32;
+    const int strips = (v_max - v_min) / strip + 1;
+    #ifdef MP_EN
+        omp_set_num_threads(MP_PROC_NUM);
+        #pragma omp parallel for schedule(static)
+    #endif
+    for (int s = 0; s < strips; s++)
+    {
+        const int v_beg = v_min + s * strip, v_end = min(v_beg + strip - 1, v_max);
+        vector<int32_t> col(3 * width, 0);
+        vector<float> trace(width), disc(width);
+        int32_t* cxx = col.data();
+        int32_t* cyy = cxx + width;
+        int32_t* cxy = cyy + width;
+        // 第 y 行的梯度积加入（sign 为1）或移出（sign 为-1）列和
+        auto add_row = [&](int y, int32_t sign)
+        {
+            const uint8_t* row = img.data + stride * y;
+            const uint8_t* up = row - stride;
+            const uint8_t* down = row + stride;
+            #pragma omp simd
+            for (int x = 1; x < width - 1; x++)
+            {
+                const int32_t dx = int32_t(row[x + 1]) - int32_t(row[x - 1]);
+                const int32_t dy = int32_t(down[x]) - int32_t(up[x]);
+                cxx[x] += sign * dx * dx;
+                cyy[x] += sign * dy * dy;
+                cxy[x] += sign * dx * dy;
+            }
+        };
+        for (int y = v_beg - half; y < v_beg + half - 1; y++) add_row(y, 1);
+        for (int v = v_beg; v <= v_end; v++)
+        {
+            add_row(v + half - 1, 1);
+            #pragma omp simd
+            for (int u = u_min; u <= u_max; u++)
+            {
+                int32_t sxx = 0, syy = 0, sxy = 0;
+                for (int k = -half; k < half; k++)
+                {
+                    sxx += cxx[u + k];
+                    syy += cyy[u + k];
+                    sxy += cxy[u + k];
+                }
+                // 窗口面积 64，与 vk 相同地除以 2 倍面积
+                const float dXX = sxx / 128.0f, dYY = syy / 128.0f, dXY = sxy / 128.0f;
+                trace[u] = dXX + dYY;
+                disc[u] = (dXX + dYY) * (dXX + dYY) - 4 * (dXX * dYY - dXY * dXY);
+            }
+            // 结构张量较小的特征值，开方用 Eigen 向量化
+            const int n = u_max - u_min + 1;
+            Eigen::Map<ArrayXf>(&st_score[v * width + u_min], n) =
+                0.5f * (Eigen::Map<const ArrayXf>(&trace[u_min], n) - Eigen::Map<const ArrayXf>(&disc[u_min], n).sqrt());
+            add_row(v - half, -1);
+        }
+    }
+}
+
+/**
+ * @brief 像素 (u, v) 处的 Shi-Tomasi 角点得分，与 vk::shiTomasiScore(img, u, v) 相同。需先对当前帧调用 computeShiTomasiMap
+ * 
+ * @param u 
+ * @param v 
+ * @return float 
+ */
+float LidarSelector::shiTomasiScore(int u, int v) const
+{
+    if (u < 0 || v < 0 || u >= width || v >= height) return 0.0;
+    return st_score[v * width + u];
+}
+
 /**
  * @brief 从图像中提取指定位置的 patch，并进行插值
  * 
@@ -159,6 +246,7 @@ void LidarSelector::getpatch(cv::Mat img, V2D pc, float* patch_tmp, int level)
  */
 void LidarSelector::addSparseMap(cv::Mat img, PointCloudXYZI::Ptr pg) 
 {
+    TRACE_SCOPE("vio_add_sparse_map");
     // double t0 = omp_get_wtime();
     reset_grid();
 
@@ -175,7 +263,7 @@ void LidarSelector::addSparseMap(cv::Mat img, PointCloudXYZI::Ptr pg)
             int index = static_cast<int>(pc[0]/grid_size)*grid_n_height + static_cast<int>(pc[1]/grid_size);
             // float cur_value = CheckGoodPoints(img, pc);
             // 计算当前点的角点得分
-            float cur_value = vk::shiTomasiScore(img, pc[0], pc[1]);
+            float cur_value = shiTomasiScore(pc[0], pc[1]);
 
             // 每个网格取最大角点得分，以及对应的点
             if (cur_value > map_value[index]) //&& (grid_num[index] != TYPE_MAP || map_value[index]<=10)) //! only add in not occupied grid
@@ -352,7 +440,9 @@ void LidarSelector::warpAffine(
 }
 
 /**
- * @brief 计算归一化互相关系数（NCC），用于衡量两个图像patch之间的相似度
+ * @brief 计算归一化互相关系数（NCC），用于衡量两个图像patch之间的相似度。
+ *        一遍求出 Σr、Σc、Σr²、Σc²、Σrc，均值和方差由这些和算出，各项求和由 Eigen 向量化；
+ *        两个patch各以首个像素为零点累加，单精度下平坦patch的方差也不会被抵消掉
  * 
  * @param ref_patch 
  * @param cur_patch 
@@ -361,20 +451,13 @@ void LidarSelector::warpAffine(
  */
 double LidarSelector::NCC(float* ref_patch, float* cur_patch, int patch_size)
 {    
-    double sum_ref = std::accumulate(ref_patch, ref_patch + patch_size, 0.0);
-    double mean_ref =  sum_ref / patch_size;
-
-    double sum_cur = std::accumulate(cur_patch, cur_patch + patch_size, 0.0);
-    double mean_curr =  sum_cur / patch_size;
-
-    double numerator = 0, demoniator1 = 0, demoniator2 = 0;
-    for (int i = 0; i < patch_size; i++) 
-    {
-        double n = (ref_patch[i] - mean_ref) * (cur_patch[i] - mean_curr);
-        numerator += n;
-        demoniator1 += (ref_patch[i] - mean_ref) * (ref_patch[i] - mean_ref);
-        demoniator2 += (cur_patch[i] - mean_curr) * (cur_patch[i] - mean_curr);
-    }
+    Eigen::Map<const ArrayXf> ref(ref_patch, patch_size), cur(cur_patch, patch_size);
+    const auto r = ref - ref[0];
+    const auto c = cur - cur[0];
+    const double sum_ref = r.sum(), sum_cur = c.sum();
+    const double numerator = (r * c).sum() - sum_ref * sum_cur / patch_size;
+    const double demoniator1 = r.square().sum() - sum_ref * sum_ref / patch_size;
+    const double demoniator2 = c.square().sum() - sum_cur * sum_cur / patch_size;
     return numerator / sqrt(demoniator1 * demoniator2 + 1e-10);
 }
 
@@ -424,6 +507,7 @@ void LidarSelector::createPatchFromPatchWithBorder(float* patch_with_border, flo
  */
 void LidarSelector::addFromSparseMap(cv::Mat img, PointCloudXYZI::Ptr pg)
 {
+    TRACE_SCOPE("vio_add_from_sparse_map");
     if(feat_map.size()<=0) return;
     // double ts0 = omp_get_wtime();
 
@@ -640,7 +724,7 @@ void LidarSelector::addFromSparseMap(cv::Mat img, PointCloudXYZI::Ptr pg)
                 new_frame_->T_f_w_ * ref_ftr->T_f_w_.inverse(), 0, 0, patch_size_half, A_cur_ref_zero);
                 
                 // 判断到哪个金字塔层级里面寻找像素对应关系
-                search_level = getBestSearchLevel(A_cur_ref_zero, 2);
+                search_level = getBestSearchLevel(A_cur_ref_zero, MAX_SEARCH_LEVEL);
 
                 Warp *ot = new Warp(search_level, A_cur_ref_zero);
                 Warp_map[ref_ftr->id_] = ot;
@@ -659,20 +743,17 @@ void LidarSelector::addFromSparseMap(cv::Mat img, PointCloudXYZI::Ptr pg)
             // 从当前帧图像中获取当前地图点的patch，但是没用金字塔
             getpatch(img, pc, patch_cache.data(), 0);
 
-            // 计算NCC
+            // 计算当前地图点的patch与参考帧的patch之间像素误差的平方和
+            float error = (Eigen::Map<const ArrayXf>(patch_wrap.data(), patch_size_total) -
+                           Eigen::Map<const ArrayXf>(patch_cache.data(), patch_size_total)).square().sum();
+            if(error > outlier_threshold*patch_size_total) continue;
+
+            // 计算NCC，只对误差阈值内的patch计算
             if(ncc_en)
             {
                 double ncc = NCC(patch_wrap.data(), patch_cache.data(), patch_size_total);
                 if(ncc < ncc_thre) continue;
             }
-
-            // 计算当前地图点的patch与参考帧的patch之间像素误差的平方和
-            float error = 0.0;
-            for (int ind=0; ind<patch_size_total; ind++) 
-            {
-                error += (patch_wrap[ind]-patch_cache[ind]) * (patch_wrap[ind]-patch_cache[ind]);
-            }
-            if(error > outlier_threshold*patch_size_total) continue;
             
             // 用到的地图点存起来，但只用于显示
             sub_map_cur_frame_.push_back(pt);
@@ -856,6 +937,7 @@ void LidarSelector::FeatureAlignment(cv::Mat img)
  */
 float LidarSelector::UpdateState(cv::Mat img, float total_residual, int level) 
 {
+    TRACE_SCOPE("vio_update_state");
     int total_points = sub_sparse_map->index.size(); // 计算了误差的patch的size
     if (total_points==0) return 0.;
     StatesGroup old_state = (*state); // 旧状态
@@ -885,6 +967,13 @@ float LidarSelector::UpdateState(cv::Mat img, float total_residual, int level)
     
     for (int iteration=0; iteration<NUM_MAX_ITERATIONS; iteration++) 
     {
+        // 超出本帧的时间预算时保留当前状态结束
+        if (vio_deadline > 0 && omp_get_wtime() > vio_deadline)
+        {
+            vio_stats.deadline_hit = true;
+            break;
+        }
+        vio_stats.iterations[level] = iteration + 1;
         // double t1 = omp_get_wtime();
         double count_outlier = 0;
      
@@ -984,6 +1073,8 @@ float LidarSelector::UpdateState(cv::Mat img, float total_residual, int level)
         // 上一次优化有效就继续优化，否则取回上一次状态结束优化
         if (error <= last_error) 
         {
+            // 自适应模式下代价的相对下降很小时，本次更新后结束本层
+            const bool small_decrease = vio_adaptive_en && iteration > 0 && last_error - error < vio_min_decrease * last_error;
             old_state = (*state);
             last_error = error;
 
@@ -1006,7 +1097,7 @@ float LidarSelector::UpdateState(cv::Mat img, float total_residual, int level)
             auto &&t_add   = solution.block<3,1>(3,0);
 
             // 状态增量较小时结束优化
-            if ((rot_add.norm() * 57.3f < 0.001f) && (t_add.norm() * 100.0f < 0.001f))
+            if (((rot_add.norm() * 57.3f < 0.001f) && (t_add.norm() * 100.0f < 0.001f)) || small_decrease)
             {
                 EKF_end = true;
             }
@@ -1043,6 +1134,7 @@ void LidarSelector::updateFrameState(StatesGroup state)
  */
 void LidarSelector::addObservation(cv::Mat img)
 {
+    TRACE_SCOPE("vio_add_observation");
     int total_points = sub_sparse_map->index.size();
     if (total_points==0) return;
 
@@ -1074,7 +1166,7 @@ void LidarSelector::addObservation(cv::Mat img)
             if(pixel_dist > 40) add_flag = true;
             
             // Maintain the size of 3D Point observation features.
-            if(pt->obs_.size()>=20)
+            if(pt->obs_.size()>=MAX_OBS_NUM)
             {
                 FeaturePtr ref_ftr;
                 pt->getFurthestViewObs(new_frame_->pos(), ref_ftr);
@@ -1083,7 +1175,7 @@ void LidarSelector::addObservation(cv::Mat img)
             } 
             if(add_flag)
             {
-                pt->value = vk::shiTomasiScore(img, pc[0], pc[1]);
+                pt->value = shiTomasiScore(pc[0], pc[1]);
                 Vector3d f = cam->cam2world(pc);
                 FeaturePtr ftr_new(new Feature(pc, f, new_frame_->T_f_w_, pt->value, sub_sparse_map->search_levels[i])); 
                 ftr_new->img = new_frame_->img_pyr_[0];
@@ -1103,22 +1195,42 @@ void LidarSelector::addObservation(cv::Mat img)
  */
 void LidarSelector::ComputeJ(cv::Mat img) 
 {
+    TRACE_SCOPE("vio_compute_j");
     int total_points = sub_sparse_map->index.size();
+    vio_stats = VioStats();
+    vio_stats.patches = total_points;
     if (total_points==0) return;
+    double t0 = omp_get_wtime();
     float error = 1e10;
-    float now_error = error;
+    float now_error = error, best_error = error, last_level_error = error;
+
+    // 先验位姿下的误差在 addFromSparseMap 中已经算好
+    for (float e : sub_sparse_map->propa_errors) vio_stats.prior_error += e;
+    vio_stats.prior_error /= total_points * patch_size_total;
+
+    // 自适应模式下先验误差已经很小时跳过粗层，只在原图层迭代
+    int top_level = (vio_adaptive_en && vio_stats.prior_error < vio_skip_error) ? 0 : 2;
 
     // 金字塔从高到低，依次利用光度误差更新状态
-    for (int level=2; level>=0; level--) 
+    for (int level=top_level; level>=0; level--) 
     {
         now_error = UpdateState(img, error, level);
+        if (now_error > 0) best_error = min(best_error, now_error);
+        // 各层的误差按各自的分辨率计算，不能相互比较，final_error 取实际迭代过的最后（最精细）一层
+        if (now_error > 0 && now_error < error) last_level_error = now_error;
+        if (vio_stats.deadline_hit) break;
     }
-    // 结束迭代时，更新协方差
-    if (now_error < error)
+    // 结束迭代时，更新协方差。因时间预算提前结束时最后一层可能没有迭代，按所有层中的最小误差判断是否有过更新
+    if ((vio_stats.deadline_hit ? best_error : now_error) < error)
     {
         state->cov -= G*state->cov;
     }
     updateFrameState(*state);
+    vio_stats.final_error = last_level_error < error ? last_level_error : vio_stats.prior_error;
+    vio_stats.time = omp_get_wtime() - t0;
+    if (vio_adaptive_en)
+        printf("[ VIO ]: iterations (level 2/1/0): %d/%d/%d, error: %.1f -> %.1f%s.\n", vio_stats.iterations[2], vio_stats.iterations[1],
+               vio_stats.iterations[0], vio_stats.prior_error, vio_stats.final_error, vio_stats.deadline_hit ? ", deadline hit" : "");
 }
 
 /**
@@ -1129,7 +1241,7 @@ void LidarSelector::ComputeJ(cv::Mat img)
 void LidarSelector::display_keypatch(double time)
 {
     int total_points = sub_sparse_map->index.size();
-    if (total_points==0) return;
+    if (total_points==0 || img_cp.empty()) return;
     // 误差小的点用绿色显示，误差大的点用蓝色显示
     for(int i=0; i<total_points; i++)
     {
@@ -1149,7 +1261,7 @@ void LidarSelector::display_keypatch(double time)
     cv::putText(img_cp, text, origin, cv::FONT_HERSHEY_COMPLEX, 0.6, cv::Scalar(255, 255, 255), 1, 8, 0);
 }
 
-V3F LidarSelector::getpixel(cv::Mat img, V2D pc) 
+V3F LidarSelector::getpixel(const cv::Mat &img, V2D pc)
 {
     const float u_ref = pc[0];
     const float v_ref = pc[1];
@@ -1177,17 +1289,34 @@ V3F LidarSelector::getpixel(cv::Mat img, V2D pc)
  */
 void LidarSelector::detect(cv::Mat img, PointCloudXYZI::Ptr pg) 
 {
+    ImgFramePtr frame(new ImgFrame());
     if(width!=img.cols || height!=img.rows)
     {
         // std::cout<<"Resize the img scale !!!"<<std::endl;
         double scale = 0.5;
         cv::resize(img,img,cv::Size(img.cols*scale,img.rows*scale),0,0,CV_INTER_LINEAR);
     }
-    img_rgb = img.clone();
-    img_cp = img.clone();
-    cv::cvtColor(img,img,CV_BGR2GRAY);
+    frame->rgb = img.clone();
+    frame->canvas = img.clone();
+    cv::cvtColor(img,frame->gray,CV_BGR2GRAY);
+    frame->pyr.push_back(frame->gray);
+    detect(frame, pg);
+}
 
-    new_frame_.reset(new Frame(cam, img.clone()));
+/**
+ * @brief 处理预处理好的图像帧，灰度图和金字塔直接共享，不再拷贝
+ * 
+ * @param frame 
+ * @param pg 
+ */
+void LidarSelector::detect(ImgFramePtr frame, PointCloudXYZI::Ptr pg) 
+{
+    TRACE_SCOPE("vio_detect");
+    img_rgb = frame->rgb;
+    img_cp = frame->canvas;
+    cv::Mat img = frame->gray;
+
+    new_frame_.reset(new Frame(cam, frame->pyr));
     updateFrameState(*state);
 
     if(stage_ == STAGE_FIRST_FRAME && pg->size()>10)
@@ -1197,14 +1326,20 @@ void LidarSelector::detect(cv::Mat img, PointCloudXYZI::Ptr pg)
     }
 
     double t1 = omp_get_wtime();
+    vio_deadline = (vio_adaptive_en && vio_time_budget > 0) ? t1 + vio_time_budget : 0.0;
 
     // 根据上一帧点云数据从地图中找相近的体素点，将其中地图点投影到当前帧和参考帧图像上，并计算误差
     addFromSparseMap(img, pg);
 
     double t3 = omp_get_wtime();
 
-    // 将点云添加到视觉地图中
-    addSparseMap(img, pg);
+    // 将点云添加到视觉地图中，定位模式下地图只读
+    // 角点得分每帧算一次，addSparseMap 和 addObservation 查表
+    if (map_update_en)
+    {
+        computeShiTomasiMap(img);
+        addSparseMap(img, pg);
+    }
 
     double t4 = omp_get_wtime();
     
@@ -1216,7 +1351,7 @@ void LidarSelector::detect(cv::Mat img, PointCloudXYZI::Ptr pg)
     double t5 = omp_get_wtime();
 
     // 给地图点添加当前帧的观测
-    addObservation(img);
+    if (map_update_en) addObservation(img);
     
     double t2 = omp_get_wtime();
     
@@ -246,7 +246,7 @@ void Map::transform(const Matrix3d& R, const Vector3d& t, const double& s)
       if((*ftr)->point->last_published_ts_ == -1000)
         continue;
       (*ftr)->point->last_published_ts_ = -1000;
-      (*ftr)->point->pos_ = s*R*(*ftr)->point->pos_ + t;
+      (*ftr)->point->setPos(s*R*(*ftr)->point->pos_ + t);
     }
   }
 }
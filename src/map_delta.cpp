@@ -0,0 +1,219 @@
+#include "map_delta.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+void push_key(std::vector<int32_t> &keys, const VOXEL_KEY &key)
+{
+  keys.push_back(int32_t(key.x));
+  keys.push_back(int32_t(key.y));
+  keys.push_back(int32_t(key.z));
+}
+
+bool in_box(const BoxPointType &box, float x, float y, float z)
+{
+  return x >= box.vertex_min[0] && x < box.vertex_max[0] &&
+         y >= box.vertex_min[1] && y < box.vertex_max[1] &&
+         z >= box.vertex_min[2] && z < box.vertex_max[2];
+}
+}
+
+MapDeltaTracker::MapDeltaTracker()
+    : block_size(10.0), track_changes(true)
+{
+}
+
+void MapDeltaTracker::set_levels(const std::vector<double> &resolutions, double block_size, bool track_changes)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  this->block_size = block_size;
+  this->track_changes = track_changes;
+  layers.clear();
+  for (double res : resolutions)
+  {
+    if (res <= 0) continue;
+    Layer layer;
+    layer.resolution = res;
+    layers.push_back(layer);
+  }
+}
+
+void MapDeltaTracker::mark_dirty(Layer &layer, const VOXEL_KEY &key, Block &block)
+{
+  if (block.dirty || !track_changes) return;
+  block.dirty = true;
+  layer.dirty_keys.push_back(key);
+}
+
+/**
+ * @brief 把插入 ikdtree 的点加入各层：体素已存在时忽略，否则新建体素并标记所在的块
+ */
+void MapDeltaTracker::insert(const PointVector &points)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  for (Layer &layer : layers)
+  {
+    const double inv_res = 1.0 / layer.resolution;
+    const double res_per_block = layer.resolution / block_size;
+    for (const PointType &p : points)
+    {
+      if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) continue;
+      VOXEL_KEY voxel_key(int64_t(std::floor(p.x * inv_res)), int64_t(std::floor(p.y * inv_res)), int64_t(std::floor(p.z * inv_res)));
+      // 按体素中心分块，同一体素总落在同一块
+      VOXEL_KEY block_key(int64_t(std::floor((voxel_key.x + 0.5) * res_per_block)),
+                          int64_t(std::floor((voxel_key.y + 0.5) * res_per_block)),
+                          int64_t(std::floor((voxel_key.z + 0.5) * res_per_block)));
+      auto it = layer.blocks.find(block_key);
+      if (it == layer.blocks.end())
+      {
+        it = layer.blocks.emplace(block_key, Block()).first;
+        it->second.dirty = false;
+      }
+      Block &block = it->second;
+      PointTypeLOD q;
+      q.x = p.x;
+      q.y = p.y;
+      q.z = p.z;
+      q.intensity = p.intensity;
+      if (block.voxels.emplace(voxel_key, q).second) mark_dirty(layer, block_key, block);
+    }
+  }
+}
+
+/**
+ * @brief 与 ikdtree.Delete_Point_Boxes 同步删除：整块落在删除范围内的块直接删掉，
+ *        部分重叠的块逐个体素检查，删空的块记为删除，否则标记为有变化
+ */
+void MapDeltaTracker::remove_boxes(const std::vector<BoxPointType> &boxes)
+{
+  if (boxes.empty()) return;
+  std::lock_guard<std::mutex> lock(mtx);
+  for (Layer &layer : layers)
+  {
+    for (auto it = layer.blocks.begin(); it != layer.blocks.end(); )
+    {
+      // 块内的点离块的边界不超过一个体素
+      float lo[3], hi[3];
+      const int64_t key[3] = {it->first.x, it->first.y, it->first.z};
+      for (int i = 0; i < 3; i++)
+      {
+        lo[i] = key[i] * block_size - layer.resolution;
+        hi[i] = (key[i] + 1) * block_size + layer.resolution;
+      }
+      bool overlap = false, inside = false;
+      for (const BoxPointType &box : boxes)
+      {
+        bool box_overlap = true, box_inside = true;
+        for (int i = 0; i < 3; i++)
+        {
+          box_overlap &= lo[i] < box.vertex_max[i] && hi[i] >= box.vertex_min[i];
+          box_inside &= lo[i] >= box.vertex_min[i] && hi[i] < box.vertex_max[i];
+        }
+        overlap |= box_overlap;
+        inside |= box_inside;
+      }
+      if (!overlap)
+      {
+        ++it;
+        continue;
+      }
+      Block &block = it->second;
+      if (!inside)
+      {
+        size_t n = block.voxels.size();
+        for (auto v = block.voxels.begin(); v != block.voxels.end(); )
+        {
+          bool erase = false;
+          for (const BoxPointType &box : boxes)
+            if (in_box(box, v->second.x, v->second.y, v->second.z)) { erase = true; break; }
+          v = erase ? block.voxels.erase(v) : std::next(v);
+        }
+        if (!block.voxels.empty())
+        {
+          if (block.voxels.size() != n) mark_dirty(layer, it->first, block);
+          ++it;
+          continue;
+        }
+      }
+      if (track_changes) layer.removed_keys.push_back(it->first);
+      it = layer.blocks.erase(it);
+    }
+  }
+}
+
+/**
+ * @brief 取出一层自上次调用以来的变化并清空变化记录；keyframe 时取出整层
+ */
+void MapDeltaTracker::take(int level, bool keyframe, MapDeltaLevel &out)
+{
+  out.keyframe = keyframe;
+  out.updated.clear();
+  out.counts.clear();
+  out.removed.clear();
+  out.points.clear();
+  std::lock_guard<std::mutex> lock(mtx);
+  if (level < 0 || level >= int(layers.size())) return;
+  Layer &layer = layers[level];
+  out.resolution = layer.resolution;
+  auto append = [&out](const VOXEL_KEY &key, Block &block)
+  {
+    block.dirty = false;
+    push_key(out.updated, key);
+    out.counts.push_back(uint32_t(block.voxels.size()));
+    for (const auto &v : block.voxels) out.points.push_back(v.second);
+  };
+  if (keyframe)
+  {
+    for (auto &it : layer.blocks) append(it.first, it.second);
+  }
+  else
+  {
+    for (const VOXEL_KEY &key : layer.removed_keys) push_key(out.removed, key);
+    for (const VOXEL_KEY &key : layer.dirty_keys)
+    {
+      auto it = layer.blocks.find(key);
+      // 标记后又被整块删除的块只出现在 removed 中
+      if (it != layer.blocks.end() && it->second.dirty) append(key, it->second);
+    }
+  }
+  layer.dirty_keys.clear();
+  layer.removed_keys.clear();
+}
+
+/**
+ * @brief 取出一层的全部点。先在锁内记下块号，再每次加锁复制 COLLECT_BLOCKS 个块，
+ *        复制期间插入和删除只需等待一小段；其间被删除的块跳过，新增的块不取
+ */
+void MapDeltaTracker::collect(int level, std::vector<PointTypeLOD> &out)
+{
+  const size_t COLLECT_BLOCKS = 64;
+  out.clear();
+  std::vector<VOXEL_KEY> keys;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (level < 0 || level >= int(layers.size())) return;
+    keys.reserve(layers[level].blocks.size());
+    for (const auto &it : layers[level].blocks) keys.push_back(it.first);
+  }
+  for (size_t beg = 0; beg < keys.size(); beg += COLLECT_BLOCKS)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    const Layer &layer = layers[level];
+    for (size_t i = beg; i < std::min(beg + COLLECT_BLOCKS, keys.size()); i++)
+    {
+      auto it = layer.blocks.find(keys[i]);
+      if (it == layer.blocks.end()) continue;
+      for (const auto &v : it->second.voxels) out.push_back(v.second);
+    }
+  }
+}
+
+size_t MapDeltaTracker::voxels(int level)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  if (level < 0 || level >= int(layers.size())) return 0;
+  size_t n = 0;
+  for (const auto &it : layers[level].blocks) n += it.second.voxels.size();
+  return n;
+}
@@ -0,0 +1,324 @@
+#include "map_snapshot.h"
+#include <omp.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace
+{
+uint64_t align8(uint64_t n)
+{
+  return (n + 7) & ~uint64_t(7);
+}
+}
+
+/**
+ * @brief 从地图的体素副本取出激光点，在写盘线程中调用
+ */
+void snapshot_collect_lio(MapDeltaTracker &map, SnapshotData &data)
+{
+  std::vector<PointTypeLOD> points;
+  map.collect(0, points);
+  data.lio.resize(points.size());
+  for (size_t i = 0; i < points.size(); i++)
+    data.lio[i] = {points[i].x, points[i].y, points[i].z, points[i].intensity};
+}
+
+/**
+ * @brief 开始收集视觉地图：记下当前的体素，之后由 snapshot_step_vio 分帧收集
+ */
+void snapshot_begin_vio(const lidar_selection::LidarSelector &selector, SnapshotVioCursor &cursor, SnapshotData &data)
+{
+  cursor.voxels.clear();
+  cursor.voxels.reserve(selector.feat_map.size());
+  for (const auto &voxel : selector.feat_map) cursor.voxels.push_back(voxel.first);
+  cursor.next = 0;
+  cursor.image_index.clear();
+  data.vio.clear();
+  data.obs.clear();
+  data.images.clear();
+  data.image_data.clear();
+}
+
+/**
+ * @brief 收集视觉地图的一部分：每个点的位置、法向和全部观测（位姿、像素、方向向量、参考图像）。
+ *        在估计线程中调用，每次收集到至少 max_points 个点为止，其间被删除的体素跳过；
+ *        参考图像按帧号只记一次，保存的是与地图共享像素的 cv::Mat，不复制像素。全部收集完时返回 true
+ */
+bool snapshot_step_vio(const lidar_selection::LidarSelector &selector, SnapshotVioCursor &cursor, SnapshotData &data, size_t max_points)
+{
+  size_t collected = 0;
+  while (cursor.next < cursor.voxels.size() && collected < max_points)
+  {
+    auto voxel = selector.feat_map.find(cursor.voxels[cursor.next++]);
+    if (voxel == selector.feat_map.end()) continue;
+    for (const lidar_selection::PointPtr &pt : voxel->second->voxel_points)
+    {
+      SnapshotVioPoint p;
+      memset(&p, 0, sizeof(p));
+      for (int i = 0; i < 3; i++)
+      {
+        p.pos[i] = pt->pos_[i];
+        p.normal[i] = float(pt->normal_[i]);
+      }
+      p.value = pt->value;
+      p.normal_set = pt->normal_set_;
+      p.first_obs = uint32_t(data.obs.size());
+      p.n_obs = uint32_t(pt->obs_.size());
+      for (const lidar_selection::FeaturePtr &ftr : pt->obs_)
+      {
+        SnapshotObs o;
+        memset(&o, 0, sizeof(o));
+        Map<Matrix<double, 3, 3, RowMajor>>(o.R) = ftr->T_f_w_.rotation_matrix();
+        Map<Vector3d>(o.t) = ftr->T_f_w_.translation();
+        Map<Vector2d>(o.px) = ftr->px;
+        Map<Vector3d>(o.f) = ftr->f;
+        o.score = ftr->score;
+        o.level = ftr->level;
+        o.frame_id = ftr->id_;
+        auto it = cursor.image_index.find(ftr->id_);
+        if (it == cursor.image_index.end())
+        {
+          SnapshotImage image;
+          memset(&image, 0, sizeof(image));
+          image.frame_id = ftr->id_;
+          if (!ftr->img.empty() && ftr->img.type() == CV_8UC1)
+          {
+            image.width = uint32_t(ftr->img.cols);
+            image.height = uint32_t(ftr->img.rows);
+          }
+          it = cursor.image_index.emplace(ftr->id_, uint32_t(data.images.size())).first;
+          data.images.push_back(image);
+          data.image_data.push_back(ftr->img);
+        }
+        o.image = it->second;
+        data.obs.push_back(o);
+      }
+      data.vio.push_back(p);
+      collected ++;
+    }
+  }
+  return cursor.next >= cursor.voxels.size();
+}
+
+bool snapshot_write(const std::string &path, const SnapshotData &data)
+{
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SNAPSHOT_MAGIC;
+  header.version = SNAPSHOT_VERSION;
+  header.lio_points = data.lio.size();
+  header.vio_points = data.vio.size();
+  header.observations = data.obs.size();
+  header.images = data.images.size();
+  header.lio_offset = align8(sizeof(header));
+  header.vio_offset = align8(header.lio_offset + data.lio.size() * sizeof(SnapshotLioPoint));
+  header.obs_offset = align8(header.vio_offset + data.vio.size() * sizeof(SnapshotVioPoint));
+  header.image_offset = align8(header.obs_offset + data.obs.size() * sizeof(SnapshotObs));
+  // 各图像的像素依次排在图像索引之后
+  std::vector<SnapshotImage> images(data.images);
+  uint64_t end = header.image_offset + images.size() * sizeof(SnapshotImage);
+  for (SnapshotImage &image : images)
+  {
+    const uint64_t bytes = uint64_t(image.width) * image.height;
+    image.offset = bytes > 0 ? align8(end) : end;
+    end = image.offset + bytes;
+  }
+  header.file_size = end;
+
+  // 所在目录不存在时创建（只创建最后一级）
+  const size_t slash = path.rfind('/');
+  if (slash != std::string::npos && slash > 0) mkdir(path.substr(0, slash).c_str(), 0755);
+  const std::string tmp = path + ".tmp";
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (fp == nullptr)
+  {
+    printf("[ SNAPSHOT ]: failed to open %s.\n", tmp.c_str());
+    return false;
+  }
+  auto write_at = [fp](uint64_t offset, const void *src, size_t bytes)
+  {
+    return fseek(fp, long(offset), SEEK_SET) == 0 && fwrite(src, 1, bytes, fp) == bytes;
+  };
+  bool ok = write_at(0, &header, sizeof(header)) &&
+            write_at(header.lio_offset, data.lio.data(), data.lio.size() * sizeof(SnapshotLioPoint)) &&
+            write_at(header.vio_offset, data.vio.data(), data.vio.size() * sizeof(SnapshotVioPoint)) &&
+            write_at(header.obs_offset, data.obs.data(), data.obs.size() * sizeof(SnapshotObs)) &&
+            write_at(header.image_offset, images.data(), images.size() * sizeof(SnapshotImage));
+  for (size_t i = 0; ok && i < images.size(); i++)
+  {
+    const cv::Mat &img = data.image_data[i];
+    for (uint32_t y = 0; ok && y < images[i].height; y++)
+      ok = write_at(images[i].offset + uint64_t(y) * images[i].width, img.ptr<uint8_t>(y), images[i].width);
+  }
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+  {
+    printf("[ SNAPSHOT ]: failed to write %s.\n", path.c_str());
+    remove(tmp.c_str());
+    return false;
+  }
+  return true;
+}
+
+MapSnapshotWriter::MapSnapshotWriter()
+    : busy_(false)
+{
+}
+
+MapSnapshotWriter::~MapSnapshotWriter()
+{
+  wait();
+}
+
+bool MapSnapshotWriter::save(const std::string &path, SnapshotData &&data, MapDeltaTracker *lio)
+{
+  if (busy_) return false;
+  if (thread_.joinable()) thread_.join();
+  busy_ = true;
+  thread_ = std::thread([this, path, lio](SnapshotData &&data)
+  {
+    double t0 = omp_get_wtime();
+    if (lio) snapshot_collect_lio(*lio, data);
+    if (snapshot_write(path, data))
+      printf("[ SNAPSHOT ]: %lu lidar points, %lu visual points, %lu observations, %lu images written to %s in %.3f s.\n",
+             (unsigned long)data.lio.size(), (unsigned long)data.vio.size(), (unsigned long)data.obs.size(),
+             (unsigned long)data.images.size(), path.c_str(), omp_get_wtime() - t0);
+    busy_ = false;
+  }, std::move(data));
+  return true;
+}
+
+void MapSnapshotWriter::wait()
+{
+  if (thread_.joinable()) thread_.join();
+}
+
+MapSnapshot::MapSnapshot()
+    : data(nullptr), size(0)
+{
+}
+
+MapSnapshot::~MapSnapshot()
+{
+  close();
+}
+
+/**
+ * @brief 只读映射快照文件并检查文件头和各段范围
+ */
+bool MapSnapshot::open(const std::string &path)
+{
+  close();
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    printf("[ SNAPSHOT ]: failed to open %s.\n", path.c_str());
+    return false;
+  }
+  struct stat st;
+  void *ptr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(SnapshotHeader))
+    ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (ptr == MAP_FAILED)
+  {
+    printf("[ SNAPSHOT ]: failed to map %s.\n", path.c_str());
+    return false;
+  }
+  madvise(ptr, st.st_size, MADV_WILLNEED);
+  data = static_cast<const uint8_t *>(ptr);
+  size = st.st_size;
+
+  const SnapshotHeader &h = header();
+  bool ok = h.magic == SNAPSHOT_MAGIC && h.version == SNAPSHOT_VERSION && h.file_size == size &&
+            h.lio_offset + h.lio_points * sizeof(SnapshotLioPoint) <= h.vio_offset &&
+            h.vio_offset + h.vio_points * sizeof(SnapshotVioPoint) <= h.obs_offset &&
+            h.obs_offset + h.observations * sizeof(SnapshotObs) <= h.image_offset &&
+            h.image_offset + h.images * sizeof(SnapshotImage) <= size;
+  for (uint64_t i = 0; ok && i < h.images; i++)
+  {
+    const SnapshotImage &image = images()[i];
+    ok = image.offset + uint64_t(image.width) * image.height <= size;
+  }
+  if (!ok)
+  {
+    printf("[ SNAPSHOT ]: %s is not a valid version %d snapshot.\n", path.c_str(), SNAPSHOT_VERSION);
+    close();
+  }
+  return ok;
+}
+
+void MapSnapshot::close()
+{
+  if (data) munmap(const_cast<uint8_t *>(data), size);
+  data = nullptr;
+  size = 0;
+}
+
+void snapshot_restore_lio(const MapSnapshot &snapshot, PointVector &points)
+{
+  const uint64_t n = snapshot.header().lio_points;
+  const SnapshotLioPoint *src = snapshot.lio();
+  points.resize(n);
+  for (uint64_t i = 0; i < n; i++)
+  {
+    PointType &p = points[i];
+    p.x = src[i].x;
+    p.y = src[i].y;
+    p.z = src[i].z;
+    p.intensity = src[i].intensity;
+    p.normal_x = p.normal_y = p.normal_z = p.curvature = 0.0f;
+  }
+}
+
+/**
+ * @brief 重建视觉地图。参考图像不复制，同一帧的观测共享指向映射内存的 cv::Mat；快照中的帧号重新编为负数，
+ *        不会与本次运行的帧号在 Warp_map 中冲突
+ */
+int snapshot_restore_vio(const MapSnapshot &snapshot, lidar_selection::LidarSelector &selector)
+{
+  const SnapshotHeader &h = snapshot.header();
+  const SnapshotVioPoint *vio = snapshot.vio();
+  const SnapshotObs *obs = snapshot.obs();
+  std::unordered_map<int32_t, int> frame_ids;
+  std::vector<cv::Mat> images(h.images);
+  for (uint64_t i = 0; i < h.images; i++)
+  {
+    const SnapshotImage &image = snapshot.images()[i];
+    if (image.width > 0 && image.height > 0)
+      images[i] = cv::Mat(image.height, image.width, CV_8UC1, const_cast<uint8_t *>(snapshot.pixels(image)));
+  }
+  int restored = 0;
+  for (uint64_t i = 0; i < h.vio_points; i++)
+  {
+    const SnapshotVioPoint &p = vio[i];
+    if (p.first_obs + uint64_t(p.n_obs) > h.observations) continue;
+    lidar_selection::PointPtr pt(new lidar_selection::Point(Vector3d(p.pos[0], p.pos[1], p.pos[2])));
+    pt->normal_ = Vector3d(p.normal[0], p.normal[1], p.normal[2]);
+    pt->normal_set_ = p.normal_set != 0;
+    pt->value = p.value;
+    // addFrameRef 插入到表头，倒序加入以保持 obs_ 的顺序
+    for (int k = int(p.n_obs) - 1; k >= 0; k--)
+    {
+      const uint64_t j = p.first_obs + k;
+      const SnapshotObs &o = obs[j];
+      SE3 T_f_w(Matrix3d(Map<const Matrix<double, 3, 3, RowMajor>>(o.R)), Vector3d(Map<const Vector3d>(o.t)));
+      lidar_selection::FeaturePtr ftr(new lidar_selection::Feature(Vector2d(o.px[0], o.px[1]), Vector3d(o.f[0], o.f[1], o.f[2]),
+                                                                   T_f_w, o.score, o.level));
+      if (o.image < h.images) ftr->img = images[o.image];
+      auto it = frame_ids.find(o.frame_id);
+      if (it == frame_ids.end()) it = frame_ids.emplace(o.frame_id, -1 - int(frame_ids.size())).first;
+      ftr->id_ = it->second;
+      pt->addFrameRef(ftr);
+    }
+    selector.AddPoint(pt);
+    restored ++;
+  }
+  return restored;
+}
@@ -0,0 +1,100 @@
+#include "metrics.h"
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+FrameMetrics::FrameMetrics(const std::vector<std::string> &names, int capacity)
+    : names(names), capacity(capacity), cols(names.size()), ring(size_t(capacity) * names.size(), 0.0), rows(0)
+{
+  Aggregate agg;
+  agg.count = 0;
+  agg.mean = agg.m2 = 0.0;
+  agg.min = std::numeric_limits<double>::max();
+  agg.max = std::numeric_limits<double>::lowest();
+  aggs.assign(cols, agg);
+}
+
+/**
+ * @brief 写入一帧，values 的顺序与构造时的列名一致；非有限值只进入缓冲区，不计入统计
+ */
+void FrameMetrics::push(const std::vector<double> &values)
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  double *row = &ring[size_t(rows % capacity) * cols];
+  for (int i = 0; i < cols; i++)
+  {
+    const double v = i < int(values.size()) ? values[i] : NAN;
+    row[i] = v;
+    if (!std::isfinite(v)) continue;
+    Aggregate &agg = aggs[i];
+    agg.count ++;
+    const double delta = v - agg.mean;
+    agg.mean += delta / agg.count;
+    agg.m2  += delta * (v - agg.mean);
+    agg.min  = std::min(agg.min, v);
+    agg.max  = std::max(agg.max, v);
+  }
+  rows ++;
+}
+
+FrameMetrics::Aggregate FrameMetrics::aggregate(int col) const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return aggs[col];
+}
+
+unsigned long FrameMetrics::size() const
+{
+  std::lock_guard<std::mutex> lock(mtx);
+  return rows;
+}
+
+/**
+ * @brief 按时间顺序写出缓冲区中的行，第一行为列名
+ */
+bool FrameMetrics::dump(const std::string &file_name) const
+{
+  std::vector<double> out;
+  unsigned long beg;
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    const unsigned long n = std::min<unsigned long>(rows, capacity);
+    beg = rows - n;
+    out.reserve(n * cols);
+    for (unsigned long r = beg; r < rows; r++)
+    {
+      const double *row = &ring[size_t(r % capacity) * cols];
+      out.insert(out.end(), row, row + cols);
+    }
+  }
+  FILE *fp = fopen(file_name.c_str(), "w");
+  if (fp == nullptr)
+  {
+    printf("[ METRICS ]: failed to open %s.\n", file_name.c_str());
+    return false;
+  }
+  fprintf(fp, "frame");
+  for (const std::string &name : names) fprintf(fp, " %s", name.c_str());
+  fprintf(fp, "\n");
+  for (size_t r = 0; r * cols < out.size(); r++)
+  {
+    fprintf(fp, "%lu", beg + r);
+    for (int i = 0; i < cols; i++) fprintf(fp, " %.9g", out[r * cols + i]);
+    fprintf(fp, "\n");
+  }
+  fclose(fp);
+  printf("[ METRICS ]: %d frames written to %s.\n", int(out.size() / std::max(cols, 1)), file_name.c_str());
+  return true;
+}
+
+void FrameMetrics::print_summary(FILE *fp) const
+{
+  fprintf(fp, "[ METRICS ]: %-24s %8s %14s %14s %14s %14s\n", "series", "n", "mean", "std", "min", "max");
+  for (int i = 0; i < cols; i++)
+  {
+    const Aggregate agg = aggregate(i);
+    if (agg.count == 0) continue;
+    const double std_dev = agg.count > 1 ? std::sqrt(agg.m2 / (agg.count - 1)) : 0.0;
+    fprintf(fp, "[ METRICS ]: %-24s %8lu %14.6g %14.6g %14.6g %14.6g\n", names[i].c_str(), agg.count, agg.mean, std_dev, agg.min, agg.max);
+  }
+}
@@ -15,41 +15,116 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <stdexcept>
+#include <algorithm>
 #include <vikit/math_utils.h>
 #include <point.h>
  
 namespace lidar_selection {
 
+PointObs::PointObs() :
+  n_(0),
+  cap_(0)
+{}
+
+void PointObs::reserve(int cap)
+{
+  std::unique_ptr<float[]> geom(new float[6 * cap]);
+  std::unique_ptr<FeaturePtr[]> ftr(new FeaturePtr[cap]);
+  for (int k = 0; k < 6; k++)
+    std::copy(geom_.get() + k * cap_, geom_.get() + k * cap_ + n_, geom.get() + k * cap);
+  std::move(ftr_.get(), ftr_.get() + n_, ftr.get());
+  geom_ = std::move(geom);
+  ftr_ = std::move(ftr);
+  cap_ = cap;
+}
+
+/**
+ * @brief 在表头加入观测，其余观测后移一位；光心和视线方向在这里算一次
+ */
+void PointObs::push_front(const FeaturePtr& ftr, const Vector3d& pos)
+{
+  if (n_ == cap_)
+  {
+    if (cap_ < MAX_OBS_NUM) reserve(std::min(std::max(2 * cap_, 2), MAX_OBS_NUM));
+    else erase(n_ - 1);
+  }
+  for (int k = 0; k < 6; k++)
+  {
+    float* a = geom_.get() + k * cap_;
+    std::copy_backward(a, a + n_, a + n_ + 1);
+  }
+  std::move_backward(ftr_.get(), ftr_.get() + n_, ftr_.get() + n_ + 1);
+
+  const Vector3d center = ftr->T_f_w_.inverse().translation();
+  const Vector3d dir = (center - pos).normalized();
+  for (int k = 0; k < 3; k++)
+  {
+    geom_[k * cap_] = float(center[k]);
+    geom_[(3 + k) * cap_] = float(dir[k]);
+  }
+  ftr_[0] = ftr;
+  ++n_;
+}
+
+/**
+ * @brief 由缓存的光心重新计算从 pos 指向各光心的视线方向
+ */
+void PointObs::updateDirs(const Vector3d& pos)
+{
+  for (int i = 0; i < n_; i++)
+  {
+    const Vector3d center(geom_[i], geom_[cap_ + i], geom_[2 * cap_ + i]);
+    const Vector3d dir = (center - pos).normalized();
+    for (int k = 0; k < 3; k++) geom_[(3 + k) * cap_ + i] = float(dir[k]);
+  }
+}
+
+void PointObs::erase(int i)
+{
+  for (int k = 0; k < 6; k++)
+  {
+    float* a = geom_.get() + k * cap_;
+    std::copy(a + i + 1, a + n_, a + i);
+  }
+  std::move(ftr_.get() + i + 1, ftr_.get() + n_, ftr_.get() + i);
+  ftr_[--n_].reset();
+}
+
+void PointObs::clear()
+{
+  for (int i = 0; i < n_; i++) ftr_[i].reset();
+  n_ = 0;
+}
+
 int Point::point_counter_ = 0;
 
+void intrusive_ptr_add_ref(Point* p) { ++p->ref_count_; }
+void intrusive_ptr_release(Point* p) { if (--p->ref_count_ == 0) delete p; }
+void intrusive_ptr_add_ref(Feature* p) { ++p->ref_count_; }
+void intrusive_ptr_release(Feature* p) { if (--p->ref_count_ == 0) delete p; }
+
 Point::Point(const Vector3d& pos) :
-  id_(point_counter_++),
   pos_(pos),
+  ref_count_(0),
   normal_set_(false),
+  id_(point_counter_++),
   n_obs_(0),
-  last_published_ts_(0),
-  last_projected_kf_id_(-1),
   // type_(TYPE_UNKNOWN),
-  n_failed_reproj_(0),
-  n_succeeded_reproj_(0),
-  last_structure_optim_(0),
-  have_scaled(false)
+  last_published_ts_(0),
+  n_failed_reproj_(0)
 {}
 
 Point::Point(const Vector3d& pos, FeaturePtr ftr) :
-  id_(point_counter_++),
   pos_(pos),
+  ref_count_(0),
   normal_set_(false),
+  id_(point_counter_++),
   n_obs_(1),
-  last_published_ts_(0),
-  last_projected_kf_id_(-1),
   // type_(TYPE_UNKNOWN),
-  n_failed_reproj_(0),
-  n_succeeded_reproj_(0),
-  last_structure_optim_(0),
-  have_scaled(false)
+  last_published_ts_(0),
+  n_failed_reproj_(0)
 {
-  obs_.push_front(ftr);
+  obs_.push_front(ftr, pos_);
 }
 
 Point::~Point()
@@ -58,9 +133,15 @@ Point::~Point()
   std::for_each(obs_.begin(), obs_.end(), [&](FeaturePtr i){i.reset();});
 }
 
+void Point::setPos(const Vector3d& pos)
+{
+  pos_ = pos;
+  obs_.updateDirs(pos_);
+}
+
 void Point::addFrameRef(FeaturePtr ftr)
 {
-  obs_.push_front(ftr);
+  obs_.push_front(ftr, pos_);
   ++n_obs_;
 }
 
@@ -74,11 +155,11 @@ FeaturePtr Point::findFrameRef(Frame* frame)
 
 bool Point::deleteFrameRef(Frame* frame)
 {
-  for(auto it=obs_.begin(), ite=obs_.end(); it!=ite; ++it)
+  for(int i=0; i<int(obs_.size()); ++i)
   {
-    if((*it)->frame == frame)
+    if(obs_[i]->frame == frame)
     {
-      obs_.erase(it);
+      obs_.erase(i);
       return true;
     }
   }
@@ -87,23 +168,51 @@ bool Point::deleteFrameRef(Frame* frame)
 
 void Point::deleteFeatureRef(FeaturePtr ftr)
 {
-  for(auto it=obs_.begin(), ite=obs_.end(); it!=ite; ++it)
+  for(int i=0; i<int(obs_.size()); ++i)
   {
-    if((*it) == ftr)
+    if(obs_[i] == ftr)
     {
-      obs_.erase(it);
+      obs_.erase(i);
       return;
     }
   }
 }
 
+/**
+ * @brief 与当前观测方向夹角最小的观测，返回其下标和夹角余弦；先对所有观测算余弦（可向量化），再取最大值，
+ *        相同时取较新的观测，与原先按 list 顺序遍历的结果相同
+ */
+int Point::closestViewObs(const Vector3d& framepos, double& max_cos_angle) const
+{
+  Vector3d obs_dir(framepos - pos_); obs_dir.normalize();
+  const float ox = obs_dir[0], oy = obs_dir[1], oz = obs_dir[2];
+  const float* dx = obs_.dir(0);
+  const float* dy = obs_.dir(1);
+  const float* dz = obs_.dir(2);
+  const int n = obs_.size();
+  float cos_angle[MAX_OBS_NUM];
+  #pragma omp simd
+  for(int i=0; i<n; ++i)
+    cos_angle[i] = ox * dx[i] + oy * dy[i] + oz * dz[i];
+  int best = 0;
+  max_cos_angle = 0;
+  for(int i=0; i<n; ++i)
+  {
+    if(cos_angle[i] > max_cos_angle)
+    {
+      max_cos_angle = cos_angle[i];
+      best = i;
+    }
+  }
+  return best;
+}
+
 void Point::initNormal()
 {
   assert(!obs_.empty());
   const FeaturePtr ftr = obs_.back();
   assert(ftr->frame != nullptr);
   normal_ = ftr->frame->T_f_w_.rotation_matrix().transpose()*(-ftr->f);
-  normal_information_ = DiagonalMatrix<double,3,3>(pow(20/(pos_-ftr->frame->pos()).norm(),2), 1.0, 1.0);
   normal_set_ = true;
 }
 
@@ -140,41 +249,8 @@ bool Point::getClosePose(const FramePtr& new_frame, FeaturePtr& ftr) const
 
 bool Point::getCloseViewObs(const Vector3d& framepos, FeaturePtr& ftr, const Vector2d& cur_px) const
 {
-  // TODO: get frame with same point of view AND same pyramid level!
-  if(obs_.size() <= 0) return false;
-
-  Vector3d obs_dir(framepos - pos_); obs_dir.normalize();
-  auto min_it=obs_.begin();
-  double min_cos_angle = 0;
-
-  for(auto it=obs_.begin(), ite=obs_.end(); it!=ite; ++it)
-  {
-    Vector3d dir((*it)->T_f_w_.inverse().translation() - pos_); dir.normalize();
-    double cos_angle = obs_dir.dot(dir);
-    if(cos_angle > min_cos_angle)
-    {
-      min_cos_angle = cos_angle;
-      min_it = it;
-    }
-  }
-  ftr = *min_it;
-  
-  // Vector2d ftr_px = ftr->px;
-  // double pixel_dist = (cur_px-ftr_px).norm();
-  
-  // if(pixel_dist > 200) 
-  // {
-  //   ROS_ERROR("The pixel dist exceeds 200.");
-  //   return false;    
-  // }
-    
-  if(min_cos_angle < 0.5) // assume that observations larger than 60° are useless 0.5
-  {
-    // ROS_ERROR("The obseved angle is larger than 60°.");
-    return false;
-  }
-
-  return true;
+  double min_cos_angle;
+  return getCloseViewObs_test(framepos, ftr, cur_px, min_cos_angle);
 }
 
 bool Point::getCloseViewObs_test(const Vector3d& framepos, FeaturePtr& ftr, const Vector2d& cur_px, double& min_cos_angle) const
@@ -182,21 +258,7 @@ bool Point::getCloseViewObs_test(const Vector3d& framepos, FeaturePtr& ftr, cons
   // TODO: get frame with same point of view AND same pyramid level!
   if(obs_.size() <= 0) return false;
 
-  Vector3d obs_dir(framepos - pos_); obs_dir.normalize();
-  auto min_it=obs_.begin();
-  min_cos_angle = 0;
-
-  for(auto it=obs_.begin(), ite=obs_.end(); it!=ite; ++it)
-  {
-    Vector3d dir((*it)->T_f_w_.inverse().translation() - pos_); dir.normalize();
-    double cos_angle = obs_dir.dot(dir);
-    if(cos_angle > min_cos_angle)
-    {
-      min_cos_angle = cos_angle;
-      min_it = it;
-    }
-  }
-  ftr = *min_it;
+  ftr = obs_[closestViewObs(framepos, min_cos_angle)];
   
   // Vector2d ftr_px = ftr->px;
   // double pixel_dist = (cur_px-ftr_px).norm();
@@ -231,19 +293,27 @@ void Point::getFurthestViewObs(const Vector3d& framepos, FeaturePtr& ftr) const
   //     max_it = it;
   //   }
   // }
-  Vector3d obs_dir(framepos - pos_); obs_dir.normalize();
-  auto max_it=obs_.begin();
-  double maxdist = 0.0;
-  for(auto it=obs_.begin(), ite=obs_.end(); it!=ite; ++it)
+  // 光心在加入观测时已算好，先对所有观测算距离的平方（可向量化），再取最大值
+  const float fx = framepos[0], fy = framepos[1], fz = framepos[2];
+  const float* cx = obs_.center(0);
+  const float* cy = obs_.center(1);
+  const float* cz = obs_.center(2);
+  const int n = obs_.size();
+  float dist[MAX_OBS_NUM];
+  #pragma omp simd
+  for(int i=0; i<n; ++i)
+    dist[i] = (cx[i] - fx) * (cx[i] - fx) + (cy[i] - fy) * (cy[i] - fy) + (cz[i] - fz) * (cz[i] - fz);
+  int max_i = 0;
+  float maxdist = 0.0;
+  for(int i=0; i<n; ++i)
   {
-    double dist= ((*it)->T_f_w_.inverse().translation() - framepos).norm();
-    if(dist > maxdist)
+    if(dist[i] > maxdist)
     {
-      maxdist = dist;
-      max_it = it;
+      maxdist = dist[i];
+      max_i = i;
     }
   }
-  ftr = *max_it;
+  ftr = obs_[max_i];
 }
 
 void Point::optimize(const size_t n_iter)
@@ -315,6 +385,7 @@ void Point::optimize(const size_t n_iter)
 #ifdef POINT_OPTIMIZER_DEBUG
   cout << endl;
 #endif
+  obs_.updateDirs(pos_);
 }
 
 } // namespace svo
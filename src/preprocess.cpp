@@ -1,4 +1,5 @@
 #include "preprocess.h"
+#include "trace.h"
 
 #define RETURN0     0x00
 #define RETURN0AND1 0x10
@@ -42,12 +43,14 @@ void Preprocess::set(bool feat_en, int lid_type, double bld, int pfilt_num)
 
 void Preprocess::process(const livox_ros_driver::CustomMsg::ConstPtr &msg, PointCloudXYZI::Ptr &pcl_out)
 {  
+  TRACE_SCOPE("preprocess");
   avia_handler(msg);
   *pcl_out = pl_surf;
 }
 
 void Preprocess::process(const sensor_msgs::PointCloud2::ConstPtr &msg, PointCloudXYZI::Ptr &pcl_out)
 {
+  TRACE_SCOPE("preprocess");
   switch (lidar_type)
   {
   case OUST64:
@@ -0,0 +1,109 @@
+#include "rgb_map.h"
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+void to_point(const RGBVoxelMap::Voxel &voxel, PointTypeRGB &p)
+{
+  p.x = voxel.x;
+  p.y = voxel.y;
+  p.z = voxel.z;
+  p.r = uint8_t(voxel.r + 0.5f);
+  p.g = uint8_t(voxel.g + 0.5f);
+  p.b = uint8_t(voxel.b + 0.5f);
+}
+}
+
+RGBVoxelMap::RGBVoxelMap(double resolution)
+    : resolution(resolution)
+{
+}
+
+void RGBVoxelMap::set_resolution(double resolution)
+{
+  this->resolution = resolution;
+  voxels.clear();
+  updated_keys.clear();
+}
+
+/**
+ * @brief 把一帧着色点融合进体素：第一次观测新建体素，之后按观测次数更新位置和颜色的均值
+ */
+void RGBVoxelMap::insert(const PointCloudXYZRGB &cloud)
+{
+  const double inv_res = 1.0 / resolution;
+  for (const PointTypeRGB &p : cloud.points)
+  {
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) continue;
+    VOXEL_KEY key(int64_t(std::floor(p.x * inv_res)), int64_t(std::floor(p.y * inv_res)), int64_t(std::floor(p.z * inv_res)));
+    auto it = voxels.find(key);
+    if (it == voxels.end())
+    {
+      Voxel voxel;
+      voxel.x = p.x;
+      voxel.y = p.y;
+      voxel.z = p.z;
+      voxel.r = p.r;
+      voxel.g = p.g;
+      voxel.b = p.b;
+      voxel.hits = 1;
+      voxel.updated = true;
+      voxels.emplace(key, voxel);
+      updated_keys.push_back(key);
+      continue;
+    }
+    Voxel &voxel = it->second;
+    voxel.hits ++;
+    const float w = 1.0f / voxel.hits;
+    voxel.x += (p.x - voxel.x) * w;
+    voxel.y += (p.y - voxel.y) * w;
+    voxel.z += (p.z - voxel.z) * w;
+    voxel.r += (p.r - voxel.r) * w;
+    voxel.g += (p.g - voxel.g) * w;
+    voxel.b += (p.b - voxel.b) * w;
+    if (!voxel.updated)
+    {
+      voxel.updated = true;
+      updated_keys.push_back(key);
+    }
+  }
+}
+
+void RGBVoxelMap::take_updated(PointCloudXYZRGB &out)
+{
+  out.clear();
+  out.reserve(updated_keys.size());
+  for (const VOXEL_KEY &key : updated_keys)
+  {
+    Voxel &voxel = voxels[key];
+    voxel.updated = false;
+    PointTypeRGB p;
+    to_point(voxel, p);
+    out.push_back(p);
+  }
+  updated_keys.clear();
+}
+
+/**
+ * @brief 按 TileWriter 的格式（rgb 字段为打包的 float）分批写盘，每批 1M 点
+ */
+void RGBVoxelMap::save(TileWriter &writer) const
+{
+  const size_t batch_size = 1 << 20;
+  std::vector<TilePoint> batch;
+  batch.reserve(std::min(batch_size, voxels.size()));
+  for (const auto &it : voxels)
+  {
+    PointTypeRGB p;
+    to_point(it.second, p);
+    batch.push_back({p.x, p.y, p.z, p.rgb});
+    if (batch.size() == batch_size)
+    {
+      writer.push(std::move(batch));
+      batch = std::vector<TilePoint>();
+      batch.reserve(batch_size);
+    }
+  }
+  writer.push(std::move(batch));
+}
@@ -0,0 +1,97 @@
+#include "static_kdtree.h"
+#include <cmath>
+#include <algorithm>
+
+#define STATIC_KDTREE_MAX_K  (32)
+
+void StaticKdTree::Build(const PointVector &points)
+{
+  pts.clear();
+  pts.reserve(points.size());
+  for (const PointType &p : points)
+    if (std::isfinite(p.x) && std::isfinite(p.y) && std::isfinite(p.z)) pts.push_back({p.x, p.y, p.z, p.intensity});
+  dims.assign(pts.size(), 0);
+  build(0, pts.size());
+}
+
+/**
+ * @brief 在包围盒最长的维度上按中位数划分 [lo, hi)
+ */
+void StaticKdTree::build(size_t lo, size_t hi)
+{
+  if (hi - lo <= STATIC_KDTREE_LEAF) return;
+  float min_v[3] = {INFINITY, INFINITY, INFINITY}, max_v[3] = {-INFINITY, -INFINITY, -INFINITY};
+  for (size_t i = lo; i < hi; i++)
+    for (int d = 0; d < 3; d++)
+    {
+      min_v[d] = std::min(min_v[d], pts[i][d]);
+      max_v[d] = std::max(max_v[d], pts[i][d]);
+    }
+  int dim = 0;
+  for (int d = 1; d < 3; d++)
+    if (max_v[d] - min_v[d] > max_v[dim] - min_v[dim]) dim = d;
+  const size_t mid = (lo + hi) / 2;
+  std::nth_element(pts.begin() + lo, pts.begin() + mid, pts.begin() + hi,
+                   [dim](const Pt &a, const Pt &b) { return a[dim] < b[dim]; });
+  dims[mid] = uint8_t(dim);
+  build(lo, mid);
+  build(mid + 1, hi);
+}
+
+void StaticKdTree::Nearest_Search(const PointType &point, int k_nearest, PointVector &nearest, std::vector<float> &dists) const
+{
+  const int k = std::max(1, std::min(k_nearest, STATIC_KDTREE_MAX_K));
+  float best_d[STATIC_KDTREE_MAX_K];
+  uint32_t best_i[STATIC_KDTREE_MAX_K];
+  int n = 0;
+  const float q[3] = {point.x, point.y, point.z};
+  if (!pts.empty()) search(0, pts.size(), q, k, best_d, best_i, n);
+  nearest.resize(n);
+  dists.resize(n);
+  for (int i = 0; i < n; i++)
+  {
+    const Pt &p = pts[best_i[i]];
+    PointType &out = nearest[i];
+    out.x = p.x;
+    out.y = p.y;
+    out.z = p.z;
+    out.intensity = p.intensity;
+    dists[i] = best_d[i];
+  }
+}
+
+/**
+ * @brief 先搜查询点所在一侧，另一侧只在划分面比当前第 k 近的点更近时才搜；best_d 按距离升序保存
+ */
+void StaticKdTree::search(size_t lo, size_t hi, const float q[3], int k, float *best_d, uint32_t *best_i, int &n) const
+{
+  auto try_point = [&](size_t i)
+  {
+    const float dx = pts[i].x - q[0], dy = pts[i].y - q[1], dz = pts[i].z - q[2];
+    const float d = dx * dx + dy * dy + dz * dz;
+    if (n == k && d >= best_d[k - 1]) return;
+    int j = n < k ? n++ : k - 1;
+    for (; j > 0 && best_d[j - 1] > d; j--)
+    {
+      best_d[j] = best_d[j - 1];
+      best_i[j] = best_i[j - 1];
+    }
+    best_d[j] = d;
+    best_i[j] = uint32_t(i);
+  };
+  if (hi - lo <= STATIC_KDTREE_LEAF)
+  {
+    for (size_t i = lo; i < hi; i++) try_point(i);
+    return;
+  }
+  const size_t mid = (lo + hi) / 2;
+  const float diff = q[dims[mid]] - pts[mid][dims[mid]];
+  if (diff < 0) search(lo, mid, q, k, best_d, best_i, n);
+  else search(mid + 1, hi, q, k, best_d, best_i, n);
+  try_point(mid);
+  if (n < k || diff * diff < best_d[n - 1])
+  {
+    if (diff < 0) search(mid + 1, hi, q, k, best_d, best_i, n);
+    else search(lo, mid, q, k, best_d, best_i, n);
+  }
+}
@@ -0,0 +1,205 @@
+#include "tile_writer.h"
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <sys/stat.h>
+
+namespace
+{
+// 每个块号占21位（有符号），50m 的块可覆盖约 ±5e7 m
+int64_t tile_key(int ix, int iy, int iz)
+{
+  const int64_t mask = (1 << 21) - 1;
+  return ((int64_t(ix) & mask) << 42) | ((int64_t(iy) & mask) << 21) | (int64_t(iz) & mask);
+}
+
+// 逐级创建目录
+bool make_dir(const std::string &dir)
+{
+  for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1))
+  {
+    const std::string sub = dir.substr(0, pos);
+    struct stat st;
+    if (stat(sub.c_str(), &st) != 0 && mkdir(sub.c_str(), 0755) != 0) return false;
+    if (pos == std::string::npos) return true;
+  }
+}
+}
+
+TileWriter::TileWriter()
+    : tile_size(50.0), total_points(0), staged(0), running_(false)
+{
+}
+
+TileWriter::~TileWriter()
+{
+  stop();
+}
+
+bool TileWriter::start(const std::string &dir, const std::string &field, double tile_size)
+{
+  if (running_) return true;
+  if (!make_dir(dir))
+  {
+    printf("[ TILE ]: failed to create %s.\n", dir.c_str());
+    return false;
+  }
+  this->dir = dir;
+  this->field = field;
+  this->tile_size = tile_size > 0 ? tile_size : 50.0;
+  tiles.clear();
+  total_points = 0;
+  staged = 0;
+  running_ = true;
+  thread_ = std::thread(&TileWriter::worker, this);
+  return true;
+}
+
+/**
+ * @brief 交给后台线程写盘；等待写盘的点超过 TILE_MAX_STAGED 时阻塞，保证内存有界
+ */
+void TileWriter::push(std::vector<TilePoint> &&points)
+{
+  if (points.empty()) return;
+  std::unique_lock<std::mutex> lock(mtx);
+  sig_pop.wait(lock, [this]{ return staged < TILE_MAX_STAGED || !running_; });
+  if (!running_) return;
+  staged += points.size();
+  batches.push_back(std::move(points));
+  sig_push.notify_one();
+}
+
+void TileWriter::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!running_) return;
+    running_ = false;
+  }
+  sig_push.notify_all();
+  sig_pop.notify_all();
+  if (thread_.joinable()) thread_.join();
+  finish();
+}
+
+void TileWriter::worker()
+{
+  while (true)
+  {
+    std::vector<TilePoint> batch;
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      sig_push.wait(lock, [this]{ return !batches.empty() || !running_; });
+      if (batches.empty()) break;   // 已停止且队列为空
+      batch = std::move(batches.front());
+      batches.pop_front();
+      staged -= batch.size();
+    }
+    sig_pop.notify_all();
+    write_batch(batch);
+  }
+}
+
+/**
+ * @brief 按块分组后追加到各块的原始文件，每个块只打开一次
+ */
+void TileWriter::write_batch(const std::vector<TilePoint> &batch)
+{
+  std::unordered_map<int64_t, std::vector<TilePoint>> groups;
+  for (const TilePoint &p : batch)
+  {
+    if (!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z)) continue;
+    const int ix = int(std::floor(p.x / tile_size));
+    const int iy = int(std::floor(p.y / tile_size));
+    const int iz = int(std::floor(p.z / tile_size));
+    const int64_t key = tile_key(ix, iy, iz);
+    auto it = tiles.find(key);
+    if (it == tiles.end())
+    {
+      Tile tile;
+      tile.ix = ix;
+      tile.iy = iy;
+      tile.iz = iz;
+      tile.count = 0;
+      tile.min[0] = tile.min[1] = tile.min[2] = INFINITY;
+      tile.max[0] = tile.max[1] = tile.max[2] = -INFINITY;
+      it = tiles.emplace(key, tile).first;
+    }
+    Tile &tile = it->second;
+    tile.min[0] = std::min(tile.min[0], p.x); tile.max[0] = std::max(tile.max[0], p.x);
+    tile.min[1] = std::min(tile.min[1], p.y); tile.max[1] = std::max(tile.max[1], p.y);
+    tile.min[2] = std::min(tile.min[2], p.z); tile.max[2] = std::max(tile.max[2], p.z);
+    groups[key].push_back(p);
+  }
+  for (auto &group : groups)
+  {
+    Tile &tile = tiles[group.first];
+    // 块在本次运行中第一次写入时截断，避免追加到上次运行残留的文件
+    FILE *fp = fopen(raw_name(tile).c_str(), tile.count == 0 ? "wb" : "ab");
+    if (fp == nullptr)
+    {
+      printf("[ TILE ]: failed to open %s.\n", raw_name(tile).c_str());
+      continue;
+    }
+    const size_t n = fwrite(group.second.data(), sizeof(TilePoint), group.second.size(), fp);
+    fclose(fp);
+    tile.count += n;
+    total_points += n;
+  }
+}
+
+/**
+ * @brief 给每个块补上 PCD 文件头（数据段原样复制），写出索引
+ */
+void TileWriter::finish()
+{
+  std::vector<Tile> order;
+  for (const auto &it : tiles) order.push_back(it.second);
+  std::sort(order.begin(), order.end(), [](const Tile &a, const Tile &b) {
+    return a.ix != b.ix ? a.ix < b.ix : (a.iy != b.iy ? a.iy < b.iy : a.iz < b.iz);
+  });
+
+  std::vector<char> buf(1 << 20);
+  FILE *fp_index = fopen((dir + "/index.txt").c_str(), "w");
+  if (fp_index) fprintf(fp_index, "# tile_size %.3f field %s\n# ix iy iz points min_x min_y min_z max_x max_y max_z file\n", tile_size, field.c_str());
+  for (const Tile &tile : order)
+  {
+    const std::string raw = raw_name(tile), pcd = pcd_name(tile);
+    FILE *fp_raw = fopen(raw.c_str(), "rb");
+    FILE *fp_pcd = fopen(pcd.c_str(), "wb");
+    if (fp_raw == nullptr || fp_pcd == nullptr)
+    {
+      printf("[ TILE ]: failed to convert %s.\n", raw.c_str());
+      if (fp_raw) fclose(fp_raw);
+      if (fp_pcd) fclose(fp_pcd);
+      continue;
+    }
+    fprintf(fp_pcd, "# .PCD v0.7 - Point Cloud Data file format\nVERSION 0.7\nFIELDS x y z %s\nSIZE 4 4 4 4\nTYPE F F F F\nCOUNT 1 1 1 1\n"
+                    "WIDTH %lu\nHEIGHT 1\nVIEWPOINT 0 0 0 1 0 0 0\nPOINTS %lu\nDATA binary\n",
+            field.c_str(), (unsigned long)tile.count, (unsigned long)tile.count);
+    size_t n;
+    while ((n = fread(buf.data(), 1, buf.size(), fp_raw)) > 0) fwrite(buf.data(), 1, n, fp_pcd);
+    fclose(fp_raw);
+    fclose(fp_pcd);
+    remove(raw.c_str());
+    if (fp_index)
+      fprintf(fp_index, "%d %d %d %lu %.3f %.3f %.3f %.3f %.3f %.3f %s\n", tile.ix, tile.iy, tile.iz, (unsigned long)tile.count,
+              tile.min[0], tile.min[1], tile.min[2], tile.max[0], tile.max[1], tile.max[2], pcd.substr(dir.size() + 1).c_str());
+  }
+  if (fp_index) fclose(fp_index);
+  printf("[ TILE ]: %lu points in %d tiles written to %s.\n", (unsigned long)total_points, int(order.size()), dir.c_str());
+}
+
+std::string TileWriter::raw_name(const Tile &tile) const
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/tile_%d_%d_%d.raw", tile.ix, tile.iy, tile.iz);
+  return dir + name;
+}
+
+std::string TileWriter::pcd_name(const Tile &tile) const
+{
+  char name[64];
+  snprintf(name, sizeof(name), "/tile_%d_%d_%d.pcd", tile.ix, tile.iy, tile.iz);
+  return dir + name;
+}
@@ -0,0 +1,156 @@
+#include "trace.h"
+#include <map>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+std::atomic<bool> Tracer::enabled_(false);
+std::atomic<int> Tracer::frame_(-1);
+
+namespace
+{
+struct TraceSpan
+{
+  const TraceStage *stage;
+  int64_t begin_ns;
+  int64_t dur_ns;
+  uint32_t tid;
+  int32_t frame;
+};
+
+struct StrLess
+{
+  bool operator()(const char *a, const char *b) const { return strcmp(a, b) < 0; }
+};
+
+// 阶段只增不删，进程结束前一直有效
+std::mutex mtx_trace;
+std::map<const char *, TraceStage *, StrLess> stages;
+std::vector<TraceStage *> stage_order;
+std::vector<TraceSpan> spans(TRACE_MAX_SPANS);
+uint64_t span_head = 0;
+std::atomic<uint32_t> thread_counter(0);
+
+uint32_t thread_id()
+{
+  thread_local uint32_t tid = thread_counter.fetch_add(1);
+  return tid;
+}
+}
+
+TraceStage::TraceStage(const char *name)
+    : name(name), count(0), sum_ns(0.0)
+{
+}
+
+TraceStage *Tracer::stage(const char *name)
+{
+  std::lock_guard<std::mutex> lock(mtx_trace);
+  auto it = stages.find(name);
+  if (it != stages.end()) return it->second;
+  TraceStage *stage = new TraceStage(name);
+  stages[name] = stage;
+  stage_order.push_back(stage);
+  return stage;
+}
+
+int64_t Tracer::now_ns()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Tracer::record(TraceStage *stage, int64_t begin_ns, int64_t end_ns)
+{
+  const int64_t dur_ns = end_ns - begin_ns;
+  const uint32_t tid = thread_id();
+  const int32_t frame = frame_.load(std::memory_order_relaxed);
+  std::lock_guard<std::mutex> lock(mtx_trace);
+  stage->window[stage->count % TRACE_WINDOW] = dur_ns;
+  stage->count ++;
+  stage->sum_ns += dur_ns;
+  TraceSpan &span = spans[span_head % TRACE_MAX_SPANS];
+  span.stage    = stage;
+  span.begin_ns = begin_ns;
+  span.dur_ns   = dur_ns;
+  span.tid      = tid;
+  span.frame    = frame;
+  span_head ++;
+}
+
+void Tracer::record_duration(TraceStage *stage, double dur_s)
+{
+  const int64_t end_ns = now_ns();
+  record(stage, end_ns - int64_t(dur_s * 1e9), end_ns);
+}
+
+TraceStage::Summary Tracer::summary(const TraceStage *stage)
+{
+  TraceStage::Summary sum;
+  std::vector<int64_t> t;
+  {
+    std::lock_guard<std::mutex> lock(mtx_trace);
+    sum.count   = stage->count;
+    sum.mean_ms = stage->count > 0 ? stage->sum_ns / stage->count * 1e-6 : 0.0;
+    t.assign(stage->window, stage->window + std::min<uint64_t>(stage->count, TRACE_WINDOW));
+  }
+  sum.p50_ms = sum.p95_ms = sum.p99_ms = sum.max_ms = 0.0;
+  if (t.empty()) return sum;
+  sort(t.begin(), t.end());
+  auto pct = [&t](double p) { return t[std::min(t.size() - 1, size_t(p * t.size()))] * 1e-6; };
+  sum.p50_ms = pct(0.5);
+  sum.p95_ms = pct(0.95);
+  sum.p99_ms = pct(0.99);
+  sum.max_ms = t.back() * 1e-6;
+  return sum;
+}
+
+void Tracer::print_summary(FILE *fp)
+{
+  std::vector<TraceStage *> order;
+  {
+    std::lock_guard<std::mutex> lock(mtx_trace);
+    order = stage_order;
+  }
+  fprintf(fp, "[ TRACE ]: %-24s %8s %10s %10s %10s %10s %10s (ms, last %d)\n", "stage", "n", "mean", "p50", "p95", "p99", "max", TRACE_WINDOW);
+  for (const TraceStage *stage : order)
+  {
+    TraceStage::Summary sum = summary(stage);
+    if (sum.count == 0) continue;
+    fprintf(fp, "[ TRACE ]: %-24s %8lu %10.3f %10.3f %10.3f %10.3f %10.3f\n", stage->name, (unsigned long)sum.count,
+            sum.mean_ms, sum.p50_ms, sum.p95_ms, sum.p99_ms, sum.max_ms);
+  }
+}
+
+/**
+ * @brief 把环形缓冲区中的区间写成 Chrome trace 的 JSON（complete event，单位us）
+ */
+bool Tracer::dump_chrome(const std::string &file_name)
+{
+  std::vector<TraceSpan> out;
+  {
+    std::lock_guard<std::mutex> lock(mtx_trace);
+    const uint64_t n = std::min<uint64_t>(span_head, TRACE_MAX_SPANS);
+    out.reserve(n);
+    for (uint64_t i = span_head - n; i < span_head; i++) out.push_back(spans[i % TRACE_MAX_SPANS]);
+  }
+  FILE *fp = fopen(file_name.c_str(), "w");
+  if (fp == nullptr)
+  {
+    printf("[ TRACE ]: failed to open %s.\n", file_name.c_str());
+    return false;
+  }
+  const int64_t t0 = out.empty() ? 0 : out.front().begin_ns;
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (size_t i = 0; i < out.size(); i++)
+  {
+    const TraceSpan &span = out[i];
+    fprintf(fp, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}%s\n",
+            span.stage->name, span.tid, (span.begin_ns - t0) * 1e-3, span.dur_ns * 1e-3, span.frame, i + 1 < out.size() ? "," : "");
+  }
+  fprintf(fp, "]}\n");
+  fclose(fp);
+  printf("[ TRACE ]: %d spans written to %s.\n", int(out.size()), file_name.c_str());
+  return true;
+}